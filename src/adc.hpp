@@ -5,19 +5,286 @@
 
 #include "config.hpp"
 #include "msp430i2.hpp"
+#include "scope.hpp"
+#include "util.hpp"
+#include "util/ring_buffer.hpp"
+
+#include <algorithm>
+#include <limits>
 
 namespace meter {
 
+  /// \return log2 of `length`, if it is a power of two, otherwise -1.
+  constexpr int averaging_shift(const int32_t length) {
+    if ((length <= 0) || ((length & (length - 1)) != 0)) {
+      return -1;
+    }
+    return std::countr_zero(static_cast<uint32_t>(length));
+  }
+  static_assert(averaging_shift(1) == 0);
+  static_assert(averaging_shift(256) == 8);
+  static_assert(averaging_shift(65'536) == 16);
+  static_assert(averaging_shift(100) == -1);
+
+  /// Divides the accumulated `sum` by the number of samples, rounding to
+  /// nearest with ties away from zero, so that the result does not depend on
+  /// the length but for its resolution. Power-of-two lengths (`shift` >= 0)
+  /// are divided by a shift, everything else by a 64-bit division.
+  constexpr int64_t wide_average(const int64_t sum, const int32_t length,
+                                 const int shift) {
+    if (shift >= 0) {
+      const auto half = (int64_t{1} << shift) >> 1;
+      return (sum < 0) ? -((half - sum) >> shift) : ((sum + half) >> shift);
+    }
+    const auto half = int64_t{length / 2};
+    return ((sum < 0) ? (sum - half) : (sum + half)) / length;
+  }
+
+  constexpr int32_t average(const int64_t sum, const int32_t length,
+                            const int shift) {
+    return static_cast<int32_t>(wide_average(sum, length, shift));
+  }
+  static_assert(average(int64_t{0x7f'ffff} * 65'536, 65'536, 16) == 0x7f'ffff);
+  static_assert(average(int64_t{-0x80'0000} * 65'536, 65'536, 16)
+                == -0x80'0000);
+  static_assert(average(1'000, 256, 8) == 4);
+  static_assert(average(-1'000, 256, 8) == -4);
+  static_assert(average(7, 1, 0) == 7);
+  static_assert(average(3'000, 3, -1) == 1'000);
+  // both ways round alike, also for negative sums and ties
+  static_assert(average(-1'000, 256, 8) == average(-1'000, 256, -1));
+  static_assert(average(-640, 256, 8) == -3);
+  static_assert(average(-640, 256, -1) == -3);
+  static_assert(average(-5, 2, 1) == average(-5, 2, -1));
+  static_assert(average(-1'249, 250, -1) == -5);
+  static_assert(average(-1'251, 250, -1) == -5);
+
+  enum class Channel_mode : uint8_t {
+    /// the mean of the samples
+    DC,
+    /// the true RMS value of the samples, AC and DC components
+    RMS,
+    /// the RMS value with the DC component removed
+    AC
+  };
+
+  /// The RMS value of the samples around their mean.
+  /// \param sum The sum of the deviations of the samples from some pivot.
+  ///    The closer the pivot is to the mean, the more accurate the result.
+  /// \param sum_of_squares The sum of the squared deviations.
+  constexpr uint32_t ac_rms(const int64_t sum, const uint64_t sum_of_squares,
+                            const int32_t length, const int shift) {
+    const auto mean = average(sum, length, shift);
+    const auto mean_square =
+        (shift >= 0)
+            ? (sum_of_squares + ((uint64_t{1U} << shift) >> 1U)) >> shift
+            : (sum_of_squares + static_cast<uint64_t>(length / 2))
+                  / static_cast<uint64_t>(length);
+    const auto square_of_mean = static_cast<uint64_t>(int64_t{mean} * mean);
+    return (mean_square > square_of_mean)
+               ? isqrt(mean_square - square_of_mean)
+               : 0U;
+  }
+  static_assert(ac_rms(0, 4 * 100 * 100, 4, 2) == 100U);
+  static_assert(ac_rms(4 * 1'000, 4 * 1'000 * 1'000, 4, 2) == 0U);
+  static_assert(ac_rms(0, 3 * 100 * 100, 3, -1) == 100U);
+
+  /// The square of the largest deviation of a conversion result from a pivot,
+  /// which is a conversion result as well, i.e. (2^24 - 1)^2.
+  constexpr auto max_squared_deviation =
+      static_cast<uint64_t>(int64_t{msp430i2::SD24::full_scale}
+                            - msp430i2::SD24::negative_full_scale)
+      * static_cast<uint64_t>(int64_t{msp430i2::SD24::full_scale}
+                              - msp430i2::SD24::negative_full_scale);
+
+  /// The most samples, whose squared deviations `ac_rms()` can sum up and
+  /// round without overflowing 64 bits.
+  constexpr auto max_rms_window =
+      (std::numeric_limits<uint64_t>::max()
+       - static_cast<uint64_t>(max_averaging_length / 2))
+      / max_squared_deviation;
+
+  /// Line-synchronous integration sizes the averaging window to a whole
+  /// number of mains periods, so that hum cancels out of the mean.
+  enum class Line_sync : uint8_t { Off, Hz50, Hz60, Auto };
+
+  /// \return The length of one period of `frequency_Hz` in 1/256 samples,
+  ///    as given by the modulator clock and the oversampling ratio.
+  constexpr int32_t line_period_q8(const int frequency_Hz) {
+    const auto divisor = int32_t{oversampling_ratio} * frequency_Hz;
+    return ((modulator_frequency_Hz * 256) + (divisor / 2)) / divisor;
+  }
+  static_assert(line_period_q8(50) == 80 * 256);
+  static_assert(line_period_q8(60) == 17'067);
+
+  /// \return The length in 1/256 samples of the whole number of periods,
+  ///    which comes closest to `length` samples, but at least one period.
+  constexpr int32_t line_window_q8(const int32_t length,
+                                   const int32_t period_q8) {
+    const auto max_periods = (max_averaging_length * 256) / period_q8;
+    const auto periods = ((length * 256) + (period_q8 / 2)) / period_q8;
+    return std::clamp(periods, int32_t{1}, max_periods) * period_q8;
+  }
+  static_assert(line_window_q8(256, line_period_q8(50)) == 240 * 256);
+  static_assert(line_window_q8(256, line_period_q8(60)) == 4 * 17'067);
+  static_assert(line_window_q8(1, line_period_q8(50)) == 80 * 256);
+  static_assert(line_window_q8(max_averaging_length, line_period_q8(60))
+                <= max_averaging_length * 256);
+
+  /// Averages the consecutive windows of one channel over an adaptive length.
+  /// While the signal is stable, the length grows up to a maximum, so the
+  /// noise goes down. A step beyond the noise restarts it, so the reading
+  /// follows within one window. Beyond the maximum length, the older samples
+  /// fade out exponentially.
+  class Adaptive_average {
+    public:
+      /// A step must exceed this many standard errors of the window mean.
+      static constexpr auto step_threshold = 4;
+
+      /// \param window_sum The sum of the samples of the window.
+      /// \param noise_rms The RMS noise of the samples within the window.
+      /// \return The mean over the adaptive length.
+      constexpr int32_t add(const int64_t window_sum, const int32_t length,
+                            const int shift, const uint32_t noise_rms,
+                            const int32_t max_length) {
+        if (length_ > 0) {
+          const auto deviation = average(window_sum, length, shift) - mean_;
+          const auto squared_deviation =
+              static_cast<uint64_t>(int64_t{deviation} * deviation);
+          const auto squared_error = static_cast<uint64_t>(wide_average(
+              static_cast<int64_t>(uint64_t{noise_rms} * noise_rms
+                                   * (step_threshold * step_threshold)),
+              length, shift));
+          if (squared_deviation > squared_error) {
+            reset();
+          }
+        }
+        if ((length_ >= length) && (length_ + length > max_length)) {
+          sum_ -= int64_t{mean_} * length;
+          length_ -= length;
+        }
+        sum_ += window_sum;
+        length_ += length;
+        const auto rounding = (sum_ < 0) ? -(length_ / 2) : (length_ / 2);
+        mean_ = static_cast<int32_t>((sum_ + rounding) / length_);
+        return mean_;
+      }
+
+      /// The number of samples, which the mean is made of.
+      constexpr int32_t length() const { return length_; }
+
+      constexpr void reset() {
+        sum_ = 0;
+        length_ = 0;
+      }
+
+    private:
+      int64_t sum_{0};
+      int32_t length_{0};
+      int32_t mean_{0};
+  };
+
+  /// The smallest and the largest sample seen.
+  struct Extremes {
+      int32_t minimum{std::numeric_limits<int32_t>::max()};
+      int32_t maximum{std::numeric_limits<int32_t>::min()};
+
+      constexpr bool empty() const { return minimum > maximum; }
+
+      constexpr void add(const int32_t sample) {
+        minimum = std::min(minimum, sample);
+        maximum = std::max(maximum, sample);
+      }
+
+      constexpr void add(const Extremes &other) {
+        minimum = std::min(minimum, other.minimum);
+        maximum = std::max(maximum, other.maximum);
+      }
+  };
+
+  /// Tells 50 Hz from 60 Hz hum by the samples between its rising crossings
+  /// of the mean. A crossing must pass a hysteresis band, so that noise does
+  /// not count.
+  class Line_frequency_detector {
+    public:
+      /// The number of periods measured at once.
+      static constexpr auto periods = 8;
+
+      /// \param deviation The deviation of the sample from the mean.
+      /// \return Whether the measurement is complete, i.e. `periods` periods
+      ///    or half a second have passed.
+      constexpr bool add(const int32_t deviation, const int32_t hysteresis) {
+        ++samples_;
+        if (deviation < -hysteresis) {
+          armed_ = true;
+        } else if (armed_ && (deviation > hysteresis)) {
+          armed_ = false;
+          if (crossings_ == 0) {
+            first_crossing_ = samples_;
+          }
+          last_crossing_ = samples_;
+          ++crossings_;
+        }
+        return (crossings_ > periods)
+               || (samples_ >= (sampling_frequency_Hz / 2));
+      }
+
+      /// \return 50 or 60, if the crossings are periodic at about either
+      ///    frequency, otherwise 0.
+      constexpr int frequency_Hz() const {
+        if (crossings_ < 3) {
+          return 0;
+        }
+        const auto frequency = (int32_t{sampling_frequency_Hz}
+                                * (crossings_ - 1))
+                               / (last_crossing_ - first_crossing_);
+        if ((frequency < 45) || (frequency >= 66)) {
+          return 0;
+        }
+        return (frequency < 55) ? 50 : 60;
+      }
+
+      constexpr void reset() { *this = {}; }
+
+    private:
+      int32_t samples_{0};
+      int32_t first_crossing_{0};
+      int32_t last_crossing_{0};
+      int32_t crossings_{0};
+      bool armed_{false};
+  };
+
   class AD_converter {
     public:
+      /// One sample of every channel
+      using Frame = Array<int32_t, used_channels>;
+
+      /// The number of conversions of a channel, which are discarded after
+      /// its gain was switched: the one in progress and the three the sinc3
+      /// filter needs to settle.
+      static constexpr auto settling_conversions = 4;
+
+      /// The auto-ranging steps the gain down, when a sample of the last
+      /// reading reached `range_down_level`, and up, when all of them stayed
+      /// below `range_up_level`, i.e. below 3/4 full scale after doubling.
+      static constexpr auto range_down_level = 0x70'0000;
+      static constexpr auto range_up_level = 0x30'0000;
+      static_assert(2 * range_up_level < range_down_level);
+
+      /// All channels convert with the same oversampling ratio, because they
+      /// are grouped, so that the samples of a frame are simultaneous.
       static void init() {
         using namespace msp430i2;
 
+        constexpr auto osr = SD24::oversampling_ratio_bits(oversampling_ratio);
         store(SD24CTL, SD24REFS);
-        store(SD24CCTL0, SD24LSBTOG | SD24DF | SD24IE | SD24GRP);
-        store(SD24CCTL1, SD24LSBTOG | SD24DF | SD24GRP);
-        store(SD24CCTL2, SD24LSBTOG | SD24DF | SD24GRP);
-        store(SD24CCTL3, SD24LSBTOG | SD24DF);
+        store(SD24CCTL0, SD24LSBTOG | SD24DF | SD24IE | SD24GRP | osr);
+        store(SD24CCTL1, SD24LSBTOG | SD24DF | SD24GRP | osr);
+        store(SD24CCTL2, SD24LSBTOG | SD24DF | SD24GRP | osr);
+        store(SD24CCTL3, SD24LSBTOG | SD24DF | osr);
+        for (auto i = 0; i < used_channels; ++i) {
+          SD24::set_gain(i, u8{0U});
+        }
       }
 
       static void start_conversion() { msp430i2::SD24::start_conversion<3>(); }
@@ -25,39 +292,490 @@ namespace meter {
 
       static bool overflow() { return msp430i2::SD24::any_overflow(); }
 
-      constexpr int32_t get_conversion_result(const int channel) {
+      /// \return The mean of the last averaging window.
+      constexpr int32_t get_conversion_result(const int channel) const {
         return averages_[channel];
       }
 
+      /// \return The smallest and the largest sample of the last averaging
+      ///    window.
+      constexpr const Extremes &get_extremes(const int channel) const {
+        return extremes_[channel];
+      }
+
+      /// \return The smallest and the largest sample since the last
+      ///    `reset_hold()`, up to the last averaging window.
+      constexpr const Extremes &get_held_extremes(const int channel) const {
+        return held_extremes_[channel];
+      }
+
+      void reset_hold() { held_extremes_ = {}; }
+
+      /// \return The reading of the last averaging window according to the
+      ///    mode of the channel. RMS values are returned as the conversion
+      ///    result, which is `offset` plus the RMS value, so that they are
+      ///    scaled like the mean by `apply()`.
+      constexpr int32_t get_reading(const int channel,
+                                    const int32_t offset) const {
+        switch (modes_[channel]) {
+        case Channel_mode::RMS:
+          return offset + static_cast<int32_t>(get_rms(channel, offset));
+        case Channel_mode::AC:
+          return offset + static_cast<int32_t>(ac_rms_[channel]);
+        case Channel_mode::DC:
+          break;
+        }
+        return averages_[channel];
+      }
+
+      /// \return The true RMS value of the last averaging window around
+      ///    `offset`. Only available for channels in an RMS mode and for the
+      ///    power channels.
+      constexpr uint32_t get_rms(const int channel,
+                                 const int32_t offset) const {
+        const auto dc = int64_t{averages_[channel]} - offset;
+        const auto ac = uint64_t{ac_rms_[channel]};
+        return isqrt(static_cast<uint64_t>(dc * dc) + (ac * ac));
+      }
+
+      /// \return The mean of the sample-by-sample products of the power
+      ///    channels during the last averaging window. The SD24 converts all
+      ///    channels of the group simultaneously, so the samples of a frame
+      ///    belong together.
+      constexpr int64_t get_mean_product() const { return mean_product_; }
+
+      /// Selects the channels, whose samples are multiplied, see
+      /// `get_mean_product()`.
+      void set_power_channels(const int voltage_channel,
+                              const int current_channel) {
+        if ((voltage_channel == voltage_channel_)
+            && (current_channel == current_channel_)) {
+          return;
+        }
+        voltage_channel_ = voltage_channel;
+        current_channel_ = current_channel;
+        select_squared_channels();
+        discard_window();
+      }
+
+      Channel_mode mode(const int channel) const { return modes_[channel]; }
+
+      /// Selects what `get_reading()` returns for `channel`. The partial sums
+      /// of the current window are discarded.
+      void set_mode(const int channel, const Channel_mode mode) {
+        modes_[channel] = mode;
+        select_squared_channels();
+        discard_window();
+      }
+
       static constexpr int32_t to_uV(const int32_t conversion_result) {
         return static_cast<int32_t>(
             (int64_t{conversion_result} * msp430i2::SD24::reference_uV)
             / msp430i2::SD24::full_scale);
       }
 
-      /// \return Whether a new averaged result is available.
-      bool on_conversion_done() {
+      int32_t averaging_length() const { return averaging_length_; }
+
+      /// The number of samples of the last averaging window, which differs
+      /// from `averaging_length()` with line-synchronous integration.
+      int32_t window_length() const { return window_length_; }
+
+      /// The maximum length of the adaptive averaging, 0, if disabled.
+      int32_t adaptive_length() const { return adaptive_length_; }
+
+      /// The number of samples, which the current reading of `channel` is
+      /// made of.
+      int32_t effective_length(const int channel) const {
+        return (adaptive_length_ > 0) ? adaptive_[channel].length()
+                                      : window_samples_;
+      }
+
+      /// The PGA range of `channel`, which the last reading was converted
+      /// with.
+      int range(const int channel) const { return ranges_[channel]; }
+
+      /// The PGA range of `channel`, which is converting now.
+      int current_range(const int channel) const { return gains_[channel]; }
+
+      bool auto_range(const int channel) const {
+        return (auto_ranges_ & (1U << static_cast<unsigned>(channel))) != 0U;
+      }
+
+      /// Selects the PGA gain 2^`range` of `channel` and disables its
+      /// auto-ranging.
+      /// \return Whether `range` is within [0, number_of_ranges).
+      bool set_range(const int channel, const int range) {
+        if ((range < 0) || (range >= number_of_ranges)) {
+          return false;
+        }
+        auto_ranges_ = static_cast<uint8_t>(
+            auto_ranges_ & ~(1U << static_cast<unsigned>(channel)));
+        switch_range(channel, range);
+        return true;
+      }
+
+      /// Lets the gain of `channel` follow its signal, see `range_down_level`
+      /// and `range_up_level`.
+      void set_auto_range(const int channel) {
+        auto_ranges_ = static_cast<uint8_t>(
+            auto_ranges_ | (1U << static_cast<unsigned>(channel)));
+      }
+
+      /// The waveform capture, which is fed with every raw frame.
+      Scope &scope() { return scope_; }
+      const Scope &scope() const { return scope_; }
+
+      Line_sync line_sync() const { return line_sync_; }
+
+      /// The mains frequency the window is synchronized to, 0, if off.
+      int line_frequency_Hz() const {
+        return (line_sync_ == Line_sync::Off) ? 0 : line_frequency_Hz_;
+      }
+
+      /// Sizes the averaging window to the whole number of mains periods,
+      /// which comes closest to `averaging_length()`. The fraction of a
+      /// sample, by which the periods do not fit the sampling frequency, is
+      /// split between adjacent windows. `Line_sync::Auto` follows the
+      /// frequency of the hum on the voltage channel, starting at 50 Hz.
+      void set_line_sync(const Line_sync sync) {
+        line_sync_ = sync;
+        if (sync == Line_sync::Hz60) {
+          line_frequency_Hz_ = 60;
+        } else if (sync != Line_sync::Auto) {
+          line_frequency_Hz_ = 50;
+        }
+        detector_.reset();
+        select_window();
+        discard_window();
+        adaptive_ = {};
+      }
+
+      /// Enables adaptive averaging over up to `max_length` samples, see
+      /// `Adaptive_average`, or disables it for 0. A reading is still
+      /// available after every `averaging_length()` samples.
+      /// \return Whether `max_length` is within [0, max_averaging_length].
+      bool set_adaptive_length(const int32_t max_length) {
+        if ((max_length < 0) || (max_length > max_averaging_length)) {
+          return false;
+        }
+        adaptive_length_ = max_length;
+        select_squared_channels();
+        discard_window();
+        adaptive_ = {};
+        return true;
+      }
+
+      /// Changes the number of samples averaged per reading. The partial sums
+      /// of the current window are discarded.
+      /// \return Whether `length` is within [1, max_averaging_length].
+      bool set_averaging_length(const int32_t length) {
+        if ((length < 1) || (length > max_averaging_length)) {
+          return false;
+        }
+        averaging_length_ = length;
+        select_window();
+        discard_window();
+        adaptive_ = {};
+        return true;
+      }
+
+      /// The number of frames that were lost, because the main loop did not
+      /// drain the frame buffer in time. The counter wraps around.
+      uint16_t dropped_frames() const { return dropped_frames_; }
+
+      /// The number of frames collected by the main loop, which serves as its
+      /// time base. The counter wraps around.
+      uint16_t collected_frames() const { return collected_frames_; }
+
+      /// Discards all buffered frames and partial sums. Must not be called
+      /// while conversions are running.
+      void reset() {
+        frames_.clear();
+        discard_window();
+        dropped_frames_ = 0U;
+      }
+
+      /// Starts the next reading with the next frame collected, discarding
+      /// the partial sums. The frames still buffered were converted before,
+      /// by up to `frame_buffer_length` sample periods.
+      void restart_window() { discard_window(); }
+
+      /// \return The raw results of the conversions, which just completed.
+      static Frame conversion_results() {
+        auto frame = Frame{};
         for (auto i = 0; i < used_channels; ++i) {
-          sums_[i] += msp430i2::SD24::get_conversion_result(i);
+          frame[i] = msp430i2::SD24::get_conversion_result(i);
         }
-        ++number_of_conversion_results_;
+        return frame;
+      }
 
-        if (number_of_conversion_results_ >= number_of_oversamples) {
-          stop_conversion();
+      /// To be called from the interrupt service routine with the
+      /// `conversion_results()`. Only moves them into the frame buffer, the
+      /// conversion keeps running.
+      /// \return Whether the main loop should be woken up to drain the frame
+      ///    buffer.
+      bool on_conversion_done(const Frame &frame) {
+        if (!frames_.push(frame)) {
+          dropped_frames_ = static_cast<uint16_t>(dropped_frames_ + 1U);
+        }
+        return frames_.size() >= (frame_buffer_length / 2);
+      }
+
+      /// To be called from the main loop. Drains the frame buffer into the
+      /// running sums and tracks the extremes of every sample.
+      ///    Channels in an RMS mode and the power channels also sum up the
+      /// squares of the deviations from the previous mean, which is much more
+      /// accurate than squaring the samples, when the AC component is small.
+      /// The products of the power channels are summed up sample by sample,
+      /// so the power is right even if the load fluctuates within the window.
+      /// \return Whether a new averaged result is available.
+      bool collect() {
+        auto frame = Frame{};
+        while (frames_.pop(frame)) {
+          collected_frames_ = static_cast<uint16_t>(collected_frames_ + 1U);
+          scope_.add(frame);
+          if (settling_frames_ > 0) {
+            --settling_frames_;
+            continue;
+          }
+          product_sum_ +=
+              int64_t{frame[voltage_channel_]} * frame[current_channel_];
+          if ((line_sync_ == Line_sync::Auto)
+              && detector_.add(frame[voltage_channel_]
+                                   - pivots_[voltage_channel_],
+                               static_cast<int32_t>(
+                                   ac_rms_[voltage_channel_] / 2U))) {
+            follow_line_frequency(detector_.frequency_Hz());
+            detector_.reset();
+          }
           for (auto i = 0; i < used_channels; ++i) {
-            averages_[i] = sums_[i] / number_of_conversion_results_;
+            sums_[i] += frame[i];
+            running_extremes_[i].add(frame[i]);
+            if (is_squared(i)) {
+              const auto deviation = int64_t{frame[i]} - pivots_[i];
+              squares_[i] += static_cast<uint64_t>(deviation * deviation);
+            }
+          }
+          ++number_of_conversion_results_;
+
+          if (number_of_conversion_results_ >= window_samples_) {
+            for (auto i = 0; i < used_channels; ++i) {
+              const auto mean = window_mean(i, frame[i]);
+              extremes_[i] = running_extremes_[i];
+              if (ranges_[i] != gains_[i]) {
+                // the hold continues in the new range
+                held_extremes_[i] =
+                    rescaled(held_extremes_[i], gains_[i] - ranges_[i]);
+                ranges_[i] = gains_[i];
+              }
+              held_extremes_[i].add(extremes_[i]);
+              if (is_squared(i)) {
+                ac_rms_[i] = ac_rms(
+                    sums_[i] - (int64_t{pivots_[i]} * window_samples_),
+                    squares_[i], window_samples_, window_shift_);
+                pivots_[i] = mean;
+              }
+              averages_[i] = (adaptive_length_ > 0)
+                                 ? adaptive_[i].add(sums_[i], window_samples_,
+                                                    window_shift_, ac_rms_[i],
+                                                    adaptive_length_)
+                                 : mean;
+            }
+            mean_product_ = wide_average(product_sum_, window_samples_,
+                                         window_shift_);
+            window_length_ = window_samples_;
+            // the rest of the last sample belongs to the next window
+            boundaries_ = frame;
+            phase_q8_ = 256 - boundary_weight_;
+            next_window();
+            // all samples of a capture have the same gain
+            const auto capturing =
+                (scope_.state() == Scope::State::Armed)
+                || (scope_.state() == Scope::State::Triggered);
+            for (auto i = 0; (i < used_channels) && !capturing; ++i) {
+              if (auto_range(i)) {
+                follow_signal(i);
+              }
+            }
+            return true;
           }
-          sums_ = {};
-          number_of_conversion_results_ = 0;
-          return true;
         }
         return false;
       }
 
     private:
-      Array<int32_t, used_channels> sums_{};
+      bool is_squared(const int channel) const {
+        return (squared_channels_ & (1U << static_cast<unsigned>(channel)))
+               != 0U;
+      }
+
+      void select_squared_channels() {
+        auto mask = (1U << static_cast<unsigned>(voltage_channel_))
+                    | (1U << static_cast<unsigned>(current_channel_));
+        for (auto i = 0; i < used_channels; ++i) {
+          // adaptive averaging needs the noise of every channel
+          if ((modes_[i] != Channel_mode::DC) || (adaptive_length_ > 0)) {
+            mask |= 1U << static_cast<unsigned>(i);
+          }
+        }
+        squared_channels_ = static_cast<uint8_t>(mask);
+      }
+
+      /// The mean of the window, where the last sample only counts with
+      /// `boundary_weight_` and the last sample of the previous window with
+      /// the rest of its weight, `phase_q8_`.
+      int32_t window_mean(const int channel, const int32_t last_sample) const {
+        if ((phase_q8_ == 0) && (boundary_weight_ == 256)) {
+          return average(sums_[channel], window_samples_, window_shift_);
+        }
+        const auto sum =
+            (sums_[channel] * 256)
+            - (int64_t{256 - boundary_weight_} * last_sample)
+            + (int64_t{phase_q8_} * boundaries_[channel]);
+        const auto rounding = (sum < 0) ? -(current_window_q8_ / 2)
+                                        : (current_window_q8_ / 2);
+        return static_cast<int32_t>((sum + rounding) / current_window_q8_);
+      }
+
+      static constexpr Extremes rescaled(const Extremes &extremes,
+                                         const int steps) {
+        if (extremes.empty()) {
+          return extremes;
+        }
+        return (steps > 0) ? Extremes{extremes.minimum << steps,
+                                      extremes.maximum << steps}
+                           : Extremes{extremes.minimum >> -steps,
+                                      extremes.maximum >> -steps};
+      }
+
+      void follow_signal(const int channel) {
+        const auto &extremes = extremes_[channel];
+        const auto peak = std::max(-int64_t{extremes.minimum},
+                                   int64_t{extremes.maximum});
+        if ((peak >= range_down_level) && (gains_[channel] > 0)) {
+          switch_range(channel, gains_[channel] - 1);
+        } else if ((peak < range_up_level)
+                   && (gains_[channel] < number_of_ranges - 1)) {
+          switch_range(channel, gains_[channel] + 1);
+        }
+      }
+
+      /// Switches the gain and discards the frames, which were or will be
+      /// converted before the filter has settled, and the current window of
+      /// all channels, since they share it.
+      void switch_range(const int channel, const int range) {
+        if (range == gains_[channel]) {
+          return;
+        }
+        msp430i2::SD24::set_gain(channel, static_cast<u8>(range));
+        pivots_[channel] = (range > gains_[channel])
+                               ? (pivots_[channel] * 2)
+                               : (pivots_[channel] / 2);
+        gains_[channel] = static_cast<uint8_t>(range);
+        adaptive_[channel].reset();
+        settling_frames_ = frames_.size() + settling_conversions;
+        discard_window();
+      }
+
+      void select_window() {
+        window_q8_ = (line_sync_ == Line_sync::Off)
+                         ? (averaging_length_ * 256)
+                         : line_window_q8(averaging_length_,
+                                          line_period_q8(line_frequency_Hz_));
+      }
+
+      void follow_line_frequency(const int frequency_Hz) {
+        if ((frequency_Hz != 0) && (frequency_Hz != line_frequency_Hz_)) {
+          line_frequency_Hz_ = frequency_Hz;
+          select_window();
+        }
+      }
+
+      /// Starts a window with the whole samples needed to fill `window_q8_`
+      /// after the rest of the previous sample.
+      void next_window() {
+        sums_ = {};
+        squares_ = {};
+        running_extremes_ = {};
+        product_sum_ = 0;
+        number_of_conversion_results_ = 0;
+
+        current_window_q8_ = window_q8_;
+        const auto remaining_q8 = window_q8_ - phase_q8_;
+        const auto window_samples = (remaining_q8 + 255) / 256;
+        if (window_samples != window_samples_) {
+          window_samples_ = window_samples;
+          window_shift_ = averaging_shift(window_samples);
+        }
+        boundary_weight_ = remaining_q8 - ((window_samples - 1) * 256);
+      }
+
+      void discard_window() {
+        phase_q8_ = 0;
+        next_window();
+      }
+
+      Ring_buffer<Frame, frame_buffer_length> frames_{};
+      volatile uint16_t dropped_frames_{0U};
+      Scope scope_{};
+      uint16_t collected_frames_{0U};
+
+      int32_t averaging_length_{number_of_oversamples};
+
+      /// the PGA range of every channel and the one of the last reading
+      Array<uint8_t, used_channels> gains_{};
+      Array<uint8_t, used_channels> ranges_{};
+      /// bit i is set, if channel i is auto-ranging
+      uint8_t auto_ranges_{0U};
+      Size settling_frames_{0};
+
+      Line_sync line_sync_{Line_sync::Off};
+      int line_frequency_Hz_{50};
+      Line_frequency_detector detector_{};
+      /// the length of the window in 1/256 samples
+      int32_t window_q8_{int32_t{number_of_oversamples} * 256};
+      /// `window_q8_` at the start of the current window, which the detector
+      /// of `Line_sync::Auto` may change before its end
+      int32_t current_window_q8_{window_q8_};
+      /// the number of whole samples in the current window, the first
+      /// `phase_q8_` / 256 of a sample before belongs to it as well
+      int32_t window_samples_{number_of_oversamples};
+      int window_shift_{averaging_shift(number_of_oversamples)};
+      /// the weight of the last sample of the window in 1/256
+      int32_t boundary_weight_{256};
+      int32_t phase_q8_{0};
+      Frame boundaries_{};
+      int32_t window_length_{number_of_oversamples};
+
+      Array<Channel_mode, used_channels> modes_{};
+      int32_t adaptive_length_{0};
+      Array<Adaptive_average, used_channels> adaptive_{};
+      /// bit i is set, if the squares of channel i are summed up
+      uint8_t squared_channels_{0b11U};
+
+      Array<int64_t, used_channels> sums_{};
+      /// the sums of the squared deviations from `pivots_`, i.e. at most
+      /// max_averaging_length * (2^24 - 1)^2, because a window, also a
+      /// line-synchronous one, never holds more than max_averaging_length
+      /// samples, see `next_window()`
+      Array<uint64_t, used_channels> squares_{};
+      static_assert(static_cast<uint64_t>(max_averaging_length)
+                    <= max_rms_window);
+      Array<int32_t, used_channels> pivots_{};
       Array<int32_t, used_channels> averages_{};
-      Size number_of_conversion_results_{};
+      Array<uint32_t, used_channels> ac_rms_{};
+
+      Array<Extremes, used_channels> running_extremes_{};
+      Array<Extremes, used_channels> extremes_{};
+      Array<Extremes, used_channels> held_extremes_{};
+
+      int voltage_channel_{0};
+      int current_channel_{1};
+      /// at most max_averaging_length * 2^46, because the raw samples are
+      /// multiplied and their offsets are only removed from the mean
+      int64_t product_sum_{0};
+      int64_t mean_product_{0};
+      int32_t number_of_conversion_results_{};
   };
 
 } // namespace meter
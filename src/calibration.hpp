@@ -0,0 +1,122 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#ifndef MSPMETER_CALIBRATION_HPP
+#define MSPMETER_CALIBRATION_HPP
+
+#include "future.hpp"
+
+namespace meter {
+
+  struct Channel_calibration {
+      /// The voltage in uV that is applied during gain calibration.
+      int32_t calibration_voltage;
+      /// The voltage in uV that corresponds to `full_scale_reading`.
+      int32_t full_scale_voltage;
+      int32_t full_scale_reading;
+      int32_t offset;
+  };
+
+  /// \return The calibration of a channel, which was calibrated at a PGA
+  ///    gain of 1, for the nominal `gain` corrected by `trim` / 2^16.
+  ///    The offset is assumed to be referred to the input.
+  constexpr Channel_calibration at_gain(const Channel_calibration &cal,
+                                        const int gain, const int16_t trim) {
+    const auto factor = int64_t{gain} * (65'536 + trim);
+    return {cal.calibration_voltage, cal.full_scale_voltage,
+            static_cast<int32_t>(
+                ((int64_t{cal.full_scale_reading} * factor) + 32'768)
+                >> 16),
+            cal.offset * gain};
+  }
+  static_assert(at_gain({1, 2, 0x7f'ffff, -3}, 1, 0).full_scale_reading
+                == 0x7f'ffff);
+  static_assert(at_gain({1, 2, 1'000, -3}, 16, 0).full_scale_reading
+                == 16'000);
+  static_assert(at_gain({1, 2, 1'000, -3}, 16, 0).offset == -48);
+  static_assert(at_gain({1, 2, 65'536, 0}, 2, -655).full_scale_reading
+                == 2 * (65'536 - 655));
+
+  /// A `Channel_calibration` compiled into a fixed-point factor, so that a
+  /// reading can be scaled by a multiplication and a shift instead of a 64-bit
+  /// division.
+  struct Channel_scale {
+      int32_t offset;
+      int32_t multiplier;
+      int shift;
+  };
+
+  /// Chooses the largest shift for which the multiplier still fits into 31
+  /// bits. The conversion results are at most 25 bits wide including the
+  /// offset, so the product always fits into 64 bits.
+  constexpr Channel_scale compile(const Channel_calibration &cal) {
+    if (cal.full_scale_reading == 0) {
+      return {cal.offset, 0, 0};
+    }
+    constexpr auto max_shift = 31;
+    constexpr auto max_multiplier = int64_t{0x7fff'ffff};
+
+    const auto divisor = int64_t{cal.full_scale_reading};
+    const auto quotient = [&](const int shift) {
+      const auto dividend = int64_t{cal.full_scale_voltage} << shift;
+      // round to nearest
+      return ((dividend < 0) == (divisor < 0))
+                 ? (dividend + (divisor / 2)) / divisor
+                 : (dividend - (divisor / 2)) / divisor;
+    };
+
+    auto shift = max_shift;
+    while ((shift > 0)
+           && ((quotient(shift) > max_multiplier)
+               || (quotient(shift) < -max_multiplier))) {
+      --shift;
+    }
+    return {cal.offset, static_cast<int32_t>(quotient(shift)), shift};
+  }
+
+  /// \returns the scaled voltage reading in uV, rounded to nearest
+  constexpr int32_t apply(const int32_t conversion_result,
+                          const Channel_scale &scale) {
+    const auto product = int64_t{conversion_result - scale.offset}
+                         * scale.multiplier;
+    if (scale.shift == 0) {
+      return static_cast<int32_t>(product);
+    }
+    return static_cast<int32_t>(
+        (product + (int64_t{1} << (scale.shift - 1))) >> scale.shift);
+  }
+  static_assert(apply(0x7f'ffff,
+                      compile({30'000'000, 30'000'000, 0x7f'ffff, 0}))
+                == 30'000'000);
+  static_assert(apply(0x6e'0000,
+                      compile({30'000'000, 30'000'000, 0x6e'0000, 0}))
+                == 30'000'000);
+  static_assert(apply(0x70'0000,
+                      compile({30'000'000, 30'000'000, 0x6e'0000, 0}))
+                > 30'000'000);
+  static_assert(apply(-0x80'0000,
+                      compile({1'000'000, 1'000'000, 0x7f'ffff, 0}))
+                == -1'000'000);
+
+  /// \returns the conversion result, which `apply()` scales to `value`, up
+  ///    to rounding
+  constexpr int32_t unapply(const int32_t value, const Channel_scale &scale) {
+    if (scale.multiplier == 0) {
+      return scale.offset;
+    }
+    const auto dividend = int64_t{value} * (int64_t{1} << scale.shift);
+    const auto divisor = int64_t{scale.multiplier};
+    const auto quotient = ((dividend < 0) == (divisor < 0))
+                              ? (dividend + (divisor / 2)) / divisor
+                              : (dividend - (divisor / 2)) / divisor;
+    return scale.offset + static_cast<int32_t>(quotient);
+  }
+  static_assert(unapply(30'000'000,
+                        compile({30'000'000, 30'000'000, 0x7f'ffff, 0}))
+                == 0x7f'ffff);
+  static_assert(unapply(-500'000, compile({1'000'000, 1'000'000, 0x40'0000,
+                                           0x100}))
+                == 0x100 - 0x20'0000);
+
+} // namespace meter
+
+#endif // MSPMETER_CALIBRATION_HPP
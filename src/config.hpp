@@ -10,9 +10,54 @@ namespace meter {
 
   constexpr auto used_channels = 4;
 
-  /// The number of samples, which are accumulated in the background and
-  /// averaged to obtain one "reading" that is displayed to the user.
+  /// The SD24 modulator runs at 1.024 MHz with an oversampling ratio of 256.
+  constexpr auto modulator_frequency_Hz = int32_t{1'024'000};
+  constexpr auto oversampling_ratio = 256;
+  constexpr auto sampling_frequency_Hz =
+      static_cast<int>(modulator_frequency_Hz / oversampling_ratio);
+
+  /// The default number of samples, which are accumulated in the background
+  /// and averaged to obtain one "reading" that is displayed to the user. It
+  /// can be changed at runtime within [1, max_averaging_length].
   constexpr auto number_of_oversamples = 256;
+  constexpr auto max_averaging_length = int32_t{65'536};
+
+  /// The PGA of every channel has the ranges 0 to 4 with the gains 1, 2, 4, 8
+  /// and 16.
+  constexpr auto number_of_ranges = 5;
+
+  /// The number of raw conversion frames (one sample of every channel), which
+  /// can be buffered between the SD24 interrupt and the main loop. The main
+  /// loop must drain the buffer within this many sampling periods (250 us
+  /// each) or frames will be dropped.
+  constexpr auto frame_buffer_length = 16;
+
+  /// The size of the RAM buffer for waveform captures, see `Scope`, i.e. 48
+  /// samples of one channel or 12 frames of all four.
+  ///    With it, the static data takes about 1620 B of the 2048 B of RAM
+  /// (the sizes of the objects in a host build, with int, Size and pointers
+  /// at 16 bits), which leaves about 430 B for the stack. The linker script
+  /// checks that the stack reserve of 384 B fits.
+  constexpr auto capture_buffer_size = 144;
+
+  /// reported by `*IDN?`, the version of the project in CMakeLists.txt
+  constexpr auto firmware_version = "0.1.0";
+
+  /// The display is refreshed at this rate, independent of the reading rate,
+  /// so the digits are readable and do not flicker.
+  constexpr auto display_refresh_Hz = 3;
+
+  /// The baud rate of the serial interface after a reset, see
+  /// `msp430::UART::configure()`
+  constexpr auto serial_baud_rate = int32_t{9'600};
+  /// The baud rates, which can be selected at runtime until the next reset.
+  /// Streaming the raw samples of all four channels takes 921600 Bd, of one
+  /// channel 460800 Bd.
+  constexpr auto serial_baud_rates = Array<int32_t, 5>{
+      {serial_baud_rate, 115'200, 230'400, 460'800, 921'600}};
+  /// The number of bytes, which can be queued for transmission, i.e. about
+  /// three text lines or seven binary readings.
+  constexpr auto serial_queue_length = 128;
 
   constexpr auto default_calibration =
       Array<Channel_calibration, used_channels>{
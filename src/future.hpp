@@ -7,8 +7,13 @@
 #include <bit>
 #include <cstddef>
 #include <cstdint>
+#include <limits>
 #include <type_traits>
 
+#ifndef __MSP430__
+#include "host/bus.hpp"
+#endif
+
 using Size = std::ptrdiff_t;
 
 #ifndef __cpp_lib_to_underlying
@@ -134,6 +139,8 @@ Tp_ b_or(Head_tp_ head, Tail_tps_... tail) {
   return static_cast<Tp_>(static_cast<Tp_>(head) | b_or<Tp_>(tail...));
 }
 
+#ifdef __MSP430__
+
 template <typename Tp_> inline Tp_ load(const Register<Tp_> a_register) {
   return *reinterpret_cast<volatile Tp_ *>(a_register.address);
 }
@@ -143,6 +150,20 @@ inline void store(const Register<Tp_> a_register, Tp_ const val) {
   *reinterpret_cast<volatile Tp_ *>(a_register.address) = val;
 }
 
+#else // host build => simulated peripherals
+
+template <typename Tp_> inline Tp_ load(const Register<Tp_> a_register) {
+  return static_cast<std::remove_cv_t<Tp_>>(
+      host::read(a_register.address, sizeof(Tp_)));
+}
+
+template <typename Tp_>
+inline void store(const Register<Tp_> a_register, Tp_ const val) {
+  host::write(a_register.address, sizeof(Tp_), static_cast<uint16_t>(val));
+}
+
+#endif
+
 template <typename Tp_>
 inline void set_bits(const Register<Tp_> a_register, Tp_ const mask) {
   store(a_register, static_cast<Tp_>(load(a_register) | mask));
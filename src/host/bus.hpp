@@ -0,0 +1,43 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#ifndef MSPMETER_HOST_BUS_HPP
+#define MSPMETER_HOST_BUS_HPP
+
+#include <cstdint>
+
+/// The interface between the firmware and the simulated MCU, which replaces
+/// the memory-mapped peripherals and the intrinsics of msp430-gcc in host
+/// builds. See `host::Simulator` for the peripheral models.
+namespace host {
+
+  uint16_t read(intptr_t address, unsigned width);
+  void write(intptr_t address, unsigned width, uint16_t value);
+
+  void enable_interrupts();
+  void disable_interrupts();
+
+  /// Enters LPM0 until an interrupt service routine calls `stay_awake()`.
+  void sleep();
+  void stay_awake();
+
+  /// Lets simulated time pass until the next peripheral event, so that busy
+  /// waiting loops make progress.
+  void spin();
+
+  void delay(long cycles);
+
+  /// Makes the interrupt vector table known to the interrupt dispatcher.
+  bool install_vectors(void (*const *vectors)(), int count);
+
+} // namespace host
+
+inline void __delay_cycles(const long cycles) { host::delay(cycles); }
+
+inline void __bic_SR_register_on_exit(const unsigned bits) {
+  constexpr auto CPUOFF = 0x0010U;
+  if ((bits & CPUOFF) != 0U) {
+    host::stay_awake();
+  }
+}
+
+#endif // MSPMETER_HOST_BUS_HPP
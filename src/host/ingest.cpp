@@ -0,0 +1,305 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+/// meter_ingest: records the text stream of the meter on the host.
+///
+///   meter_ingest [options] <input>
+///
+///     <input>          a serial port (tty or pty), which is configured for
+///                      8N1 at the baud rate, or a file
+///     --csv            write comma-separated values (default)
+///     --columnar       write the binary columnar format, see
+///                      `Columnar_writer`
+///     --output <file>  write to this file instead of stdout
+///     --baud <rate>    the baud rate of a serial port, 9600 by default like
+///                      the meter after a reset
+///     --window <n>     the number of records of the rolling statistics,
+///                      1024 by default
+///     --stats <n>      print the statistics to stderr every n records and
+///                      at the end, never by default
+///     --benchmark      parse the input (or synthetic lines, if it is "-")
+///                      from memory repeatedly for a second without writing
+///                      anything and report the lines parsed per second
+///
+/// Lines, which do not hold readings, e.g. replies to commands, are skipped.
+
+#include "ingest.hpp"
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+  using namespace host::ingest;
+
+  struct Options {
+      const char *input{nullptr};
+      const char *output{nullptr};
+      bool columnar{false};
+      bool benchmark{false};
+      long baud_rate{9'600};
+      int window{1'024};
+      long stats_interval{0};
+  };
+
+  [[noreturn]] void usage() {
+    std::fputs("usage: meter_ingest [--csv|--columnar] [--output <file>] "
+               "[--baud <rate>]\n"
+               "                    [--window <n>] [--stats <n>] "
+               "[--benchmark] <input>\n",
+               stderr);
+    std::exit(2);
+  }
+
+  Options parse_options(const int argc, char **const argv) {
+    auto options = Options{};
+    for (auto i = 1; i < argc; ++i) {
+      const auto argument = std::string_view{argv[i]};
+      const auto value = [&] {
+        if (i + 1 >= argc) {
+          usage();
+        }
+        return argv[++i];
+      };
+      if (argument == "--csv") {
+        options.columnar = false;
+      } else if (argument == "--columnar") {
+        options.columnar = true;
+      } else if (argument == "--output") {
+        options.output = value();
+      } else if (argument == "--baud") {
+        options.baud_rate = std::strtol(value(), nullptr, 10);
+      } else if (argument == "--window") {
+        options.window = static_cast<int>(std::strtol(value(), nullptr, 10));
+      } else if (argument == "--stats") {
+        options.stats_interval = std::strtol(value(), nullptr, 10);
+      } else if (argument == "--benchmark") {
+        options.benchmark = true;
+      } else if ((options.input == nullptr)
+                 && (!argument.starts_with("--") || (argument == "-"))) {
+        options.input = argv[i];
+      } else {
+        usage();
+      }
+    }
+    if (options.input == nullptr) {
+      usage();
+    }
+    return options;
+  }
+
+  speed_t to_speed(const long baud_rate) {
+    switch (baud_rate) {
+    case 9'600:
+      return B9600;
+    case 19'200:
+      return B19200;
+    case 38'400:
+      return B38400;
+    case 57'600:
+      return B57600;
+    case 115'200:
+      return B115200;
+    case 230'400:
+      return B230400;
+#ifdef B460800
+    case 460'800:
+      return B460800;
+#endif
+#ifdef B921600
+    case 921'600:
+      return B921600;
+#endif
+    default:
+      return B0;
+    }
+  }
+
+  /// Configures a serial port for raw 8N1 input.
+  bool configure_port(const int fd, const long baud_rate) {
+    auto settings = termios{};
+    if (tcgetattr(fd, &settings) != 0) {
+      return false;
+    }
+    cfmakeraw(&settings);
+    settings.c_cflag |= CLOCAL | CREAD;
+    settings.c_cc[VMIN] = 1;
+    settings.c_cc[VTIME] = 0;
+    const auto speed = to_speed(baud_rate);
+    return (speed != B0) && (cfsetispeed(&settings, speed) == 0)
+           && (cfsetospeed(&settings, speed) == 0)
+           && (tcsetattr(fd, TCSANOW, &settings) == 0);
+  }
+
+  // too large for the stack
+  auto statistics = Rolling_statistics{};
+
+  void print_statistics(const Line_parser &parser) {
+    std::fprintf(stderr, "%llu records, %llu rejected lines\n",
+                 static_cast<unsigned long long>(parser.records()),
+                 static_cast<unsigned long long>(parser.rejected()));
+    if (statistics.count() == 0) {
+      return;
+    }
+    for (auto column = 0; column < parser.columns(); ++column) {
+      const auto summary = statistics.summary(column);
+      std::fprintf(stderr,
+                   "  ch%d: mean %.1f, std. dev. %.1f, min %d, max %d "
+                   "over %d records\n",
+                   column + 1, summary.mean, summary.standard_deviation,
+                   summary.minimum, summary.maximum, statistics.count());
+    }
+  }
+
+  template <class Writer_>
+  int ingest(const int fd, Writer_ &writer, const Options &options,
+             const bool complete_first_line) {
+    auto parser = Line_parser{};
+    parser.set_complete_first_line(complete_first_line);
+    auto buffer = std::array<char, 4'096>{};
+    auto ok = true;
+    while (ok) {
+      const auto received = read(fd, buffer.data(), buffer.size());
+      if (received <= 0) {
+        break;
+      }
+      parser.feed(buffer.data(), static_cast<std::size_t>(received),
+                  [&](const Record &record) {
+                    if ((parser.records() == 1)
+                        && !writer.header(record.columns)) {
+                      ok = false;
+                    }
+                    ok = ok && writer.write(parser.records() - 1, record);
+                    statistics.add(record);
+                    if ((options.stats_interval > 0)
+                        && (parser.records()
+                                % static_cast<uint64_t>(
+                                    options.stats_interval)
+                            == 0U)) {
+                      print_statistics(parser);
+                    }
+                  });
+    }
+    ok = writer.finish() && ok;
+    if (options.stats_interval > 0) {
+      print_statistics(parser);
+    }
+    if (!ok) {
+      std::perror("meter_ingest: writing failed");
+      return 1;
+    }
+    return 0;
+  }
+
+  /// \return The lines of the input or of constant readings of four
+  ///    channels.
+  std::vector<char> benchmark_input(const Options &options) {
+    auto input = std::vector<char>{};
+    if (std::string_view{options.input} != "-") {
+      auto *const file = std::fopen(options.input, "rb");
+      if (file == nullptr) {
+        return input;
+      }
+      auto buffer = std::array<char, 4'096>{};
+      auto length = std::size_t{0};
+      while ((length = std::fread(buffer.data(), 1, buffer.size(), file))
+             > 0) {
+        input.insert(input.end(), buffer.begin(),
+                     buffer.begin() + static_cast<std::ptrdiff_t>(length));
+      }
+      std::fclose(file);
+      return input;
+    }
+    constexpr auto line = std::string_view{
+        "30000000\t-1000000\t29999999\t-999999\r\n"};
+    for (auto i = 0; i < 100'000; ++i) {
+      input.insert(input.end(), line.begin(), line.end());
+    }
+    return input;
+  }
+
+  int benchmark(const Options &options) {
+    const auto input = benchmark_input(options);
+    if (input.empty()) {
+      std::fputs("meter_ingest: no input to parse\n", stderr);
+      return 1;
+    }
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+    auto elapsed = Clock::duration{};
+    auto lines = uint64_t{0U};
+    auto checksum = int64_t{0};
+    do {
+      auto parser = Line_parser{};
+      parser.set_complete_first_line(true);
+      parser.feed(input.data(), input.size(), [&](const Record &record) {
+        statistics.add(record);
+        checksum += record.values[0];
+      });
+      lines += parser.records() + parser.rejected();
+      elapsed = Clock::now() - start;
+    } while (elapsed < std::chrono::seconds{1});
+
+    const auto seconds = std::chrono::duration<double>{elapsed}.count();
+    std::printf("%llu lines in %.3f s: %.0f lines/s (checksum %lld)\n",
+                static_cast<unsigned long long>(lines), seconds,
+                static_cast<double>(lines) / seconds,
+                static_cast<long long>(checksum));
+    return 0;
+  }
+
+} // namespace
+
+int main(const int argc, char **const argv) {
+  const auto options = parse_options(argc, argv);
+  if (!statistics.set_window(options.window)) {
+    std::fprintf(stderr, "meter_ingest: the window must be within 1..%d\n",
+                 Rolling_statistics::max_window);
+    return 2;
+  }
+  if (options.benchmark) {
+    return benchmark(options);
+  }
+
+  const auto fd = open(options.input, O_RDONLY | O_NOCTTY);
+  if (fd < 0) {
+    std::perror(options.input);
+    return 1;
+  }
+  const auto serial_port = isatty(fd) != 0;
+  if (serial_port && !configure_port(fd, options.baud_rate)) {
+    std::fprintf(stderr, "meter_ingest: cannot configure %s for %ld Bd\n",
+                 options.input, options.baud_rate);
+    return 1;
+  }
+
+  auto *const output = (options.output == nullptr)
+                           ? stdout
+                           : std::fopen(options.output, "wb");
+  if (output == nullptr) {
+    std::perror(options.output);
+    return 1;
+  }
+  // a stream may start in the middle of a line, a file does not
+  auto result = 0;
+  if (options.columnar) {
+    // too large for the stack
+    static auto writer = Columnar_writer{output};
+    result = ingest(fd, writer, options, !serial_port);
+  } else {
+    auto writer = Csv_writer{output};
+    result = ingest(fd, writer, options, !serial_port);
+  }
+  close(fd);
+  if ((output != stdout) && (std::fclose(output) != 0)) {
+    std::perror(options.output);
+    return 1;
+  }
+  return result;
+}
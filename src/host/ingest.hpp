@@ -0,0 +1,347 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#ifndef MSPMETER_HOST_INGEST_HPP
+#define MSPMETER_HOST_INGEST_HPP
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string_view>
+
+/// Reading the text stream of the meter on the host, see the `meter_ingest`
+/// tool. Nothing is allocated once the objects exist, so a busy host does
+/// not lose lines to the allocator.
+namespace host::ingest {
+
+  /// The meter sends at most one value per channel.
+  constexpr auto max_columns = 4;
+
+  /// One line of readings, i.e. the values of the enabled channels in uV or
+  /// uA.
+  struct Record {
+      std::array<int32_t, max_columns> values{};
+      int columns{0};
+  };
+
+  /// Parses one line of tab-separated values without its terminator.
+  /// \return Whether the line holds one to `max_columns` values and nothing
+  ///    else.
+  inline bool parse_line(const std::string_view line, Record &record) {
+    record.columns = 0;
+    const auto *first = line.data();
+    const auto *const last = line.data() + line.size();
+    while (true) {
+      if (record.columns == max_columns) {
+        return false;
+      }
+      auto &value = record.values[static_cast<std::size_t>(record.columns)];
+      const auto result = std::from_chars(first, last, value);
+      if ((result.ec != std::errc{}) || (result.ptr == first)) {
+        return false;
+      }
+      ++record.columns;
+      if (result.ptr == last) {
+        return true;
+      }
+      if (*result.ptr != '\t') {
+        return false;
+      }
+      first = result.ptr + 1;
+    }
+  }
+
+  /// Splits a stream of characters, which arrive in chunks of any size, into
+  /// lines and parses them.
+  ///    Replies to commands, lines of another number of columns than the first
+  /// one and lines, which are too long or were cut off, e.g. when reading
+  /// started in the middle of one, are counted and skipped.
+  class Line_parser {
+    public:
+      static constexpr auto max_line_length = 128;
+
+      /// Calls `on_record(record)` for every complete, valid line in `data`.
+      template <class Handler_>
+      void feed(const char *const data, const std::size_t length,
+                Handler_ &&on_record) {
+        for (auto i = std::size_t{0}; i < length; ++i) {
+          const auto c = data[i];
+          if ((c != '\r') && (c != '\n')) {
+            if (length_ < line_.size()) {
+              line_[length_] = c;
+              ++length_;
+            } else {
+              too_long_ = true;
+            }
+            continue;
+          }
+          if ((length_ == 0) && !too_long_) {
+            continue;
+          }
+          auto record = Record{};
+          const auto valid =
+              !too_long_ && !first_line_
+              && parse_line({line_.data(), length_}, record)
+              && ((columns_ == 0) || (record.columns == columns_));
+          // the first line may have been cut off
+          first_line_ = false;
+          length_ = 0;
+          too_long_ = false;
+          if (!valid) {
+            ++rejected_;
+            continue;
+          }
+          columns_ = record.columns;
+          ++records_;
+          on_record(record);
+        }
+      }
+
+      /// Whether the first line is to be parsed as well, i.e. the stream
+      /// starts at the beginning of a line like a file does.
+      void set_complete_first_line(const bool complete) {
+        first_line_ = !complete;
+      }
+
+      /// The number of columns of every record, 0 before the first one.
+      int columns() const { return columns_; }
+      uint64_t records() const { return records_; }
+      uint64_t rejected() const { return rejected_; }
+
+    private:
+      std::array<char, max_line_length> line_{};
+      std::size_t length_{0};
+      bool too_long_{false};
+      bool first_line_{true};
+      int columns_{0};
+      uint64_t records_{0U};
+      uint64_t rejected_{0U};
+  };
+
+  /// Mean, standard deviation and extremes of every column over the last
+  /// `window` records.
+  class Rolling_statistics {
+    public:
+      static constexpr auto max_window = 16'384;
+
+      struct Summary {
+          double mean;
+          double standard_deviation;
+          int32_t minimum;
+          int32_t maximum;
+      };
+
+      /// \return Whether `window` is within [1, `max_window`].
+      bool set_window(const int window) {
+        if ((window < 1) || (window > max_window)) {
+          return false;
+        }
+        window_ = window;
+        clear();
+        return true;
+      }
+      int window() const { return window_; }
+
+      void clear() {
+        count_ = 0;
+        next_ = 0;
+        sums_ = {};
+        squares_ = {};
+      }
+
+      void add(const Record &record) {
+        columns_ = record.columns;
+        const auto slot = static_cast<std::size_t>(next_);
+        for (auto column = std::size_t{0};
+             column < static_cast<std::size_t>(columns_); ++column) {
+          const auto value = record.values[column];
+          if (count_ == window_) {
+            const auto oldest = history_[column][slot];
+            sums_[column] -= oldest;
+            squares_[column] -= static_cast<double>(oldest) * oldest;
+          }
+          history_[column][slot] = value;
+          sums_[column] += value;
+          squares_[column] += static_cast<double>(value) * value;
+        }
+        count_ = std::min(count_ + 1, window_);
+        next_ = (next_ + 1 == window_) ? 0 : next_ + 1;
+        // the rounding errors of removing squares must not pile up
+        if (next_ == 0) {
+          resum();
+        }
+      }
+
+      /// The number of records in the window.
+      int count() const { return count_; }
+
+      /// Only valid, if `count()` is not zero.
+      Summary summary(const int column) const {
+        const auto index = static_cast<std::size_t>(column);
+        const auto &history = history_[index];
+        const auto begin = history.begin();
+        const auto [minimum, maximum] =
+            std::minmax_element(begin, begin + count_);
+        const auto n = static_cast<double>(count_);
+        const auto mean = static_cast<double>(sums_[index]) / n;
+        const auto variance =
+            std::max(0.0, (squares_[index] / n) - (mean * mean));
+        return {mean, std::sqrt(variance), *minimum, *maximum};
+      }
+
+    private:
+      void resum() {
+        for (auto column = std::size_t{0};
+             column < static_cast<std::size_t>(columns_); ++column) {
+          sums_[column] = 0;
+          squares_[column] = 0.0;
+          for (auto i = 0; i < count_; ++i) {
+            const auto value = history_[column][static_cast<std::size_t>(i)];
+            sums_[column] += value;
+            squares_[column] += static_cast<double>(value) * value;
+          }
+        }
+      }
+
+      std::array<std::array<int32_t, max_window>, max_columns> history_{};
+      std::array<int64_t, max_columns> sums_{};
+      std::array<double, max_columns> squares_{};
+      int window_{1'024};
+      int count_{0};
+      int next_{0};
+      int columns_{0};
+  };
+
+  /// Writes records as lines of comma-separated values, preceded by their
+  /// index.
+  class Csv_writer {
+    public:
+      explicit Csv_writer(std::FILE *const file) : file_{file} {}
+
+      bool header(const int columns) {
+        auto length = print("index");
+        for (auto column = 1; column <= columns; ++column) {
+          length += print(",ch");
+          length += print(column);
+        }
+        length += print("\n");
+        return flush(length);
+      }
+
+      bool write(const uint64_t index, const Record &record) {
+        auto length = print(index);
+        for (auto column = std::size_t{0};
+             column < static_cast<std::size_t>(record.columns); ++column) {
+          length += print(",");
+          length += print(record.values[column]);
+        }
+        length += print("\n");
+        return flush(length);
+      }
+
+      bool finish() { return std::fflush(file_) == 0; }
+
+    private:
+      template <class Value_> std::size_t print(const Value_ value) {
+        const auto result =
+            std::to_chars(line_.data() + position_,
+                          line_.data() + line_.size(), value);
+        const auto length =
+            static_cast<std::size_t>(result.ptr - (line_.data() + position_));
+        position_ += length;
+        return length;
+      }
+
+      std::size_t print(const std::string_view text) {
+        const auto length = std::min(text.size(), line_.size() - position_);
+        std::copy_n(text.data(), length, line_.data() + position_);
+        position_ += length;
+        return length;
+      }
+
+      std::size_t print(const char *const text) {
+        return print(std::string_view{text});
+      }
+
+      bool flush(const std::size_t length) {
+        position_ = 0;
+        return std::fwrite(line_.data(), 1, length, file_) == length;
+      }
+
+      std::FILE *file_;
+      std::array<char, 80> line_{};
+      std::size_t position_{0};
+  };
+
+  /// Writes records in blocks of columns, which suits analysis tools better
+  /// than rows do.
+  ///    The file starts with the magic "MSPC", the format version 1 and the
+  /// number of columns (one byte each). Every block consists of the number of
+  /// records in it (uint32) followed by the values of each column in turn
+  /// (int32), all in little-endian byte order.
+  class Columnar_writer {
+    public:
+      static constexpr auto block_length = 4'096;
+
+      explicit Columnar_writer(std::FILE *const file) : file_{file} {}
+
+      bool header(const int columns) {
+        columns_ = columns;
+        const auto header = std::array<unsigned char, 6>{
+            'M', 'S', 'P', 'C', 1U, static_cast<unsigned char>(columns)};
+        return std::fwrite(header.data(), 1, header.size(), file_)
+               == header.size();
+      }
+
+      bool write(const uint64_t, const Record &record) {
+        for (auto column = std::size_t{0};
+             column < static_cast<std::size_t>(columns_); ++column) {
+          block_[column][static_cast<std::size_t>(rows_)] =
+              record.values[column];
+        }
+        ++rows_;
+        return (rows_ < block_length) || flush();
+      }
+
+      bool finish() { return flush() && (std::fflush(file_) == 0); }
+
+    private:
+      bool put(const uint32_t value) {
+        const auto bytes = std::array<unsigned char, 4>{
+            static_cast<unsigned char>(value),
+            static_cast<unsigned char>(value >> 8U),
+            static_cast<unsigned char>(value >> 16U),
+            static_cast<unsigned char>(value >> 24U)};
+        return std::fwrite(bytes.data(), 1, bytes.size(), file_)
+               == bytes.size();
+      }
+
+      bool flush() {
+        if (rows_ == 0) {
+          return true;
+        }
+        auto ok = put(static_cast<uint32_t>(rows_));
+        for (auto column = std::size_t{0};
+             column < static_cast<std::size_t>(columns_); ++column) {
+          for (auto row = 0; row < rows_; ++row) {
+            ok = ok
+                 && put(static_cast<uint32_t>(
+                     block_[column][static_cast<std::size_t>(row)]));
+          }
+        }
+        rows_ = 0;
+        return ok;
+      }
+
+      std::FILE *file_;
+      std::array<std::array<int32_t, block_length>, max_columns> block_{};
+      int columns_{0};
+      int rows_{0};
+  };
+
+} // namespace host::ingest
+
+#endif // MSPMETER_HOST_INGEST_HPP
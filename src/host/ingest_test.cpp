@@ -0,0 +1,219 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#include "ingest.hpp"
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <cmath>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace host::ingest {
+
+  namespace {
+
+    std::vector<Record> parse_all(Line_parser &parser,
+                                  const std::string_view text,
+                                  const std::size_t chunk_length) {
+      auto records = std::vector<Record>{};
+      for (auto i = std::size_t{0}; i < text.size(); i += chunk_length) {
+        parser.feed(text.data() + i, std::min(chunk_length, text.size() - i),
+                    [&](const Record &record) { records.push_back(record); });
+      }
+      return records;
+    }
+
+    std::string contents_of(std::FILE *const file) {
+      std::rewind(file);
+      auto contents = std::string{};
+      auto c = 0;
+      while ((c = std::fgetc(file)) != EOF) {
+        contents.push_back(static_cast<char>(c));
+      }
+      return contents;
+    }
+
+  } // namespace
+
+  SCENARIO("parsing a line of readings") {
+    auto record = Record{};
+
+    GIVEN("the values of four channels") {
+      THEN("all of them are parsed") {
+        REQUIRE(parse_line("30000000\t-1\t0\t2147483647", record));
+        REQUIRE(record.columns == 4);
+        REQUIRE(record.values[0] == 30'000'000);
+        REQUIRE(record.values[1] == -1);
+        REQUIRE(record.values[2] == 0);
+        REQUIRE(record.values[3] == 2'147'483'647);
+      }
+    }
+
+    GIVEN("lines, which are no readings") {
+      THEN("they are rejected") {
+        REQUIRE_FALSE(parse_line("", record));
+        REQUIRE_FALSE(parse_line("OK", record));
+        REQUIRE_FALSE(parse_line("1\t", record));
+        REQUIRE_FALSE(parse_line("1 2", record));
+        REQUIRE_FALSE(parse_line("1\t2\t3\t4\t5", record));
+        REQUIRE_FALSE(parse_line("2147483648", record));
+      }
+    }
+  }
+
+  SCENARIO("splitting a stream into records") {
+    auto parser = Line_parser{};
+    constexpr auto text = std::string_view{
+        "00\t4\r\n1\t2\r\nOK\r\n3\t4\r\n5\r\n6\t7\r\n"};
+
+    GIVEN("a stream, which may start in the middle of a line") {
+      WHEN("it arrives in chunks of any length") {
+        const auto chunk_length = GENERATE(std::size_t{1}, std::size_t{3},
+                                           std::size_t{64});
+        const auto records = parse_all(parser, text, chunk_length);
+
+        THEN("the first line, replies and odd lines are skipped") {
+          REQUIRE(records.size() == 3);
+          REQUIRE(records[0].values[0] == 1);
+          REQUIRE(records[1].values[1] == 4);
+          REQUIRE(records[2].values[0] == 6);
+          REQUIRE(parser.columns() == 2);
+          REQUIRE(parser.records() == 3U);
+          REQUIRE(parser.rejected() == 3U);
+        }
+      }
+    }
+
+    GIVEN("a file, which starts with a complete line") {
+      parser.set_complete_first_line(true);
+      const auto records = parse_all(parser, text, 64);
+
+      THEN("the first line is a record, too") {
+        REQUIRE(records.size() == 4);
+        REQUIRE(records[0].values[1] == 4);
+      }
+    }
+
+    GIVEN("a line, which is longer than the buffer") {
+      parser.set_complete_first_line(true);
+      const auto text = std::string(Line_parser::max_line_length + 1, '1')
+                        + "\n1\n";
+      const auto records = parse_all(parser, text, 7);
+
+      THEN("it is rejected as a whole") {
+        REQUIRE(records.size() == 1);
+        REQUIRE(records[0].values[0] == 1);
+        REQUIRE(parser.rejected() == 1U);
+      }
+    }
+  }
+
+  SCENARIO("rolling statistics") {
+    auto statistics = std::make_unique<Rolling_statistics>();
+
+    GIVEN("a window of four records") {
+      REQUIRE(statistics->set_window(4));
+      REQUIRE_FALSE(statistics->set_window(0));
+      REQUIRE_FALSE(
+          statistics->set_window(Rolling_statistics::max_window + 1));
+      REQUIRE(statistics->window() == 4);
+
+      WHEN("six records were added") {
+        for (const auto value : {100, -100, 1, 2, 3, 4}) {
+          statistics->add({{value, -value}, 2});
+        }
+
+        THEN("only the last four of them count") {
+          REQUIRE(statistics->count() == 4);
+          const auto summary = statistics->summary(0);
+          REQUIRE(summary.mean == 2.5);
+          REQUIRE(std::abs(summary.standard_deviation - std::sqrt(1.25))
+                  < 1e-9);
+          REQUIRE(summary.minimum == 1);
+          REQUIRE(summary.maximum == 4);
+          REQUIRE(statistics->summary(1).mean == -2.5);
+        }
+      }
+
+      WHEN("many large values passed through the window") {
+        for (auto i = 0; i < 10'001; ++i) {
+          const auto value = ((i % 2) == 0) ? 2'000'000'000 : -2'000'000'000;
+          statistics->add({{value}, 1});
+        }
+        for (auto i = 0; i < 4; ++i) {
+          statistics->add({{7}, 1});
+        }
+
+        THEN("no rounding errors remain") {
+          const auto summary = statistics->summary(0);
+          REQUIRE(summary.mean == 7.0);
+          REQUIRE(summary.standard_deviation < 1e-3);
+        }
+      }
+    }
+  }
+
+  SCENARIO("writing records") {
+    auto *const file = std::tmpfile();
+    REQUIRE(file != nullptr);
+    const auto first = Record{{1, -2}, 2};
+    const auto second = Record{{2'147'483'647, -2'147'483'647 - 1}, 2};
+
+    GIVEN("comma-separated values") {
+      auto writer = Csv_writer{file};
+      REQUIRE(writer.header(2));
+      REQUIRE(writer.write(0U, first));
+      REQUIRE(writer.write(1U, second));
+      REQUIRE(writer.finish());
+
+      THEN("every record is a row with its index") {
+        REQUIRE(contents_of(file)
+                == "index,ch1,ch2\n0,1,-2\n1,2147483647,-2147483648\n");
+      }
+    }
+
+    GIVEN("the columnar format") {
+      auto writer = std::make_unique<Columnar_writer>(file);
+      REQUIRE(writer->header(2));
+      REQUIRE(writer->write(0U, first));
+      REQUIRE(writer->write(1U, second));
+      REQUIRE(writer->finish());
+
+      THEN("the columns follow the header and the row count in turn") {
+        const auto contents = contents_of(file);
+        const auto expected = std::string{
+            "MSPC\x01\x02"
+            "\x02\x00\x00\x00"
+            "\x01\x00\x00\x00"
+            "\xff\xff\xff\x7f"
+            "\xfe\xff\xff\xff"
+            "\x00\x00\x00\x80",
+            26};
+        REQUIRE(contents == expected);
+      }
+    }
+
+    std::fclose(file);
+  }
+
+  TEST_CASE("cost of ingesting lines") {
+    auto input = std::string{};
+    for (auto i = 0; i < 1'000; ++i) {
+      input += "30000000\t-1000000\t29999999\t-999999\r\n";
+    }
+    auto statistics = std::make_unique<Rolling_statistics>();
+
+    BENCHMARK("Line_parser::feed() and Rolling_statistics::add() of 1000 "
+              "lines") {
+      auto parser = Line_parser{};
+      parser.set_complete_first_line(true);
+      parser.feed(input.data(), input.size(),
+                  [&](const Record &record) { statistics->add(record); });
+      return parser.records();
+    };
+  }
+
+} // namespace host::ingest
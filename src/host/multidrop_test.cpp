@@ -0,0 +1,249 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#include "modbus.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace meter {
+
+  namespace {
+
+    constexpr auto number_of_meters = 32;
+    /// a reading of 256 samples
+    constexpr auto window_s = 256.0 / sampling_frequency_Hz;
+
+    /// A meter as seen from the bus: the Modbus slave of the firmware with
+    /// readings, which tell the meters apart, and which take `window_s`
+    /// after a latch.
+    class Virtual_meter {
+      public:
+        explicit Virtual_meter(const uint8_t address) : address_{address} {
+          for (auto i = 0; i < used_channels; ++i) {
+            snapshot_.readings[i] = (address * 1'000) + i;
+          }
+          snapshot_.power_uW = address;
+        }
+
+        /// Receives a `frame`, which is followed by 3.5 characters of
+        /// silence at `now_s`.
+        /// \return The response, empty for none.
+        std::vector<uint8_t> receive(const std::vector<uint8_t> &frame,
+                                     const double now_s) {
+          now_s_ = now_s;
+          for (const auto byte : frame) {
+            receiver_.add_byte(byte);
+          }
+          auto response = std::vector<uint8_t>{};
+          if (receiver_.end_frame()) {
+            auto buffer = Array<uint8_t, modbus::max_response_length>{};
+            const auto length =
+                modbus::respond(receiver_.frame(), receiver_.length(),
+                                address_, *this, buffer.data());
+            response.assign(buffer.begin(), buffer.begin() + length);
+          }
+          receiver_.release();
+          return response;
+        }
+
+        modbus::Exception read_input_register(uint16_t, uint16_t &) const {
+          return modbus::Exception::IllegalDataAddress;
+        }
+        modbus::Exception read_holding_register(uint16_t, uint16_t &) const {
+          return modbus::Exception::IllegalDataAddress;
+        }
+        modbus::Exception write_holding_register(uint16_t, uint16_t) {
+          return modbus::Exception::IllegalDataAddress;
+        }
+        modbus::Exception read_snapshot(modbus::Snapshot &snapshot) const {
+          if (now_s_ < latched_s_ + window_s) {
+            return modbus::Exception::ServerDeviceBusy;
+          }
+          snapshot = snapshot_;
+          return modbus::Exception::None;
+        }
+        modbus::Exception latch(const uint16_t number) {
+          latched_s_ = now_s_;
+          snapshot_.latch = number;
+          snapshot_.timestamp_ms = static_cast<uint32_t>(
+              std::lround((now_s_ + window_s) * 1'000.0));
+          return modbus::Exception::None;
+        }
+
+      private:
+        uint8_t address_;
+        modbus::Receiver receiver_{};
+        modbus::Snapshot snapshot_{};
+        double now_s_{0.0};
+        double latched_s_{-1.0};
+    };
+
+    /// A half-duplex line at `baud_rate`, on which the master and the
+    /// meters take turns. Time passes with the characters sent, the silence
+    /// after every frame and the time a meter takes to start its response.
+    /// The latter is less than a character in the scenario "polling over
+    /// Modbus RTU" in simulator_test.cpp, but that leaves out the execution
+    /// time of the firmware.
+    class Bus {
+      public:
+        explicit Bus(const int32_t baud_rate)
+            : character_s_{10.0 / baud_rate} {
+          for (auto address = 1; address <= number_of_meters; ++address) {
+            meters_.emplace_back(static_cast<uint8_t>(address));
+          }
+        }
+
+        /// Sends a request, to which the CRC is appended, to all meters and
+        /// waits for the response of the addressed one, if any.
+        /// \return The response without its CRC, empty for none.
+        std::vector<uint8_t> transact(const std::vector<uint8_t> &data) {
+          const auto crc = Crc16_modbus::compute(
+              data.data(), static_cast<Size>(data.size()));
+          auto request = std::vector<uint8_t>(data.size() + 2);
+          std::copy(data.begin(), data.end(), request.begin());
+          request[data.size()] = static_cast<uint8_t>(crc);
+          request[data.size() + 1] = static_cast<uint8_t>(crc >> 8U);
+          pass(static_cast<double>(request.size()) + 3.5);
+
+          auto response = std::vector<uint8_t>{};
+          for (auto &meter : meters_) {
+            auto answer = meter.receive(request, now_s_);
+            if (answer.empty()) {
+              continue;
+            }
+            if (!response.empty()) {
+              ++collisions_;
+            }
+            response = std::move(answer);
+          }
+          if (response.empty()) {
+            // a broadcast is not answered, so the master need not wait
+            if (request[0] != modbus::broadcast_address) {
+              now_s_ += response_timeout_s;
+            }
+            return response;
+          }
+          pass(turnaround_characters
+               + static_cast<double>(response.size()) + 3.5);
+          if (Crc16_modbus::compute(response.data(),
+                                    static_cast<Size>(response.size()))
+              != 0U) {
+            ++collisions_;
+          }
+          response.resize(response.size() - 2);
+          return response;
+        }
+
+        void wait(const double duration_s) { now_s_ += duration_s; }
+
+        double seconds() const { return now_s_; }
+        int collisions() const { return collisions_; }
+
+        static constexpr auto turnaround_characters = 1.0;
+        static constexpr auto response_timeout_s = 0.05;
+
+      private:
+        void pass(const double characters) {
+          now_s_ += characters * character_s_;
+        }
+
+        double character_s_;
+        std::vector<Virtual_meter> meters_{};
+        double now_s_{0.0};
+        int collisions_{0};
+    };
+
+    /// Latches all meters, waits for the reading and polls them one by one.
+    /// \return The snapshots in the order of the addresses.
+    std::vector<modbus::Snapshot> poll_cycle(Bus &bus,
+                                             const uint16_t latch) {
+      const auto latched = bus.transact(
+          {modbus::broadcast_address, 0x42U, static_cast<uint8_t>(latch >> 8U),
+           static_cast<uint8_t>(latch)});
+      REQUIRE(latched.empty());
+      bus.wait(window_s);
+      auto snapshots = std::vector<modbus::Snapshot>{};
+      for (auto address = 1; address <= number_of_meters; ++address) {
+        const auto response =
+            bus.transact({static_cast<uint8_t>(address), 0x41U});
+        REQUIRE(response.size() == 3 + modbus::snapshot_length);
+        CHECK(response[0] == address);
+        CHECK(response[1] == 0x41U);
+        snapshots.push_back(modbus::decode(response.data() + 3));
+      }
+      return snapshots;
+    }
+
+  } // namespace
+
+  SCENARIO("polling 32 meters on one bus") {
+    for (const auto baud_rate : {serial_baud_rates[1], serial_baud_rates[4]}) {
+      GIVEN("a bus at " + std::to_string(baud_rate) + " Bd") {
+        auto bus = Bus{baud_rate};
+
+        WHEN("all meters are latched and polled in turn") {
+          const auto started_s = bus.seconds();
+          const auto snapshots = poll_cycle(bus, 1U);
+          const auto cycle_s = bus.seconds() - started_s;
+
+          THEN("every meter answers with the reading of the same window") {
+            CHECK(bus.collisions() == 0);
+            for (auto i = 0; i < number_of_meters; ++i) {
+              const auto &snapshot =
+                  snapshots[static_cast<std::size_t>(i)];
+              CHECK(snapshot.latch == 1U);
+              CHECK(snapshot.timestamp_ms == snapshots[0].timestamp_ms);
+              CHECK(snapshot.readings[0] == (i + 1) * 1'000);
+              CHECK(snapshot.power_uW == i + 1);
+            }
+          }
+
+          THEN("the cycle takes the reading and a few characters per poll") {
+            const auto character_s = 10.0 / baud_rate;
+            // the request, the silence, the turnaround, the response and
+            // the silence again
+            const auto poll_s =
+                (4.0 + 3.5 + Bus::turnaround_characters
+                 + (3 + modbus::snapshot_length + 2) + 3.5)
+                * character_s;
+            INFO("poll cycle " << cycle_s * 1'000.0 << " ms, "
+                               << poll_s * 1'000.0 << " ms per meter");
+            const auto latch_s = (6.0 + 3.5) * character_s;
+            CHECK(std::abs(cycle_s - latch_s - window_s
+                           - (number_of_meters * poll_s))
+                  < 1e-9);
+            CHECK(cycle_s < ((baud_rate == 115'200) ? 0.2 : 0.08));
+          }
+        }
+
+        WHEN("the meters are polled before the reading is complete") {
+          REQUIRE(bus.transact({modbus::broadcast_address, 0x42U, 0x00U,
+                                0x02U})
+                      .empty());
+          const auto response = bus.transact({1U, 0x41U});
+
+          THEN("they are busy") {
+            CHECK(response == std::vector<uint8_t>{1U, 0xc1U, 0x06U});
+          }
+        }
+
+        WHEN("a meter is polled, which is not on the bus") {
+          const auto before_s = bus.seconds();
+          const auto response =
+              bus.transact({number_of_meters + 1, 0x41U});
+
+          THEN("the master waits for the response timeout") {
+            CHECK(response.empty());
+            CHECK(bus.seconds() - before_s >= Bus::response_timeout_s);
+          }
+        }
+      }
+    }
+  }
+
+} // namespace meter
@@ -0,0 +1,746 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#include "simulator.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+// the bounds of the static data of the firmware, see `MSP430_STATIC`
+extern "C" char __start_firmware_static[];
+extern "C" char __stop_firmware_static[];
+
+namespace host {
+
+  namespace {
+
+    constexpr auto no_event = std::numeric_limits<uint64_t>::max();
+
+    // register addresses, see msp430i2.hpp and msp430.hpp
+    constexpr auto PAIN = intptr_t{0x10};
+    constexpr auto P1IV = intptr_t{0x1e};
+    constexpr auto PAIES = intptr_t{0x28};
+    constexpr auto PAIE = intptr_t{0x2a};
+    constexpr auto PAIFG = intptr_t{0x2c};
+    constexpr auto P2IV = intptr_t{0x2e};
+
+    constexpr auto SD24INCTL0 = intptr_t{0xb0};
+    constexpr auto SD24CTL = intptr_t{0x100};
+    constexpr auto SD24CCTL0 = intptr_t{0x102};
+    constexpr auto SD24MEM0 = intptr_t{0x110};
+    constexpr auto SD24IV = intptr_t{0x1f0};
+
+    constexpr auto FCTL1 = intptr_t{0x128};
+    constexpr auto FCTL2 = intptr_t{0x12a};
+    constexpr auto FCTL3 = intptr_t{0x12c};
+
+    constexpr auto TA0CTL = intptr_t{0x160};
+    constexpr auto TA0CCTL0 = intptr_t{0x162};
+    constexpr auto TA0R = intptr_t{0x170};
+    constexpr auto TA0CCR0 = intptr_t{0x172};
+
+    constexpr auto UCA0STATW = intptr_t{0x14a};
+    constexpr auto UCB0STATW = intptr_t{0x1c8};
+
+    // bits
+    constexpr auto UCRXIFG = uint16_t{0x0001U};
+    constexpr auto UCTXIFG = uint16_t{0x0002U};
+    constexpr auto UCSWRST = uint16_t{0x0001U};
+
+    constexpr auto SD24OVIE = uint16_t{0x0002U};
+    constexpr auto SD24LSBTOG = uint16_t{0x0080U};
+    constexpr auto SD24LSBACC = uint16_t{0x0040U};
+    constexpr auto SD24OVIFG = uint16_t{0x0020U};
+    constexpr auto SD24IE = uint16_t{0x0008U};
+    constexpr auto SD24IFG = uint16_t{0x0004U};
+    constexpr auto SD24SC = uint16_t{0x0002U};
+
+    constexpr auto TACLR = uint16_t{0x0004U};
+    constexpr auto CCIE = uint16_t{0x0010U};
+    constexpr auto CCIFG = uint16_t{0x0001U};
+
+    constexpr auto FWKEY = uint16_t{0xa500U};
+    constexpr auto ERASE = uint16_t{0x0002U};
+    constexpr auto WRT = uint16_t{0x0040U};
+
+    constexpr auto sd24_modulator_divider = 16U; // fM = MCLK / 16
+
+    /// The share of a new PGA gain in the conversions after a switch, about
+    /// the step response of the sinc3 filter. The fourth one has settled.
+    constexpr auto sd24_settling =
+        std::array<double, 3>{{1.0 / 6, 0.5, 5.0 / 6}};
+
+    /// Guards against interrupt sources that are never cleared by their
+    /// service routine, which would hang the real MCU as well.
+    constexpr auto max_nested_dispatches = 10'000;
+
+    [[noreturn]] void fail(const char *const message) {
+      std::fprintf(stderr, "simulator: %s\n", message);
+      std::abort();
+    }
+
+  } // namespace
+
+  Simulator &Simulator::instance() {
+    // never destroyed, because the firmware thread may still be parked when
+    // the process exits
+    static auto *const simulator = new Simulator{};
+    return *simulator;
+  }
+
+  Simulator::Simulator()
+      : uca0_{.base = 0x140,
+              .ifg_address = 0x15c,
+              .ie_address = 0x15a,
+              .iv_address = 0x15e,
+              .txbuf_address = 0x14e,
+              .rxbuf_address = 0x14c},
+        ucb0_{.base = 0x1c0,
+              .ifg_address = 0x1ec,
+              .ie_address = 0x1ea,
+              .iv_address = 0x1ee,
+              .txbuf_address = 0x1ce,
+              .rxbuf_address = 0x1cc} {
+    reset();
+  }
+
+  void Simulator::reset() {
+    memory_.fill(0U);
+    for (auto *const eusci : {&uca0_, &ucb0_}) {
+      poke(eusci->base, UCSWRST);
+      poke(eusci->ifg_address, UCTXIFG);
+      eusci->shifting = false;
+      eusci->buffered = false;
+      eusci->rx_pending.clear();
+    }
+    sd24_ = {};
+    flash_ = {};
+    timer_ = {};
+    gie_ = false;
+    wake_ = false;
+    clear_output();
+  }
+
+  void Simulator::restart() {
+    auto lock = std::unique_lock{mutex_};
+    if (started_ && !returned_) {
+      stopping_ = true;
+      firmware_turn_ = true;
+      turn_changed_.notify_all();
+      turn_changed_.wait(lock, [this] { return !firmware_turn_; });
+      stopping_ = false;
+    }
+    started_ = false;
+    returned_ = false;
+    condition_ = {};
+    lock.unlock();
+
+    reset();
+    cycles_ = 0U;
+    isr_depth_ = 0;
+    waveform_ = {};
+    if (!initial_data_.empty()) {
+      std::memcpy(__start_firmware_static, initial_data_.data(),
+                  initial_data_.size());
+    }
+  }
+
+  std::string Simulator::uart_text() const {
+    auto text = std::string{};
+    text.reserve(uca0_.output.size());
+    for (const auto &byte : uca0_.output) {
+      text.push_back(static_cast<char>(byte.value));
+    }
+    return text;
+  }
+
+  void Simulator::clear_output() {
+    uca0_.output.clear();
+    ucb0_.output.clear();
+  }
+
+  void Simulator::set_port_input(const uint16_t pins) {
+    const auto previous_pins = peek(PAIN);
+    poke(PAIN, pins);
+    update_port_flags(previous_pins);
+  }
+
+  void Simulator::receive(const std::string_view bytes) {
+    if (uca0_.rx_pending.empty()) {
+      uca0_.rx_at = cycles_ + character_cycles(uca0_);
+    }
+    uca0_.rx_pending.append(bytes);
+  }
+
+  // --- registers -------------------------------------------------------------
+
+  uint16_t Simulator::peek(const intptr_t address) const {
+    return static_cast<uint16_t>(
+        memory_[static_cast<std::size_t>(address)]
+        | (memory_[static_cast<std::size_t>(address + 1)] << 8U));
+  }
+
+  void Simulator::poke(const intptr_t address, const uint16_t value) {
+    memory_[static_cast<std::size_t>(address)] = static_cast<uint8_t>(value);
+    memory_[static_cast<std::size_t>(address + 1)] =
+        static_cast<uint8_t>(value >> 8U);
+  }
+
+  void Simulator::set_flags(const intptr_t address, const uint16_t mask) {
+    poke(address, static_cast<uint16_t>(peek(address) | mask));
+  }
+
+  void Simulator::clear_flags(const intptr_t address, const uint16_t mask) {
+    poke(address, static_cast<uint16_t>(peek(address) & ~mask));
+  }
+
+  uint16_t Simulator::read(const intptr_t address, const unsigned width) {
+    if ((address < 0)
+        || (static_cast<std::size_t>(address) + width > memory_.size())) {
+      fail("read from unmapped address");
+    }
+
+    auto value = peek(address);
+
+    if (address == uca0_.iv_address) {
+      value = read_eusci_iv(uca0_);
+    } else if (address == ucb0_.iv_address) {
+      value = read_eusci_iv(ucb0_);
+    } else if (address == uca0_.rxbuf_address) {
+      clear_flags(uca0_.ifg_address, UCRXIFG);
+    } else if (address == UCA0STATW) {
+      value = uca0_.shifting ? 1U : 0U;
+    } else if (address == UCB0STATW) {
+      value = ucb0_.shifting ? 1U : 0U;
+    } else if ((address >= SD24MEM0) && (address < SD24MEM0 + 8)) {
+      value = read_sd24_memory(static_cast<int>((address - SD24MEM0) / 2));
+    } else if (address == SD24IV) {
+      value = read_sd24_iv();
+    } else if (address == P1IV) {
+      value = read_port_iv(PAIFG);
+    } else if (address == P2IV) {
+      value = read_port_iv(PAIFG + 1);
+    } else if (address == TA0R) {
+      value = timer_count();
+    }
+
+    return (width == 1U) ? static_cast<uint16_t>(value & 0xffU) : value;
+  }
+
+  void Simulator::write(const intptr_t address, const unsigned width,
+                        const uint16_t value) {
+    if ((address < 0)
+        || (static_cast<std::size_t>(address) + width > memory_.size())) {
+      fail("write to unmapped address");
+    }
+
+    if ((address == FCTL1) || (address == FCTL2) || (address == FCTL3)) {
+      write_flash_control(address, value);
+    } else if (address == uca0_.txbuf_address) {
+      write_tx_buffer(uca0_, value);
+    } else if (address == ucb0_.txbuf_address) {
+      write_tx_buffer(ucb0_, value);
+    } else if (width == 1U) {
+      memory_[static_cast<std::size_t>(address)] = static_cast<uint8_t>(value);
+    } else {
+      const auto previous = peek(address);
+      poke(address, value);
+
+      if ((address >= SD24CCTL0) && (address < SD24CCTL0 + 8)) {
+        const auto was_running = sd24_.running;
+        sd24_.running = false;
+        for (auto channel = 0; channel < 4; ++channel) {
+          sd24_.running = sd24_.running
+                          || ((peek(SD24CCTL0 + 2 * channel) & SD24SC) != 0U);
+        }
+        if (!was_running && sd24_.running) {
+          sd24_.next_at = cycles_ + sd24_period();
+        }
+      } else if ((address == TA0CTL) || (address == TA0CCR0)) {
+        const auto mode_bits = uint16_t{0x0030U};
+        const auto clear = (address == TA0CTL) && ((value & TACLR) != 0U);
+        if (clear) {
+          // the count restarts and the bit reads as 0
+          clear_flags(TA0CTL, TACLR);
+        }
+        if ((address == TA0CCR0) || clear
+            || ((previous & mode_bits) != (value & mode_bits))) {
+          timer_.started_at = cycles_;
+          const auto period = timer_period();
+          timer_.next_at = (period == 0U) ? 0U : cycles_ + period;
+        }
+      }
+    }
+
+    if ((isr_depth_ == 0) && gie_) {
+      dispatch();
+    }
+  }
+
+  // --- eUSCI -----------------------------------------------------------------
+
+  uint64_t Simulator::character_cycles(const Eusci &eusci) const {
+    const auto ctlw0 = peek(eusci.base);
+    const auto clock_cycles = ((ctlw0 & 0x00c0U) == 0x0040U)
+                                  ? static_cast<double>(aclk_divider)
+                                  : 1.0;
+    const auto brw = std::max(1U, static_cast<unsigned>(peek(eusci.base + 6)));
+
+    if (&eusci == &ucb0_) {
+      return static_cast<uint64_t>(8.0 * clock_cycles * brw);
+    }
+
+    const auto mctlw = peek(eusci.base + 8);
+    const auto oversampling = (mctlw & 0x0001U) != 0U;
+    const auto brf = (mctlw >> 4U) & 0x000fU;
+    const auto brs = static_cast<unsigned>(std::popcount(
+        static_cast<uint8_t>(mctlw >> 8U)));
+    const auto divider = oversampling ? (16.0 * brw + brf) : (brw + brs / 8.0);
+    return static_cast<uint64_t>(std::llround(10.0 * clock_cycles * divider));
+  }
+
+  void Simulator::write_tx_buffer(Eusci &eusci, const uint16_t value) {
+    clear_flags(eusci.ifg_address, UCTXIFG);
+    if (eusci.shifting) {
+      if (eusci.buffered) {
+        fail("TX buffer overwritten before it was transferred");
+      }
+      eusci.buffer = static_cast<uint8_t>(value);
+      eusci.buffered = true;
+    } else {
+      eusci.shift_register = static_cast<uint8_t>(value);
+      eusci.shifting = true;
+      eusci.done_at = cycles_ + character_cycles(eusci);
+      set_flags(eusci.ifg_address, UCTXIFG);
+    }
+  }
+
+  uint16_t Simulator::read_eusci_iv(Eusci &eusci) {
+    const auto pending = peek(eusci.ifg_address) & peek(eusci.ie_address);
+    if ((pending & UCRXIFG) != 0U) {
+      clear_flags(eusci.ifg_address, UCRXIFG);
+      return 2U;
+    }
+    if ((pending & UCTXIFG) != 0U) {
+      clear_flags(eusci.ifg_address, UCTXIFG);
+      return 4U;
+    }
+    return 0U;
+  }
+
+  // --- SD24 ------------------------------------------------------------------
+
+  uint64_t Simulator::sd24_period() const {
+    // the group is controlled by the channel without SD24GRP, i.e. channel 3
+    const auto cctl = peek(SD24CCTL0 + 6);
+    const auto osr = 256U >> ((cctl >> 8U) & 0x3U);
+    return uint64_t{osr} * sd24_modulator_divider;
+  }
+
+  double Simulator::sd24_gain(const int channel) {
+    const auto index = static_cast<std::size_t>(channel);
+    const auto gain = 1 << std::min(memory_[SD24INCTL0 + index] & 0x7U, 4U);
+    if (gain != sd24_.gains[index]) {
+      sd24_.previous_gains[index] = sd24_.gains[index];
+      sd24_.gains[index] = gain;
+      sd24_.since_switch[index] = 0;
+    }
+    const auto since_switch = sd24_.since_switch[index];
+    if (static_cast<std::size_t>(since_switch) >= sd24_settling.size()) {
+      return gain;
+    }
+    ++sd24_.since_switch[index];
+    const auto share = sd24_settling[static_cast<std::size_t>(since_switch)];
+    return (share * gain) + ((1.0 - share) * sd24_.previous_gains[index]);
+  }
+
+  uint16_t Simulator::read_sd24_memory(const int channel) {
+    const auto cctl_address = SD24CCTL0 + 2 * channel;
+    const auto cctl = peek(cctl_address);
+    const auto result = static_cast<uint32_t>(
+        sd24_.results[static_cast<std::size_t>(channel)]);
+    const auto value = ((cctl & SD24LSBACC) != 0U)
+                           ? static_cast<uint16_t>(result)
+                           : static_cast<uint16_t>(result >> 8U);
+    auto next_cctl = static_cast<uint16_t>(cctl & ~SD24IFG);
+    if ((cctl & SD24LSBTOG) != 0U) {
+      next_cctl ^= SD24LSBACC;
+    }
+    poke(cctl_address, next_cctl);
+    return value;
+  }
+
+  uint16_t Simulator::read_sd24_iv() {
+    if ((peek(SD24CTL) & SD24OVIE) != 0U) {
+      for (auto channel = 0; channel < 4; ++channel) {
+        if ((peek(SD24CCTL0 + 2 * channel) & SD24OVIFG) != 0U) {
+          return 2U;
+        }
+      }
+    }
+    for (auto channel = 0; channel < 4; ++channel) {
+      const auto cctl = peek(SD24CCTL0 + 2 * channel);
+      if (((cctl & SD24IFG) != 0U) && ((cctl & SD24IE) != 0U)) {
+        return static_cast<uint16_t>(4 + 2 * channel);
+      }
+    }
+    return 0U;
+  }
+
+  // --- port ------------------------------------------------------------------
+
+  void Simulator::update_port_flags(const uint16_t previous_pins) {
+    const auto pins = peek(PAIN);
+    const auto falling_edge = peek(PAIES);
+    const auto rising = static_cast<uint16_t>(pins & ~previous_pins);
+    const auto falling = static_cast<uint16_t>(~pins & previous_pins);
+    set_flags(PAIFG, static_cast<uint16_t>((rising & ~falling_edge)
+                                           | (falling & falling_edge)));
+  }
+
+  uint16_t Simulator::read_port_iv(const intptr_t ifg_address) {
+    const auto ie_address = PAIE + (ifg_address - PAIFG);
+    const auto pending =
+        memory_[static_cast<std::size_t>(ifg_address)]
+        & memory_[static_cast<std::size_t>(ie_address)];
+    if (pending == 0U) {
+      return 0U;
+    }
+    const auto bit = std::countr_zero(static_cast<unsigned>(pending));
+    memory_[static_cast<std::size_t>(ifg_address)] &=
+        static_cast<uint8_t>(~(1U << bit));
+    return static_cast<uint16_t>((bit + 1) * 2);
+  }
+
+  // --- flash -----------------------------------------------------------------
+
+  void Simulator::write_flash_control(const intptr_t address,
+                                      const uint16_t value) {
+    if ((value & 0xff00U) != FWKEY) {
+      ++flash_.key_violations;
+      return;
+    }
+    if (address == FCTL1) {
+      if ((value & ERASE) != 0U) {
+        ++flash_.erases;
+      }
+      if ((value & WRT) != 0U) {
+        ++flash_.writes;
+      }
+    }
+    poke(address, static_cast<uint16_t>(value & 0x00ffU));
+  }
+
+  // --- Timer_A0 --------------------------------------------------------------
+
+  uint64_t Simulator::timer_period() const {
+    const auto ctl = peek(TA0CTL);
+    const auto mode = (ctl >> 4U) & 0x3U;
+    const auto ccr0 = uint64_t{peek(TA0CCR0)};
+    const auto tick_cycles =
+        ((((ctl >> 8U) & 0x3U) == 2U) ? 1U : aclk_divider)
+        << ((ctl >> 6U) & 0x3U);
+    switch (mode) {
+    case 1U:
+      return (ccr0 + 1U) * static_cast<uint64_t>(tick_cycles);
+    case 2U:
+      return uint64_t{0x1'0000U} * static_cast<uint64_t>(tick_cycles);
+    case 3U:
+      return 2U * ccr0 * static_cast<uint64_t>(tick_cycles);
+    default:
+      return 0U;
+    }
+  }
+
+  uint16_t Simulator::timer_count() const {
+    const auto period = timer_period();
+    if (period == 0U) {
+      return peek(TA0R);
+    }
+    const auto ctl = peek(TA0CTL);
+    const auto tick_cycles =
+        ((((ctl >> 8U) & 0x3U) == 2U) ? 1U : aclk_divider)
+        << ((ctl >> 6U) & 0x3U);
+    return static_cast<uint16_t>(((cycles_ - timer_.started_at) % period)
+                                 / static_cast<uint64_t>(tick_cycles));
+  }
+
+  // --- time and interrupts ---------------------------------------------------
+
+  uint64_t Simulator::next_event() const {
+    auto next = no_event;
+    if (sd24_.running) {
+      next = std::min(next, sd24_.next_at);
+    }
+    for (const auto *const eusci : {&uca0_, &ucb0_}) {
+      if (eusci->shifting) {
+        next = std::min(next, eusci->done_at);
+      }
+    }
+    if (!uca0_.rx_pending.empty()) {
+      next = std::min(next, uca0_.rx_at);
+    }
+    if (timer_.next_at != 0U) {
+      next = std::min(next, timer_.next_at);
+    }
+    return next;
+  }
+
+  void Simulator::advance_to(const uint64_t cycle) {
+    for (auto next = next_event(); next <= cycle; next = next_event()) {
+      cycles_ = next;
+
+      if (sd24_.running && (sd24_.next_at == cycles_)) {
+        for (auto channel = 0; channel < 4; ++channel) {
+          const auto cctl_address = SD24CCTL0 + 2 * channel;
+          auto cctl = peek(cctl_address);
+          if ((cctl & SD24IFG) != 0U) {
+            cctl |= SD24OVIFG;
+          }
+          cctl = static_cast<uint16_t>((cctl | SD24IFG) & ~SD24LSBACC);
+          poke(cctl_address, cctl);
+          const auto input = waveform_ ? waveform_(channel, sd24_.conversions)
+                                       : int32_t{0};
+          const auto result = std::llround(input * sd24_gain(channel));
+          sd24_.results[static_cast<std::size_t>(channel)] =
+              static_cast<int32_t>(
+                  std::clamp(result, -0x80'0000LL, 0x7f'ffffLL));
+        }
+        ++sd24_.conversions;
+        sd24_.next_at += sd24_period();
+      }
+
+      for (auto *const eusci : {&uca0_, &ucb0_}) {
+        if (eusci->shifting && (eusci->done_at == cycles_)) {
+          eusci->output.push_back({cycles_, eusci->shift_register});
+          eusci->shifting = false;
+          if (eusci->buffered) {
+            eusci->buffered = false;
+            eusci->shift_register = eusci->buffer;
+            eusci->shifting = true;
+            eusci->done_at = cycles_ + character_cycles(*eusci);
+            set_flags(eusci->ifg_address, UCTXIFG);
+          }
+        }
+      }
+
+      if (!uca0_.rx_pending.empty() && (uca0_.rx_at == cycles_)) {
+        poke(uca0_.rxbuf_address, static_cast<uint8_t>(uca0_.rx_pending[0]));
+        uca0_.rx_pending.erase(0, 1);
+        set_flags(uca0_.ifg_address, UCRXIFG);
+        uca0_.rx_at = cycles_ + character_cycles(uca0_);
+      }
+
+      if ((timer_.next_at != 0U) && (timer_.next_at == cycles_)) {
+        set_flags(TA0CCTL0, CCIFG);
+        const auto period = timer_period();
+        timer_.next_at = (period == 0U) ? 0U : cycles_ + period;
+      }
+    }
+    cycles_ = std::max(cycles_, cycle);
+  }
+
+  int Simulator::pending_vector() const {
+    const auto pending = [this](const Eusci &eusci) {
+      return (peek(eusci.ifg_address) & peek(eusci.ie_address)) != 0U;
+    };
+    const auto sd24_pending = [this] {
+      const auto overflow_enabled = (peek(SD24CTL) & SD24OVIE) != 0U;
+      for (auto channel = 0; channel < 4; ++channel) {
+        const auto cctl = peek(SD24CCTL0 + 2 * channel);
+        if ((((cctl & SD24IFG) != 0U) && ((cctl & SD24IE) != 0U))
+            || (overflow_enabled && ((cctl & SD24OVIFG) != 0U))) {
+          return true;
+        }
+      }
+      return false;
+    };
+    const auto port_pending = static_cast<unsigned>(peek(PAIFG) & peek(PAIE));
+
+    if (pending(uca0_)) {
+      return vector::eusci_a0;
+    }
+    if (pending(ucb0_)) {
+      return vector::eusci_b0;
+    }
+    if (sd24_pending()) {
+      return vector::sd24;
+    }
+    if ((peek(TA0CCTL0) & (CCIE | CCIFG)) == (CCIE | CCIFG)) {
+      return vector::timer_a0_ccr0;
+    }
+    if ((port_pending & 0x00ffU) != 0U) {
+      return vector::port1;
+    }
+    if ((port_pending & 0xff00U) != 0U) {
+      return vector::port2;
+    }
+    return -1;
+  }
+
+  void Simulator::dispatch() {
+    if ((vectors_ == nullptr) || (isr_depth_ > 0)) {
+      return;
+    }
+    for (auto i = 0; gie_ && (i < max_nested_dispatches); ++i) {
+      const auto vector = pending_vector();
+      if (vector < 0) {
+        return;
+      }
+      if (vector == vector::timer_a0_ccr0) {
+        // the single-source flag is reset when the interrupt is accepted
+        clear_flags(TA0CCTL0, CCIFG);
+      }
+      if ((vector >= vector_count_) || (vectors_[vector] == nullptr)) {
+        fail("interrupt without service routine");
+      }
+      ++isr_depth_;
+      gie_ = false;
+      vectors_[vector]();
+      gie_ = true;
+      --isr_depth_;
+    }
+    if (gie_) {
+      fail("interrupt source is never cleared");
+    }
+  }
+
+  void Simulator::enable_interrupts() {
+    if (std::this_thread::get_id() != firmware_thread_) {
+      return;
+    }
+    gie_ = true;
+    if (isr_depth_ == 0) {
+      dispatch();
+    }
+  }
+
+  void Simulator::disable_interrupts() {
+    if (std::this_thread::get_id() == firmware_thread_) {
+      gie_ = false;
+    }
+  }
+
+  void Simulator::sleep() {
+    wake_ = false;
+    while (true) {
+      dispatch();
+      if (wake_) {
+        wake_ = false;
+        return;
+      }
+      advance_to(std::min(next_event(), std::max(deadline_, cycles_)));
+      checkpoint();
+    }
+  }
+
+  void Simulator::spin() {
+    dispatch();
+    advance_to(std::min(next_event(), std::max(deadline_, cycles_)));
+    checkpoint();
+    dispatch();
+  }
+
+  void Simulator::delay(const long cycles) {
+    const auto target = cycles_ + static_cast<uint64_t>(std::max(cycles, 0L));
+    while (cycles_ < target) {
+      advance_to(std::min(next_event(), target));
+      dispatch();
+      checkpoint();
+    }
+  }
+
+  bool Simulator::install_vectors(void (*const *const vectors)(),
+                                  const int count) {
+    vectors_ = vectors;
+    vector_count_ = count;
+    return true;
+  }
+
+  // --- firmware execution ----------------------------------------------------
+
+  bool Simulator::run_until(int (*const entry)(),
+                            const std::function<bool()> &condition,
+                            const double timeout_s) {
+    auto lock = std::unique_lock{mutex_};
+    condition_ = condition;
+    deadline_ = cycles_
+                + static_cast<uint64_t>(timeout_s * static_cast<double>(mclk_Hz));
+    if (!started_) {
+      started_ = true;
+      if (initial_data_.empty()) {
+        initial_data_.assign(__start_firmware_static, __stop_firmware_static);
+      }
+      std::thread{&Simulator::firmware_main, this, entry}.detach();
+    }
+    if (!returned_) {
+      firmware_turn_ = true;
+      turn_changed_.notify_all();
+      turn_changed_.wait(lock, [this] { return !firmware_turn_; });
+    }
+    return condition_();
+  }
+
+  void Simulator::firmware_main(int (*const entry)()) {
+    {
+      auto lock = std::unique_lock{mutex_};
+      firmware_thread_ = std::this_thread::get_id();
+      turn_changed_.wait(lock, [this] { return firmware_turn_; });
+    }
+    try {
+      entry();
+    } catch (const Stop &) {
+      // restarted
+    }
+    auto lock = std::unique_lock{mutex_};
+    returned_ = true;
+    firmware_turn_ = false;
+    turn_changed_.notify_all();
+  }
+
+  void Simulator::checkpoint() {
+    if ((condition_ && condition_()) || (cycles_ >= deadline_)) {
+      hand_over_to_host();
+    }
+  }
+
+  void Simulator::hand_over_to_host() {
+    auto lock = std::unique_lock{mutex_};
+    firmware_turn_ = false;
+    turn_changed_.notify_all();
+    turn_changed_.wait(lock, [this] { return firmware_turn_; });
+    if (stopping_) {
+      throw Stop{};
+    }
+  }
+
+  // --- bus -------------------------------------------------------------------
+
+  uint16_t read(const intptr_t address, const unsigned width) {
+    return Simulator::instance().read(address, width);
+  }
+
+  void write(const intptr_t address, const unsigned width,
+             const uint16_t value) {
+    Simulator::instance().write(address, width, value);
+  }
+
+  void enable_interrupts() { Simulator::instance().enable_interrupts(); }
+  void disable_interrupts() { Simulator::instance().disable_interrupts(); }
+  void sleep() { Simulator::instance().sleep(); }
+  void stay_awake() { Simulator::instance().stay_awake(); }
+  void spin() { Simulator::instance().spin(); }
+  void delay(const long cycles) { Simulator::instance().delay(cycles); }
+
+  bool install_vectors(void (*const *const vectors)(), const int count) {
+    return Simulator::instance().install_vectors(vectors, count);
+  }
+
+} // namespace host
+
+/// The reset vector is never taken on the host, `main()` is called directly.
+extern "C" [[noreturn]] void on_reset() { std::abort(); }
@@ -0,0 +1,229 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#ifndef MSPMETER_HOST_SIMULATOR_HPP
+#define MSPMETER_HOST_SIMULATOR_HPP
+
+#include "bus.hpp"
+
+#include <array>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace host {
+
+  /// Simulates the peripherals of the MSP430i2041 that are used by the
+  /// firmware, i.e. SD24, eUSCI_A0 (UART), eUSCI_B0 (SPI), port A, flash
+  /// controller and Timer_A0, and dispatches their interrupts through the
+  /// firmware's vector table.
+  ///    The firmware runs on a thread of its own, but never concurrently with
+  /// the test: `run_until()` hands over execution and waits until the firmware
+  /// reaches a point, at which the given condition holds. Simulated time only
+  /// passes, while the firmware sleeps, busy-waits or delays, so code is
+  /// assumed to execute in zero time and every run is deterministic.
+  ///    There is no accounting of instruction cycles: latencies measured in
+  /// simulated time leave out the execution time of the firmware, and the
+  /// host time of a run says nothing about the CPU load on the MSP430.
+  class Simulator {
+    public:
+      static constexpr auto mclk_Hz = 16'384'000L;
+      static constexpr auto aclk_divider = 500L;
+
+      /// Returns the raw 24-bit conversion result of `channel` for the
+      /// `sample`-th group conversion.
+      using Waveform = std::function<int32_t(int channel, uint64_t sample)>;
+
+      struct Transmitted_byte {
+          uint64_t cycle;
+          uint8_t value;
+      };
+
+      static Simulator &instance();
+
+      /// Resets all peripherals to their power-up state. Must not be called
+      /// while the firmware is running.
+      void reset();
+
+      /// Stops the firmware, resets the peripherals and the simulated time
+      /// and restores the static data of the firmware, i.e. its RAM and its
+      /// calibration data in flash, as they were after programming the MCU.
+      /// The next `run_until()` starts the firmware from its entry point, so
+      /// that a test does not depend on the ones before it.
+      void restart();
+
+      uint64_t cycles() const { return cycles_; }
+      double seconds() const {
+        return static_cast<double>(cycles_) / static_cast<double>(mclk_Hz);
+      }
+
+      // stimuli
+
+      void set_waveform(Waveform waveform) { waveform_ = std::move(waveform); }
+      void set_port_input(uint16_t pins);
+      void receive(std::string_view bytes);
+
+      // observations
+
+      uint64_t sd24_conversions() const { return sd24_.conversions; }
+      const std::vector<Transmitted_byte> &uart_output() const {
+        return uca0_.output;
+      }
+      std::string uart_text() const;
+      /// the duration of a character at the baud rate of eUSCI_A0
+      double uart_character_s() const {
+        return static_cast<double>(character_cycles(uca0_))
+               / static_cast<double>(mclk_Hz);
+      }
+      const std::vector<Transmitted_byte> &spi_output() const {
+        return ucb0_.output;
+      }
+      void clear_output();
+
+      int flash_erases() const { return flash_.erases; }
+      int flash_writes() const { return flash_.writes; }
+      int flash_key_violations() const { return flash_.key_violations; }
+
+      bool interrupts_enabled() const { return gie_; }
+
+      // firmware execution
+
+      /// Runs the firmware `entry` point (the renamed `main()`) until
+      /// `condition` holds at a sleep, spin or delay, or until `timeout_s` of
+      /// simulated time have passed.
+      /// \return Whether the condition holds.
+      bool run_until(int (*entry)(), const std::function<bool()> &condition,
+                     double timeout_s);
+
+      // bus, called by the firmware; drivers, which are unit tested on the
+      // test thread, leave the interrupt state of the firmware alone
+      uint16_t read(intptr_t address, unsigned width);
+      void write(intptr_t address, unsigned width, uint16_t value);
+      void enable_interrupts();
+      void disable_interrupts();
+      void sleep();
+      void stay_awake() { wake_ = true; }
+      void spin();
+      void delay(long cycles);
+      bool install_vectors(void (*const *vectors)(), int count);
+
+    private:
+      struct Eusci {
+          intptr_t base;
+          uint16_t ifg_address;
+          uint16_t ie_address;
+          uint16_t iv_address;
+          uint16_t txbuf_address;
+          uint16_t rxbuf_address;
+          bool shifting{false};
+          uint64_t done_at{0U};
+          uint8_t shift_register{0U};
+          uint8_t buffer{0U};
+          bool buffered{false};
+          std::vector<Transmitted_byte> output{};
+          std::string rx_pending{};
+          uint64_t rx_at{0U};
+      };
+
+      struct Sd24 {
+          bool running{false};
+          uint64_t next_at{0U};
+          uint64_t conversions{0U};
+          std::array<int32_t, 4> results{};
+          /// the PGA gain of every channel, the one before the last switch
+          /// and the number of conversions since then
+          std::array<int, 4> gains{{1, 1, 1, 1}};
+          std::array<int, 4> previous_gains{{1, 1, 1, 1}};
+          std::array<int, 4> since_switch{};
+      };
+
+      struct Flash {
+          int erases{0};
+          int writes{0};
+          int key_violations{0};
+      };
+
+      struct Timer {
+          uint64_t started_at{0U};
+          /// 0 while the timer is stopped
+          uint64_t next_at{0U};
+      };
+
+      Simulator();
+
+      uint16_t peek(intptr_t address) const;
+      void poke(intptr_t address, uint16_t value);
+      void set_flags(intptr_t address, uint16_t mask);
+      void clear_flags(intptr_t address, uint16_t mask);
+
+      uint64_t character_cycles(const Eusci &eusci) const;
+      uint64_t sd24_period() const;
+      uint64_t timer_period() const;
+      uint16_t timer_count() const;
+
+      void write_tx_buffer(Eusci &eusci, uint16_t value);
+      uint16_t read_eusci_iv(Eusci &eusci);
+      /// \return The gain of the PGA of `channel` for the next conversion.
+      double sd24_gain(int channel);
+      uint16_t read_sd24_memory(int channel);
+      uint16_t read_sd24_iv();
+      uint16_t read_port_iv(intptr_t ifg_address);
+      void write_flash_control(intptr_t address, uint16_t value);
+      void update_port_flags(uint16_t previous_pins);
+
+      uint64_t next_event() const;
+      void advance_to(uint64_t cycle);
+      void dispatch();
+      int pending_vector() const;
+      void checkpoint();
+
+      void firmware_main(int (*entry)());
+      void hand_over_to_host();
+
+      /// thrown on the firmware thread to unwind it for a restart
+      struct Stop {};
+
+      std::array<uint8_t, 0x200> memory_{};
+      uint64_t cycles_{0U};
+
+      bool gie_{false};
+      bool wake_{false};
+      int isr_depth_{0};
+      void (*const *vectors_)(){nullptr};
+      int vector_count_{0};
+
+      Waveform waveform_{};
+      Sd24 sd24_{};
+      Eusci uca0_;
+      Eusci ucb0_;
+      Flash flash_{};
+      Timer timer_{};
+
+      std::mutex mutex_{};
+      std::thread::id firmware_thread_{};
+      std::condition_variable turn_changed_{};
+      bool firmware_turn_{false};
+      bool started_{false};
+      bool returned_{false};
+      bool stopping_{false};
+      /// the static data of the firmware before it first ran
+      std::vector<char> initial_data_{};
+      std::function<bool()> condition_{};
+      uint64_t deadline_{0U};
+  };
+
+  namespace vector {
+    constexpr auto port1 = 18;
+    constexpr auto port2 = 17;
+    constexpr auto timer_a0_ccr0 = 22;
+    constexpr auto sd24 = 23;
+    constexpr auto eusci_b0 = 24;
+    constexpr auto eusci_a0 = 25;
+  } // namespace vector
+
+} // namespace host
+
+#endif // MSPMETER_HOST_SIMULATOR_HPP
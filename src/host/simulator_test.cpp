@@ -0,0 +1,1470 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#include "simulator.hpp"
+
+#include "calibration.hpp"
+#include "config.hpp"
+#include "modbus.hpp"
+#include "telemetry.hpp"
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <memory>
+#include <numbers>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/// The firmware's `main()`, renamed for the host build.
+int firmware_main();
+
+namespace meter {
+
+  namespace {
+
+    auto &sim = host::Simulator::instance();
+
+    Size count_lines() {
+      const auto &output = sim.uart_output();
+      return std::count_if(output.begin(), output.end(),
+                           [](const auto &byte) { return byte.value == '\n'; });
+    }
+
+    bool run_for_lines(const Size number_of_lines, const double timeout_s) {
+      return sim.run_until(
+          firmware_main,
+          [number_of_lines] { return count_lines() >= number_of_lines; },
+          timeout_s);
+    }
+
+    /// \return The values of the last complete line sent over the UART.
+    std::vector<int32_t> last_line() {
+      const auto text = sim.uart_text();
+      const auto end = text.rfind("\r\n");
+      const auto begin = text.rfind("\r\n", end - 1);
+      auto values = std::vector<int32_t>{};
+      const auto *first = text.data()
+                          + ((begin == std::string::npos) ? 0 : begin + 2);
+      const auto *const last = text.data() + end;
+      while (first < last) {
+        auto value = int32_t{};
+        const auto result = std::from_chars(first, last, value);
+        if (result.ec != std::errc{}) {
+          break;
+        }
+        values.push_back(value);
+        first = result.ptr + 1;
+      }
+      return values;
+    }
+
+    /// \return The value of `channel` of every reading sent since the output
+    ///    was cleared, except for the first one, which may be incomplete.
+    std::vector<int32_t> readings_of(const int channel) {
+      const auto text = sim.uart_text();
+      auto readings = std::vector<int32_t>{};
+      for (auto begin = text.find("\r\n"), end = text.find("\r\n", begin + 2);
+           end != std::string::npos;
+           begin = end, end = text.find("\r\n", begin + 2)) {
+        const auto *const last = text.data() + end;
+        auto value = int32_t{};
+        auto result = std::from_chars(text.data() + begin + 2, last, value);
+        for (auto index = 0; (index < channel) && (result.ec == std::errc{});
+             ++index) {
+          result = (result.ptr < last)
+                       ? std::from_chars(result.ptr + 1, last, value)
+                       : std::from_chars_result{last,
+                                                std::errc::invalid_argument};
+        }
+        if (result.ec == std::errc{}) {
+          readings.push_back(value);
+        }
+      }
+      return readings;
+    }
+
+    /// \return The telemetry frames sent since the output was cleared, which
+    ///    could be decoded, without their CRC. A reply "OK" in front of the
+    ///    first one is skipped.
+    std::vector<std::vector<uint8_t>> frames() {
+      auto text = sim.uart_text();
+      if (text.starts_with("OK\r\n")) {
+        text.erase(0, 4);
+      }
+      auto decoded = std::vector<std::vector<uint8_t>>{};
+      for (auto begin = std::size_t{0}, end = text.find('\0');
+           end != std::string::npos;
+           begin = end + 1, end = text.find('\0', begin)) {
+        auto frame = std::vector<uint8_t>(
+            text.begin() + static_cast<std::ptrdiff_t>(begin),
+            text.begin() + static_cast<std::ptrdiff_t>(end));
+        frame.resize(std::max(frame.size(), std::size_t{1}));
+        const auto length =
+            telemetry::decode(frame.data(), static_cast<Size>(end - begin));
+        if (length > 0) {
+          frame.resize(static_cast<std::size_t>(length));
+          decoded.push_back(frame);
+        }
+      }
+      return decoded;
+    }
+
+    int32_t expected_uV(const int channel, const int32_t conversion_result) {
+      return apply(conversion_result, compile(default_calibration[channel]));
+    }
+
+    /// Sends a command line and waits for its reply. Readings, which are
+    /// transmitted meanwhile, are skipped, unless the command is a query.
+    /// \return The reply and the time it took until it was received.
+    std::pair<std::string, double> command(const std::string_view line) {
+      const auto is_query = line.find('?') != std::string_view::npos;
+      const auto find_reply = [is_query] {
+        const auto text = sim.uart_text();
+        auto begin = std::size_t{0};
+        for (auto end = text.find('\n'); end != std::string::npos;
+             begin = end + 1, end = text.find('\n', begin)) {
+          // the rest of a binary frame may come before the reply
+          const auto zero = text.rfind('\0', end);
+          const auto first =
+              ((zero != std::string::npos) && (zero >= begin)) ? zero + 1
+                                                               : begin;
+          const auto candidate = text.substr(first, end + 1 - first);
+          if (is_query || (candidate == "OK\r\n")
+              || (candidate == "ERR\r\n")) {
+            return candidate;
+          }
+        }
+        return std::string{};
+      };
+
+      sim.clear_output();
+      const auto sent_cycle = sim.cycles();
+      sim.receive(line);
+      sim.receive("\r\n");
+      if (!sim.run_until(
+              firmware_main, [&] { return !find_reply().empty(); }, 1.0)) {
+        return {};
+      }
+      return {find_reply(),
+              static_cast<double>(sim.uart_output().back().cycle - sent_cycle)
+                  / host::Simulator::mclk_Hz};
+    }
+
+    std::string reply(const std::string_view line) {
+      return command(line).first;
+    }
+
+    /// Switches from `serial_baud_rate`, with which the meter starts, to a
+    /// higher `baud_rate`, as a host would, which opts in to it.
+    void select_baud_rate(const int32_t baud_rate) {
+      REQUIRE(reply("baud " + std::to_string(baud_rate)) == "OK\r\n");
+      REQUIRE(reply("baud?") == std::to_string(baud_rate) + "\r\n");
+    }
+
+    /// Sends a Modbus `request`, to which the CRC is appended, and waits for
+    /// the response. The master pauses for `pause_s` after the first half of
+    /// the request.
+    /// \return The response including its CRC, empty for none, and the time
+    ///    from the end of the request until it was received.
+    std::pair<std::vector<uint8_t>, double>
+    modbus_request(const std::vector<uint8_t> &request,
+                   const double pause_s = 0.0) {
+      const auto crc = Crc16_modbus::compute(
+          request.data(), static_cast<Size>(request.size()));
+      auto frame = std::string(request.begin(), request.end());
+      frame.push_back(static_cast<char>(crc));
+      frame.push_back(static_cast<char>(crc >> 8U));
+      const auto response = [] {
+        auto bytes = std::vector<uint8_t>{};
+        for (const auto &byte : sim.uart_output()) {
+          bytes.push_back(byte.value);
+        }
+        return bytes;
+      };
+      const auto complete = [&response] {
+        const auto bytes = response();
+        return (bytes.size() >= 5)
+               && (Crc16_modbus::compute(bytes.data(),
+                                         static_cast<Size>(bytes.size()))
+                   == 0U);
+      };
+
+      sim.clear_output();
+      const auto sent_cycle = sim.cycles();
+      if (pause_s > 0.0) {
+        const auto first_half = std::string_view{frame}.substr(
+            0, frame.size() / 2);
+        sim.receive(first_half);
+        sim.run_until(
+            firmware_main, [] { return false; },
+            (static_cast<double>(first_half.size()) * sim.uart_character_s())
+                + pause_s);
+        sim.receive(std::string_view{frame}.substr(first_half.size()));
+      } else {
+        sim.receive(frame);
+      }
+      if (!sim.run_until(firmware_main, complete, 0.05)) {
+        return {};
+      }
+      const auto latency_s =
+          (static_cast<double>(sim.uart_output().back().cycle - sent_cycle)
+           / host::Simulator::mclk_Hz)
+          - (static_cast<double>(frame.size()) * sim.uart_character_s())
+          - pause_s;
+      return {response(), latency_s};
+    }
+
+  } // namespace
+
+  SCENARIO("firmware runs on the simulated MCU") {
+    sim.restart();
+
+    GIVEN("constant inputs on all channels") {
+      const auto inputs = std::array<int32_t, used_channels>{
+          {0x40'0000, -0x12'3456, 0x00'1000, 0x7f'0000}};
+      sim.set_waveform([inputs](const int channel, uint64_t) {
+        return inputs[static_cast<std::size_t>(channel)];
+      });
+
+      WHEN("running until a few readings were transmitted") {
+        sim.clear_output();
+        REQUIRE(run_for_lines(3, 1.0));
+
+        THEN("the calibrated readings are sent over the UART") {
+          const auto values = last_line();
+          REQUIRE(values.size() == used_channels);
+          for (auto i = 0; i < used_channels; ++i) {
+            CHECK(values[static_cast<std::size_t>(i)]
+                  == expected_uV(i, inputs[static_cast<std::size_t>(i)]));
+          }
+        }
+
+        THEN("no flash operations were performed") {
+          CHECK(sim.flash_erases() == 0);
+          CHECK(sim.flash_key_violations() == 0);
+        }
+      }
+    }
+  }
+
+  SCENARIO("restarting the simulated MCU") {
+    sim.restart();
+
+    GIVEN("a meter, whose configuration was changed") {
+      sim.set_waveform([](const int, uint64_t) { return 0x10'0000; });
+      REQUIRE(reply("rate 0") == "OK\r\n");
+      REQUIRE(reply("avg 64") == "OK\r\n");
+
+      WHEN("it is restarted") {
+        sim.restart();
+
+        THEN("the firmware starts over with the defaults") {
+          CHECK(sim.cycles() == 0U);
+          REQUIRE(run_for_lines(3, 1.0));
+          REQUIRE(reply("rate 0") == "OK\r\n");
+          CHECK(reply("avg?") == "256\r\n");
+        }
+      }
+    }
+  }
+
+  SCENARIO("end-to-end latency of a step on the input") {
+    sim.restart();
+
+    GIVEN("a step on channel 1 shortly after the start of a measurement") {
+      constexpr auto step = int32_t{0x20'0000};
+      const auto step_sample = sim.sd24_conversions() + 10U;
+      const auto step_cycle = std::make_shared<uint64_t>(0U);
+      sim.set_waveform([step_sample, step_cycle](const int channel,
+                                                 const uint64_t sample) {
+        if (sample == step_sample) {
+          *step_cycle = sim.cycles();
+        }
+        return ((channel == 1) && (sample >= step_sample)) ? step : 0;
+      });
+      sim.clear_output();
+
+      WHEN("running until the new value is transmitted") {
+        const auto settled = [] {
+          const auto &output = sim.uart_output();
+          return !output.empty() && (output.back().value == '\n')
+                 && (last_line().size() == used_channels)
+                 && (last_line()[1] == expected_uV(1, step));
+        };
+        REQUIRE(sim.run_until(firmware_main, settled, 1.0));
+
+        // without the execution time of the firmware, which the simulator
+        // does not account for
+        THEN("it arrives within two averaging windows plus transmission") {
+          const auto sample_period_s = 256.0 * 16.0 / host::Simulator::mclk_Hz;
+          const auto latency_s =
+              static_cast<double>(sim.uart_output().back().cycle - *step_cycle)
+              / host::Simulator::mclk_Hz;
+          INFO("latency: " << latency_s * 1e3 << " ms");
+          CHECK(latency_s > 0.0);
+          CHECK(latency_s < 2 * number_of_oversamples * sample_period_s + 0.06);
+        }
+      }
+    }
+  }
+
+  SCENARIO("the display is refreshed independently of the readings") {
+    sim.restart();
+
+    constexpr auto refresh_period_s = 1.0 / display_refresh_Hz;
+
+    GIVEN("a short averaging length and a changing input") {
+      select_baud_rate(115'200);
+      REQUIRE(reply("avg 16") == "OK\r\n");
+      sim.set_waveform([](const int, const uint64_t sample) {
+        return static_cast<int32_t>(sample * 1'000U % 0x40'0000U);
+      });
+      sim.clear_output();
+      sim.run_until(firmware_main, [] { return false; }, 2.0);
+
+      THEN("the readings go out at full rate") {
+        CHECK(count_lines() >= 400);
+      }
+
+      THEN("the display is refreshed at its refresh rate") {
+        const auto updates = sim.spi_output().size() / 8;
+        CHECK(updates >= static_cast<std::size_t>(2.0 / refresh_period_s) - 1);
+        CHECK(updates <= static_cast<std::size_t>(2.0 / refresh_period_s) + 1);
+      }
+
+      REQUIRE(reply("avg 256") == "OK\r\n");
+    }
+
+    GIVEN("a constant input") {
+      sim.set_waveform([](const int, uint64_t) { return 0x20'0000; });
+      sim.run_until(firmware_main, [] { return false; }, 1.0);
+      sim.clear_output();
+      sim.run_until(firmware_main, [] { return false; }, 2.0);
+
+      THEN("the unchanged display is not shifted out again") {
+        CHECK(sim.spi_output().empty());
+      }
+    }
+  }
+
+  SCENARIO("remote control over the serial interface") {
+    sim.restart();
+
+    GIVEN("a meter with the transmission of readings stopped") {
+      sim.set_waveform([](const int, uint64_t) { return 0x10'0000; });
+      REQUIRE(reply("rate 0") == "OK\r\n");
+      // let readings, which were queued before, go out
+      sim.run_until(firmware_main, [] { return false; }, 0.1);
+
+      THEN("queries are answered within one measurement cycle") {
+        const auto [text, latency_s] = command("avg?");
+        CHECK(text == "256\r\n");
+        CHECK(latency_s < number_of_oversamples * 256.0 * 16.0
+                              / host::Simulator::mclk_Hz);
+      }
+
+      THEN("the configuration can be changed") {
+        CHECK(reply("AVG 64") == "OK\r\n");
+        CHECK(reply("avg?") == "64\r\n");
+        CHECK(reply("avg 3000000") == "ERR\r\n");
+        CHECK(reply("mask 5") == "OK\r\n");
+        CHECK(reply("mask?") == "5\r\n");
+        CHECK(reply("mask 16") == "ERR\r\n");
+        CHECK(reply("fmt?") == "text\r\n");
+        CHECK(reply("rate?") == "0\r\n");
+        CHECK(reply("mode 3 ac") == "OK\r\n");
+        CHECK(reply("mode? 3") == "ac\r\n");
+        CHECK(reply("mode 3 dc") == "OK\r\n");
+        CHECK(reply("mode? 3") == "dc\r\n");
+        CHECK(reply("mode 3 peak") == "ERR\r\n");
+        CHECK(reply("adapt?") == "0 64 64 64 64\r\n");
+        CHECK(reply("adapt -1") == "ERR\r\n");
+
+        AND_THEN("readings contain the selected channels only") {
+          sim.clear_output();
+          REQUIRE(reply("rate 2") == "OK\r\n");
+          REQUIRE(run_for_lines(3, 1.0));
+          CHECK(last_line()
+                == std::vector<int32_t>{expected_uV(0, 0x10'0000),
+                                        expected_uV(2, 0x10'0000)});
+        }
+
+        REQUIRE(reply("rate 0") == "OK\r\n");
+        REQUIRE(reply("mask 15") == "OK\r\n");
+        REQUIRE(reply("avg 256") == "OK\r\n");
+      }
+
+      THEN("calibration constants can be read and written") {
+        CHECK(reply("cal? 1") == "5000000 30000000 8388607 0\r\n");
+        CHECK(reply("cal 2 1000000 2000000 4194304 -10") == "OK\r\n");
+        CHECK(reply("cal? 2") == "1000000 2000000 4194304 -10\r\n");
+        CHECK(reply("cal 2 1000000 1000000 8388607 0") == "OK\r\n");
+      }
+
+      THEN("malformed commands are rejected") {
+        CHECK(reply("bogus") == "ERR\r\n");
+        CHECK(reply("cal 5 offset") == "ERR\r\n");
+        CHECK(reply("cal? 1 2") == "ERR\r\n");
+        CHECK(reply("avg 12x") == "ERR\r\n");
+        CHECK(reply(std::string(60, 'x')) == "ERR\r\n");
+      }
+    }
+  }
+
+  SCENARIO("reporting by exception over the serial interface") {
+    sim.restart();
+
+    /// \return The lines sent since the output was cleared.
+    const auto lines = [] {
+      const auto text = sim.uart_text();
+      auto result = std::vector<std::string>{};
+      for (auto begin = std::size_t{0}, end = text.find("\r\n");
+           end != std::string::npos;
+           begin = end + 2, end = text.find("\r\n", begin)) {
+        result.push_back(text.substr(begin, end - begin));
+      }
+      return result;
+    };
+    /// \return The sequence number and the timestamp of a record.
+    const auto header = [](const std::string &line) {
+      auto sequence = 0;
+      auto timestamp_ms = int64_t{};
+      const auto *const last = line.data() + line.size();
+      const auto result = std::from_chars(line.data(), last, sequence);
+      std::from_chars(result.ptr + 1, last, timestamp_ms);
+      return std::pair{sequence, timestamp_ms};
+    };
+
+    GIVEN("constant inputs, which are reported by exception") {
+      auto level = std::make_shared<int32_t>(0x10'0000);
+      sim.set_waveform([level](const int channel, uint64_t) {
+        return (channel == 2) ? *level : 0x10'0000;
+      });
+      REQUIRE(reply("rate 0") == "OK\r\n");
+      REQUIRE(reply("report change") == "OK\r\n");
+      REQUIRE(reply("report?") == "change\r\n");
+      REQUIRE(reply("deadband 3 10000") == "OK\r\n");
+      REQUIRE(reply("deadband? 3") == "10000\r\n");
+      REQUIRE(reply("heartbeat 1000") == "OK\r\n");
+      REQUIRE(reply("heartbeat?") == "1000\r\n");
+      REQUIRE(reply("deadband 5 1") == "ERR\r\n");
+      REQUIRE(reply("heartbeat -1") == "ERR\r\n");
+      sim.clear_output();
+      REQUIRE(reply("rate 1") == "OK\r\n");
+
+      WHEN("nothing changes") {
+        sim.run_until(firmware_main, [] { return false; }, 2.5);
+
+        THEN("all channels are reported with every heartbeat only") {
+          const auto records = lines();
+          // "OK", the first reading and two heartbeats
+          REQUIRE(records.size() == 4);
+          const auto first = header(records[1]);
+          const auto last = header(records[3]);
+          CHECK(last.first == (first.first + 2) % 256);
+          CHECK(last.second - first.second >= 2'000);
+          CHECK(last.second - first.second < 2'100);
+          CHECK(records[3].ends_with(
+              "\t1=" + std::to_string(expected_uV(0, 0x10'0000)) + "\t2="
+              + std::to_string(expected_uV(1, 0x10'0000)) + "\t3="
+              + std::to_string(expected_uV(2, 0x10'0000)) + "\t4="
+              + std::to_string(expected_uV(3, 0x10'0000))));
+        }
+      }
+
+      WHEN("channel 3 moves beyond its deadband") {
+        sim.run_until(firmware_main, [] { return false; }, 0.2);
+        *level = 0x10'0000 + 0x1'0000;
+        sim.run_until(firmware_main, [] { return false; }, 0.3);
+
+        THEN("only channel 3 is reported") {
+          const auto records = lines();
+          REQUIRE(records.size() >= 3);
+          CHECK(records.back().ends_with(
+              "\t3=" + std::to_string(expected_uV(2, 0x11'0000))));
+          CHECK(records.back().find("\t1=") == std::string::npos);
+        }
+      }
+    }
+  }
+
+  SCENARIO("true-RMS measurement of AC signals") {
+    sim.restart();
+
+    // 64 samples per period, i.e. exactly four periods per reading
+    constexpr auto period = 64U;
+    constexpr auto amplitude = 0x30'0000;
+    constexpr auto dc = 0x08'0000;
+    const auto rms_uV = [](const int channel, const double rms) {
+      return expected_uV(channel, static_cast<int32_t>(std::lround(rms)));
+    };
+
+    GIVEN("a sine wave on channel 1 and a square wave on channel 2") {
+      sim.set_waveform([](const int channel, const uint64_t sample) {
+        const auto phase = static_cast<double>(sample % period) / period;
+        if (channel == 0) {
+          return dc
+                 + static_cast<int32_t>(std::lround(
+                     amplitude * std::sin(2.0 * std::numbers::pi * phase)));
+        }
+        if (channel == 1) {
+          return dc + ((phase < 0.5) ? amplitude : -amplitude);
+        }
+        return dc;
+      });
+
+      WHEN("the channels are read in DC mode") {
+        sim.clear_output();
+        REQUIRE(run_for_lines(3, 1.0));
+
+        THEN("the mean is shown") {
+          const auto values = last_line();
+          REQUIRE(values.size() == used_channels);
+          CHECK(std::abs(values[0] - expected_uV(0, dc)) <= 10);
+          CHECK(values[1] == expected_uV(1, dc));
+        }
+      }
+
+      WHEN("the channels are read in AC mode") {
+        REQUIRE(reply("mode 1 ac") == "OK\r\n");
+        REQUIRE(reply("mode 2 AC") == "OK\r\n");
+        sim.clear_output();
+        REQUIRE(run_for_lines(3, 1.0));
+
+        THEN("the RMS values without DC are shown") {
+          const auto values = last_line();
+          REQUIRE(values.size() == used_channels);
+          CHECK(std::abs(values[0]
+                         - rms_uV(0, amplitude / std::numbers::sqrt2))
+                <= 10);
+          CHECK(values[1] == rms_uV(1, amplitude));
+          CHECK(values[2] == expected_uV(2, dc));
+        }
+      }
+
+      WHEN("the channels are read in true-RMS mode") {
+        REQUIRE(reply("mode 1 rms") == "OK\r\n");
+        REQUIRE(reply("mode 2 rms") == "OK\r\n");
+        sim.clear_output();
+        REQUIRE(run_for_lines(3, 1.0));
+
+        THEN("the RMS values including DC are shown") {
+          const auto values = last_line();
+          REQUIRE(values.size() == used_channels);
+          CHECK(std::abs(values[0]
+                         - rms_uV(0, std::hypot(amplitude / std::numbers::sqrt2,
+                                                dc)))
+                <= 10);
+          CHECK(std::abs(values[1] - rms_uV(1, std::hypot(amplitude, dc)))
+                <= 10);
+        }
+      }
+    }
+  }
+
+  SCENARIO("peaks within a reading are held") {
+    sim.restart();
+
+    constexpr auto level = 0x10'0000;
+    constexpr auto spike = 0x70'0000;
+    const auto peaks = [](const int channel) {
+      const auto text = reply("peak? " + std::to_string(channel + 1));
+      auto result = std::vector<int32_t>{};
+      const auto *first = text.data();
+      const auto *const last = text.data() + text.size();
+      for (auto value = int32_t{};;) {
+        const auto parsed = std::from_chars(first, last, value);
+        if (parsed.ec != std::errc{}) {
+          break;
+        }
+        result.push_back(value);
+        first = parsed.ptr + 1;
+      }
+      return result;
+    };
+
+    GIVEN("a single sample spike on channel 3") {
+      const auto spike_sample = sim.sd24_conversions() + 1'600U;
+      sim.set_waveform([spike_sample](const int channel,
+                                      const uint64_t sample) {
+        return ((channel == 2) && (sample == spike_sample)) ? spike : level;
+      });
+      REQUIRE(reply("rate 0") == "OK\r\n");
+      // the hold must not see the windows with the previous waveform
+      sim.run_until(firmware_main, [] { return false; }, 0.2);
+      REQUIRE(reply("peak reset") == "OK\r\n");
+      sim.run_until(firmware_main, [] { return false; }, 0.5);
+
+      THEN("the hold keeps the spike after it has passed") {
+        const auto values = peaks(2);
+        REQUIRE(values.size() == 6);
+        CHECK(values[0] == expected_uV(2, level));
+        CHECK(values[1] == expected_uV(2, level));
+        CHECK(values[2] == 0);
+        CHECK(values[3] == expected_uV(2, level));
+        CHECK(values[4] == expected_uV(2, spike));
+        CHECK(values[5] == expected_uV(2, spike) - expected_uV(2, level));
+      }
+
+      THEN("other channels are not affected") {
+        const auto values = peaks(0);
+        REQUIRE(values.size() == 6);
+        CHECK(values[4] == expected_uV(0, level));
+      }
+
+      WHEN("the hold is reset") {
+        REQUIRE(reply("peak reset") == "OK\r\n");
+        sim.run_until(firmware_main, [] { return false; }, 0.2);
+
+        THEN("the spike is forgotten") {
+          const auto values = peaks(2);
+          REQUIRE(values.size() == 6);
+          CHECK(values[4] == expected_uV(2, level));
+          CHECK(values[5] == 0);
+        }
+      }
+    }
+  }
+
+  SCENARIO("power and energy of a fluctuating DC load") {
+    sim.restart();
+
+    constexpr auto high = 0x60'0000;
+    constexpr auto low = 0x20'0000;
+    const auto to_W = [](const int channel, const int32_t reading) {
+      return expected_uV(channel, reading) / 1e6;
+    };
+    const auto power_W = ((to_W(0, high) * to_W(1, high))
+                          + (to_W(0, low) * to_W(1, low)))
+                         / 2;
+    const auto current_A = (to_W(1, high) + to_W(1, low)) / 2;
+    const auto values = [](const std::string &text) {
+      auto result = std::vector<int64_t>{};
+      const auto *first = text.data();
+      const auto *const last = text.data() + text.size();
+      for (auto value = int64_t{};
+           std::from_chars(first, last, value).ec == std::errc{};) {
+        result.push_back(value);
+        first = std::from_chars(first, last, value).ptr + 1;
+      }
+      return result;
+    };
+
+    GIVEN("voltage and current switching in phase within every reading") {
+      sim.set_waveform([](const int channel, const uint64_t sample) {
+        return ((channel <= 1) && ((sample % 64U) < 32U)) ? high : low;
+      });
+      REQUIRE(reply("rate 0") == "OK\r\n");
+      // wait for a window, which started after the change of the waveform
+      sim.run_until(firmware_main, [] { return false; }, 0.2);
+
+      THEN("the power is the mean of the instantaneous power") {
+        const auto power = values(reply("power?"));
+        REQUIRE(power.size() == 3);
+        CHECK(std::abs(static_cast<double>(power[0]) - (power_W * 1e6)) <= 1);
+      }
+
+      WHEN("integrating over two seconds") {
+        constexpr auto duration_s = 2.0;
+        REQUIRE(reply("energy reset") == "OK\r\n");
+        sim.run_until(firmware_main, [] { return false; }, duration_s);
+        const auto counters = values(reply("energy?"));
+
+        THEN("energy and charge are counted up to the last reading") {
+          const auto reading_s = number_of_oversamples * 1.0
+                                 / sampling_frequency_Hz;
+          REQUIRE(counters.size() == 2);
+          CHECK(std::abs(static_cast<double>(counters[0])
+                         - (power_W * duration_s / 3.6e-3))
+                <= power_W * reading_s / 3.6e-3);
+          CHECK(std::abs(static_cast<double>(counters[1])
+                         - (current_A * duration_s / 3.6e-3))
+                <= current_A * reading_s / 3.6e-3);
+        }
+      }
+    }
+  }
+
+  SCENARIO("power of an AC load") {
+    sim.restart();
+
+    constexpr auto period = 64U;
+    constexpr auto amplitude = 0x40'0000;
+    const auto peak_W = [](const int channel) {
+      return expected_uV(channel, amplitude) / 1e6;
+    };
+    const auto values = [](const std::string &text) {
+      auto result = std::vector<int32_t>{};
+      const auto *first = text.data();
+      const auto *const last = text.data() + text.size();
+      for (auto value = int32_t{};;) {
+        const auto parsed = std::from_chars(first, last, value);
+        if (parsed.ec != std::errc{}) {
+          break;
+        }
+        result.push_back(value);
+        first = parsed.ptr + 1;
+      }
+      return result;
+    };
+
+    GIVEN("a sinusoidal current lagging the voltage by 60 degrees") {
+      sim.set_waveform([](const int channel, const uint64_t sample) {
+        const auto phase = 2.0 * std::numbers::pi
+                           * static_cast<double>(sample % period) / period;
+        if (channel == 0) {
+          return static_cast<int32_t>(std::lround(amplitude * std::sin(phase)));
+        }
+        if (channel == 1) {
+          return static_cast<int32_t>(std::lround(
+              amplitude * std::sin(phase - (std::numbers::pi / 3))));
+        }
+        return 0;
+      });
+      REQUIRE(reply("rate 0") == "OK\r\n");
+      sim.run_until(firmware_main, [] { return false; }, 0.2);
+
+      THEN("real power, apparent power and power factor are reported") {
+        const auto power = values(reply("power?"));
+        REQUIRE(power.size() == 3);
+        const auto apparent_W = peak_W(0) * peak_W(1) / 2;
+        CHECK(std::abs(power[0] - (apparent_W * 0.5 * 1e6)) <= 10);
+        CHECK(std::abs(power[1] - (apparent_W * 1e6)) <= 10);
+        CHECK(power[2] == 500);
+      }
+    }
+  }
+
+  SCENARIO("auto-ranging of a small current") {
+    sim.restart();
+
+    constexpr auto small = 0x02'0000;
+    constexpr auto large = 0x60'0000;
+    const auto set_input = [](const int32_t input) {
+      sim.set_waveform([input](const int channel, uint64_t) {
+        return (channel == 1) ? input : 0;
+      });
+    };
+    const auto gain = [] {
+      REQUIRE(reply("rate 0") == "OK\r\n");
+      const auto answer = reply("gain? 2");
+      REQUIRE(reply("rate 1") == "OK\r\n");
+      return answer;
+    };
+
+    GIVEN("a current of 1/64 of full scale") {
+      set_input(small);
+      sim.run_until(firmware_main, [] { return false; }, 0.2);
+
+      WHEN("the gain follows the signal") {
+        REQUIRE(reply("gain 2 auto") == "OK\r\n");
+        sim.run_until(firmware_main, [] { return false; }, 0.6);
+        const auto readings = readings_of(1);
+
+        THEN("it is raised to 16") { CHECK(gain() == "auto 16\r\n"); }
+
+        THEN("no reading is disturbed by the switching") {
+          REQUIRE(readings.size() >= 8);
+          for (const auto reading : readings) {
+            CHECK(std::abs(reading - expected_uV(1, small)) <= 1);
+          }
+        }
+
+        AND_WHEN("the current rises to 3/4 of full scale") {
+          set_input(large);
+          sim.run_until(firmware_main, [] { return false; }, 0.6);
+
+          THEN("the gain is lowered to 1") {
+            CHECK(gain() == "auto 1\r\n");
+            sim.clear_output();
+            REQUIRE(run_for_lines(3, 1.0));
+            CHECK(std::abs(last_line()[1] - expected_uV(1, large)) <= 1);
+          }
+        }
+      }
+
+      WHEN("a fixed gain with a trimmed range is selected") {
+        REQUIRE(reply("gain 2 4") == "OK\r\n");
+        REQUIRE(reply("trim 2 4 655") == "OK\r\n");
+        sim.run_until(firmware_main, [] { return false; }, 0.2);
+
+        THEN("the reading is corrected by the trim of the range") {
+          CHECK(gain() == "4 4\r\n");
+          REQUIRE(reply("rate 0") == "OK\r\n");
+          CHECK(reply("trim? 2") == "0 0 655 0 0\r\n");
+          REQUIRE(reply("rate 1") == "OK\r\n");
+          sim.clear_output();
+          REQUIRE(run_for_lines(3, 1.0));
+          CHECK(std::abs(last_line()[1]
+                         - (expected_uV(1, small) * 65'536.0 / 66'191))
+                <= 1);
+        }
+      }
+
+      CHECK(reply("gain 2 0") == "ERR\r\n");
+    }
+  }
+
+  SCENARIO("capturing an inrush current") {
+    sim.restart();
+
+    constexpr auto peak = 0x60'0000;
+    constexpr auto steady = 0x08'0000;
+    const auto onset = sim.sd24_conversions() + 2'000;
+    const auto current = [onset](const uint64_t sample) {
+      if (sample < onset) {
+        return 0;
+      }
+      return steady
+             + static_cast<int32_t>(std::lround(
+                 (peak - steady)
+                 * std::exp(-static_cast<double>(sample - onset) / 20.0)));
+    };
+
+    GIVEN("a current, which is switched on with an inrush peak") {
+      sim.set_waveform([current](const int channel, const uint64_t sample) {
+        return (channel == 1) ? current(sample) : 0;
+      });
+      REQUIRE(reply("rate 0") == "OK\r\n");
+      REQUIRE(reply("mask 2") == "OK\r\n");
+
+      WHEN("a capture is triggered by the rising current") {
+        // 200 mA
+        REQUIRE(reply("scope 2 rise 200000 16 32") == "OK\r\n");
+        CHECK(reply("scope?") == "armed 0\r\n");
+        sim.run_until(firmware_main, [] { return false; }, 1.0);
+        REQUIRE(reply("scope?") == "done 144\r\n");
+
+        THEN("the raw samples around the onset are dumped as a block") {
+          const auto header = std::string{"#3144"};
+          const auto length = header.size() + 144 + 2;
+          sim.clear_output();
+          sim.receive("scope dump\r\n");
+          REQUIRE(sim.run_until(
+              firmware_main,
+              [length] { return sim.uart_output().size() >= length; }, 1.0));
+          const auto text = sim.uart_text();
+          REQUIRE(text.size() == length);
+          CHECK(text.starts_with(header));
+          CHECK(text.ends_with("\r\n"));
+
+          const auto *const data =
+              reinterpret_cast<const uint8_t *>(text.data() + header.size());
+          for (auto i = 0; i < 48; ++i) {
+            const auto sample =
+                static_cast<int32_t>(data[3 * i]
+                                     | (data[(3 * i) + 1] << 8U)
+                                     | (data[(3 * i) + 2] << 16U))
+                << 8 >> 8;
+            CHECK(sample
+                  == current(onset - 16 + static_cast<uint64_t>(i)));
+          }
+
+          AND_THEN("commands are answered again") {
+            CHECK(reply("scope?") == "done 144\r\n");
+          }
+        }
+      }
+
+      WHEN("the capture does not fit") {
+        THEN("it is rejected") {
+          CHECK(reply("scope 2 rise 200000 100 100") == "ERR\r\n");
+          CHECK(reply("scope 5 rise 0 1 1") == "ERR\r\n");
+          CHECK(reply("scope dump") == "ERR\r\n");
+        }
+      }
+    }
+  }
+
+  SCENARIO("batched binary telemetry") {
+    sim.restart();
+
+    GIVEN("constant inputs") {
+      sim.set_waveform([](const int channel, uint64_t) {
+        return (channel + 1) * 0x1'0000;
+      });
+      select_baud_rate(115'200);
+      REQUIRE(reply("rate 0") == "OK\r\n");
+      REQUIRE(reply("avg 16") == "OK\r\n");
+      REQUIRE(reply("batch 17") == "ERR\r\n");
+      REQUIRE(reply("batch 5") == "OK\r\n");
+      REQUIRE(reply("batch?") == "5\r\n");
+      REQUIRE(reply("fmt batch") == "OK\r\n");
+      REQUIRE(reply("fmt?") == "batch\r\n");
+
+      WHEN("readings are transmitted") {
+        sim.clear_output();
+        REQUIRE(reply("rate 1") == "OK\r\n");
+        sim.run_until(firmware_main, [] { return false; }, 0.5);
+        const auto received = frames();
+        REQUIRE(reply("rate 0") == "OK\r\n");
+
+        THEN("every frame but the calibration holds five readings") {
+          REQUIRE(received.size() >= 4);
+          CHECK(received[0][0]
+                == std::to_underlying(telemetry::Frame_type::Calibration));
+          for (auto i = std::size_t{1}; i < received.size(); ++i) {
+            REQUIRE(received[i][0]
+                    == std::to_underlying(telemetry::Frame_type::Batch));
+            CHECK(received[i][1]
+                  == static_cast<uint8_t>(received[0][1] + i));
+            auto readings = telemetry::Batch_readings{};
+            REQUIRE(telemetry::decode_batch(
+                        received[i].data(),
+                        static_cast<Size>(received[i].size()), readings)
+                    == 5);
+            for (auto channel = 0; channel < used_channels; ++channel) {
+              CHECK(readings[4][channel] == (channel + 1) * 0x1'0000);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  SCENARIO("streaming every raw sample") {
+    sim.restart();
+
+    // every channel counts the conversions in its own range of values
+    const auto sample_value = [](const int channel, const uint64_t sample) {
+      return (channel << 20) + static_cast<int32_t>(sample % 0x1'0000U);
+    };
+
+    /// Stops the stream and waits until it has been acknowledged.
+    const auto stop_stream = [] {
+      sim.receive("stream off\r\n");
+      return sim.run_until(
+          firmware_main, [] { return sim.uart_text().ends_with("OK\r\n"); },
+          1.0);
+    };
+
+    GIVEN("a meter with the transmission of readings stopped") {
+      sim.set_waveform(sample_value);
+      REQUIRE(reply("rate 0") == "OK\r\n");
+      sim.run_until(firmware_main, [] { return false; }, 0.1);
+
+      WHEN("all channels are streamed at 921600 Bd") {
+        select_baud_rate(921'600);
+        sim.clear_output();
+        sim.receive("stream 15\r\n");
+        const auto started = sim.sd24_conversions();
+        sim.run_until(firmware_main, [] { return false; }, 0.1);
+        REQUIRE(stop_stream());
+        const auto streamed = sim.sd24_conversions() - started;
+
+        THEN("every conversion is sent after the calibration") {
+          const auto received = frames();
+          REQUIRE(received.size() >= 2);
+          CHECK(received[0][0]
+                == std::to_underlying(telemetry::Frame_type::Calibration));
+          CHECK(received[0][1] == 0U);
+          // but those converted while the command was being received
+          CHECK(received.size() - 1 + 10 >= streamed);
+          CHECK(received.size() - 1 <= streamed);
+          for (auto i = std::size_t{1}; i < received.size(); ++i) {
+            const auto &frame = received[i];
+            REQUIRE(frame.size() == 2 + (used_channels * 3));
+            CHECK(frame[0]
+                  == std::to_underlying(telemetry::Frame_type::Samples));
+            CHECK(frame[1] == static_cast<uint8_t>(i));
+            const auto first = telemetry::get(frame.data() + 2, 3);
+            for (auto channel = 0; channel < used_channels; ++channel) {
+              CHECK(telemetry::get(frame.data() + 2 + (channel * 3), 3)
+                    == first + (channel << 20));
+            }
+            if (i > 1) {
+              CHECK(first
+                    == (telemetry::get(received[i - 1].data() + 2, 3) + 1)
+                           % 0x1'0000);
+            }
+          }
+          CHECK(reply("stream?") == "0 0\r\n");
+        }
+      }
+
+      WHEN("one channel is streamed at 115200 Bd") {
+        select_baud_rate(115'200);
+        sim.clear_output();
+        REQUIRE(reply("stream 2").starts_with("OK\r\n"));
+        sim.run_until(firmware_main, [] { return false; }, 0.1);
+
+        THEN("other commands are ignored") {
+          sim.receive("avg?\r\n");
+          sim.run_until(firmware_main, [] { return false; }, 0.01);
+          CHECK(sim.uart_text().find("256") == std::string::npos);
+        }
+
+        THEN("SCPI queries are not answered either") {
+          sim.receive("*IDN?\r\n");
+          sim.run_until(firmware_main, [] { return false; }, 0.01);
+          sim.receive("MEAS:VOLT?\r\n");
+          sim.run_until(firmware_main, [] { return false; }, 0.01);
+          const auto text = sim.uart_text();
+          CHECK(text.find("mspmeter") == std::string::npos);
+          // no reply came between the frames
+          CHECK(frames().size()
+                == static_cast<std::size_t>(
+                    std::count(text.begin(), text.end(), '\0')));
+        }
+
+        REQUIRE(stop_stream());
+
+        THEN("the frames, which do not fit, are counted") {
+          const auto received = frames();
+          REQUIRE(received.size() >= 2);
+          CHECK(received.back().size() == 2 + 3);
+          CHECK(received.back()[0]
+                == std::to_underlying(telemetry::Frame_type::Samples));
+          const auto overruns = std::stoi(reply("stream?").substr(2));
+          CHECK(overruns > 200);
+          // the gaps in the sequence numbers, but for the frames dropped
+          // right before the stream was stopped, and for the queued frame,
+          // which may have made room for the reply to `stream off`
+          auto missing = 0;
+          for (auto i = std::size_t{1}; i < received.size(); ++i) {
+            missing += static_cast<uint8_t>(received[i][1]
+                                            - received[i - 1][1] - 1U);
+          }
+          CHECK(missing <= overruns + 1);
+          CHECK(missing + 4 >= overruns);
+        }
+      }
+
+      THEN("invalid masks are rejected") {
+        CHECK(reply("stream 0") == "ERR\r\n");
+        CHECK(reply("stream 16") == "ERR\r\n");
+        CHECK(reply("baud 14400") == "ERR\r\n");
+      }
+    }
+  }
+
+  SCENARIO("polling over Modbus RTU") {
+    sim.restart();
+
+    const auto inputs = std::array<int32_t, used_channels>{
+        {0x40'0000, -0x12'3456, 0x00'1000, 0x7f'0000}};
+    /// \return The `index`-th register of a read response.
+    const auto word = [](const std::vector<uint8_t> &response,
+                         const int index) {
+      const auto offset = static_cast<std::size_t>(3 + (2 * index));
+      return static_cast<uint16_t>((response[offset] << 8U)
+                                   | response[offset + 1]);
+    };
+    const auto int32_of = [&word](const std::vector<uint8_t> &response,
+                                  const int index) {
+      return static_cast<int32_t>(
+          (static_cast<uint32_t>(word(response, index)) << 16U)
+          | word(response, index + 1));
+    };
+
+    GIVEN("a meter, which is a Modbus slave") {
+      sim.set_waveform([inputs](const int channel, uint64_t) {
+        return inputs[static_cast<std::size_t>(channel)];
+      });
+      select_baud_rate(115'200);
+      REQUIRE(reply("modbus 0") == "ERR\r\n");
+      REQUIRE(reply("modbus 17") == "OK\r\n");
+      sim.clear_output();
+      sim.run_until(firmware_main, [] { return false; }, 0.2);
+
+      THEN("it does not send readings on its own") {
+        CHECK(sim.uart_output().empty());
+      }
+
+      WHEN("the readings of all channels are read") {
+        const auto [response, latency_s] =
+            modbus_request({17U, 0x04U, 0x00U, 0x00U, 0x00U, 0x08U});
+
+        THEN("they are returned within a few character times") {
+          REQUIRE(response.size() == 5 + (2 * 8));
+          CHECK(response[0] == 17U);
+          CHECK(response[1] == 0x04U);
+          CHECK(response[2] == 16U);
+          for (auto i = 0; i < used_channels; ++i) {
+            CHECK(int32_of(response, 2 * i)
+                  == expected_uV(i, inputs[static_cast<std::size_t>(i)]));
+          }
+          // the silence, which ends the request, and the response itself
+          CHECK(latency_s
+                < 1.75e-3
+                      + ((static_cast<double>(response.size()) + 1.0)
+                         * sim.uart_character_s()));
+        }
+      }
+
+      WHEN("the master pauses for 1 ms within a request") {
+        const auto response =
+            modbus_request({17U, 0x04U, 0x00U, 0x00U, 0x00U, 0x02U}, 1e-3)
+                .first;
+
+        THEN("the request is not split into two frames") {
+          REQUIRE(response.size() == 5 + (2 * 2));
+          CHECK(response[0] == 17U);
+          CHECK(response[1] == 0x04U);
+          CHECK(int32_of(response, 0) == expected_uV(0, inputs[0]));
+        }
+      }
+
+      WHEN("requests are sent back to back") {
+        auto polls = 0;
+        const auto started = sim.seconds();
+        while (sim.seconds() - started < 0.1) {
+          const auto response =
+              modbus_request({17U, 0x04U, 0x00U, 0x00U, 0x00U, 0x02U})
+                  .first;
+          REQUIRE(response.size() == 5 + (2 * 2));
+          ++polls;
+        }
+
+        THEN("each one is answered") {
+          INFO(polls << " polls in 100 ms");
+          // 8 bytes of request, the silence, which ends it, and 9 bytes of
+          // response plus one character time to spare
+          CHECK(polls >= static_cast<int>(
+                    0.1 / (1.75e-3 + (18.0 * sim.uart_character_s()))));
+        }
+      }
+
+      WHEN("the averaging length is written") {
+        const auto [response, latency_s] = modbus_request(
+            {17U, 0x10U, 0x00U, 0x00U, 0x00U, 0x02U, 0x04U, 0x00U, 0x00U,
+             0x00U, 0x40U});
+        REQUIRE(response.size() == 8);
+        CHECK(response[1] == 0x10U);
+
+        THEN("it takes effect") {
+          const auto read =
+              modbus_request({17U, 0x03U, 0x00U, 0x00U, 0x00U, 0x02U}).first;
+          REQUIRE(read.size() == 5 + (2 * 2));
+          CHECK(int32_of(read, 0) == 64);
+        }
+
+        REQUIRE(modbus_request({17U, 0x06U, 0x00U, 0x01U, 0x01U, 0x00U})
+                    .first.size()
+                == 8);
+      }
+
+      WHEN("a register does not exist or a value is out of range") {
+        THEN("an exception is returned") {
+          auto response =
+              modbus_request({17U, 0x04U, 0x00U, 0x26U, 0x00U, 0x04U}).first;
+          REQUIRE(response.size() == 5);
+          CHECK(response[1] == 0x84U);
+          CHECK(response[2] == 0x02U);
+          response =
+              modbus_request({17U, 0x06U, 0x00U, 0x02U, 0x00U, 0x07U}).first;
+          REQUIRE(response.size() == 5);
+          CHECK(response[1] == 0x86U);
+          CHECK(response[2] == 0x03U);
+        }
+      }
+
+      WHEN("a request is addressed to another slave or to all of them") {
+        const auto other =
+            modbus_request({18U, 0x04U, 0x00U, 0x00U, 0x00U, 0x02U});
+        const auto broadcast =
+            modbus_request({0U, 0x06U, 0x00U, 0x0bU, 0x00U, 0x05U});
+
+        THEN("it is not answered") {
+          CHECK(other.first.empty());
+          CHECK(broadcast.first.empty());
+        }
+
+        THEN("a broadcast is executed") {
+          const auto response =
+              modbus_request({5U, 0x03U, 0x00U, 0x0bU, 0x00U, 0x01U}).first;
+          REQUIRE(response.size() == 5 + 2);
+          CHECK(word(response, 0) == 5U);
+        }
+      }
+    }
+  }
+
+  SCENARIO("latching readings on a multi-drop bus") {
+    sim.restart();
+
+    const auto set_level = [](const int32_t level) {
+      sim.set_waveform([level](int, uint64_t) { return level; });
+    };
+    const auto snapshot_of = [](const std::vector<uint8_t> &response) {
+      REQUIRE(response.size() == 3 + modbus::snapshot_length + 2);
+      CHECK(response[1] == 0x41U);
+      CHECK(response[2] == modbus::snapshot_length);
+      return modbus::decode(response.data() + 3);
+    };
+    const auto poll = [] {
+      return modbus_request({17U, 0x41U}).first;
+    };
+
+    GIVEN("a slave, whose input changes right before a latch") {
+      set_level(0x10'0000);
+      REQUIRE(reply("modbus 17") == "OK\r\n");
+      sim.run_until(firmware_main, [] { return false; }, 0.2);
+      set_level(0x30'0000);
+      REQUIRE(modbus_request({0U, 0x42U, 0x00U, 0x05U}).first.empty());
+
+      THEN("it is busy, until the reading is complete") {
+        // the response timeout of `modbus_request()` is shorter than the
+        // 64 ms of a reading
+        const auto response = poll();
+        REQUIRE(response.size() == 5);
+        CHECK(response[1] == 0xc1U);
+        CHECK(response[2] == 0x06U);
+      }
+
+      WHEN("the reading is complete") {
+        sim.run_until(firmware_main, [] { return false; }, 0.1);
+        const auto snapshot = snapshot_of(poll());
+
+        THEN("it holds the samples taken after the latch") {
+          CHECK(snapshot.latch == 5U);
+          // but for those still in the frame buffer and in the converter
+          for (auto i = 0; i < used_channels; ++i) {
+            const auto step =
+                expected_uV(i, 0x30'0000) - expected_uV(i, 0x10'0000);
+            CHECK(expected_uV(i, 0x30'0000) - snapshot.readings[i]
+                  <= step * 4 / 256);
+          }
+        }
+
+        THEN("it is kept until the next latch") {
+          set_level(0x20'0000);
+          sim.run_until(firmware_main, [] { return false; }, 0.2);
+          const auto again = snapshot_of(poll());
+          CHECK(again.latch == 5U);
+          CHECK(again.timestamp_ms == snapshot.timestamp_ms);
+          CHECK(again.readings == snapshot.readings);
+        }
+      }
+
+      WHEN("the address is stored") {
+        const auto writes = sim.flash_writes();
+        const auto response =
+            modbus_request({17U, 0x06U, 0x00U, 0x0dU, 0x00U, 0x01U}).first;
+        REQUIRE(response.size() == 8);
+        sim.run_until(firmware_main, [] { return false; }, 0.1);
+
+        THEN("it is written to flash with the calibration") {
+          CHECK(sim.flash_writes() == writes + 1);
+        }
+      }
+
+      WHEN("the slave is switched back to the text commands") {
+        REQUIRE(modbus_request({0U, 0x06U, 0x00U, 0x0cU, 0x00U, 0x00U})
+                    .first.empty());
+        // no readings, which could be taken for the replies to the queries
+        REQUIRE(reply("rate 0") == "OK\r\n");
+
+        THEN("the address is kept, until it is cleared") {
+          CHECK(reply("modbus?") == "17\r\n");
+          REQUIRE(reply("modbus off") == "OK\r\n");
+          CHECK(reply("modbus?") == "0\r\n");
+        }
+      }
+    }
+  }
+
+  SCENARIO("instrument automation over SCPI") {
+    sim.restart();
+
+    const auto inputs = std::array<int32_t, used_channels>{
+        {0x40'0000, -0x12'3456, 0x00'1000, 0x7f'0000}};
+    // commands are not answered
+    const auto send = [](const std::string_view line) {
+      sim.clear_output();
+      sim.receive(line);
+      sim.receive("\r\n");
+      sim.run_until(firmware_main, [] { return false; }, 0.01);
+      return sim.uart_output().empty();
+    };
+    const auto uV_of = [](const std::string &reply) {
+      return std::llround(std::stod(reply) * 1e6);
+    };
+
+    GIVEN("a meter, which only answers queries") {
+      sim.set_waveform([inputs](const int channel, uint64_t) {
+        return inputs[static_cast<std::size_t>(channel)];
+      });
+      REQUIRE(send("CONF:RATE 0"));
+      sim.run_until(firmware_main, [] { return false; }, 0.2);
+
+      WHEN("the readings are queried") {
+        const auto [voltage, latency_s] = command("MEAS:VOLT?");
+
+        THEN("the last reading is returned right away in V or A") {
+          CHECK(uV_of(voltage) == expected_uV(0, inputs[0]));
+          CHECK(uV_of(command("measure:current?").first)
+                == expected_uV(1, inputs[1]));
+          CHECK(uV_of(command(":MEAS:CHAN? 3").first)
+                == expected_uV(2, inputs[2]));
+          // the query and the reply, much less than the 64 ms of a reading
+          CHECK(latency_s < static_cast<double>(12 + voltage.size() + 2)
+                                * sim.uart_character_s());
+        }
+
+        THEN("all channels can be read at once") {
+          const auto all = command("MEAS:CHAN?").first;
+          REQUIRE(all.ends_with("\r\n"));
+          auto begin = std::size_t{0};
+          for (auto i = 0; i < used_channels; ++i) {
+            const auto end = all.find_first_of(",\r", begin);
+            CHECK(uV_of(all.substr(begin, end - begin))
+                  == expected_uV(i, inputs[static_cast<std::size_t>(i)]));
+            begin = end + 1;
+          }
+        }
+      }
+
+      WHEN("the averaging length is configured") {
+        REQUIRE(send("CONF:AVER 64"));
+
+        THEN("it takes effect") {
+          CHECK(command("CONFigure:AVERage?").first == "64\r\n");
+          CHECK(reply("avg?") == "64\r\n");
+        }
+
+        REQUIRE(send("CONF:AVER 256"));
+      }
+
+      WHEN("the meter identifies itself") {
+        THEN("the model and the firmware are reported") {
+          CHECK(command("*IDN?").first == "mspmeter,MSP430i2041,0,0.1.0\r\n");
+        }
+      }
+
+      WHEN("commands are invalid") {
+        REQUIRE(send("MEAS:FREQ?"));
+        REQUIRE(send("CONF:AVER 0"));
+
+        THEN("the first error is kept until it is read") {
+          CHECK(command("SYST:ERR?").first == "-113,\"Undefined header\"\r\n");
+          CHECK(command("SYST:ERR?").first == "0,\"No error\"\r\n");
+          REQUIRE(send("CONF:AVER"));
+          REQUIRE(send("*CLS"));
+          CHECK(command("SYST:ERR?").first == "0,\"No error\"\r\n");
+        }
+      }
+    }
+  }
+
+  SCENARIO("line-synchronous integration rejects mains hum") {
+    sim.restart();
+
+    constexpr auto dc = 0x10'0000;
+    constexpr auto amplitude = 0x04'0000;
+    const auto set_hum = [](const double frequency_Hz) {
+      sim.set_waveform([frequency_Hz](const int channel, uint64_t sample) {
+        if (channel != 0) {
+          return 0;
+        }
+        const auto t = static_cast<double>(sample) / sampling_frequency_Hz;
+        return dc
+               + static_cast<int32_t>(std::lround(
+                   amplitude
+                   * std::sin((2.0 * std::numbers::pi * frequency_Hz * t)
+                              + 0.3)));
+      });
+    };
+    // the amplitude of the hum over the largest deviation of the readings
+    // of channel 1 from the DC value within a second
+    const auto rejection_dB = [] {
+      sim.run_until(firmware_main, [] { return false; }, 0.2);
+      sim.clear_output();
+      sim.run_until(firmware_main, [] { return false; }, 1.0);
+      const auto readings = readings_of(0);
+      const auto expected = expected_uV(0, dc);
+      auto worst = 1;
+      for (const auto value : readings) {
+        worst = std::max(worst, std::abs(value - expected));
+      }
+      REQUIRE(readings.size() >= 10);
+      return 20.0
+             * std::log10(static_cast<double>(expected_uV(0, dc + amplitude)
+                                              - expected)
+                          / worst);
+    };
+
+    GIVEN("50 Hz hum on a DC voltage") {
+      set_hum(50.0);
+
+      THEN("a window of 256 samples lets the hum through") {
+        CHECK(rejection_dB() < 30.0);
+      }
+
+      WHEN("integrating over whole periods of 50 Hz") {
+        REQUIRE(reply("sync 50") == "OK\r\n");
+
+        THEN("the hum is rejected") { CHECK(rejection_dB() > 80.0); }
+      }
+
+      WHEN("the detection follows it from 60 Hz") {
+        REQUIRE(reply("sync 60") == "OK\r\n");
+        REQUIRE(reply("sync auto") == "OK\r\n");
+        sim.clear_output();
+        sim.run_until(firmware_main, [] { return false; }, 1.0);
+
+        THEN("the reading, in whose window it changes, is not scaled") {
+          // the 60 Hz window lets a little of the hum through, but dividing
+          // the sum of 4 periods of 60 Hz by the length of 3 periods of
+          // 50 Hz is off by an eighth of the DC value
+          const auto expected = expected_uV(0, dc);
+          const auto tolerance = expected_uV(0, dc + (amplitude / 8))
+                                 - expected;
+          const auto readings = readings_of(0);
+          REQUIRE(readings.size() >= 10);
+          for (const auto value : readings) {
+            CHECK(std::abs(value - expected) < tolerance);
+          }
+          CHECK(reply("sync?") == "auto 50\r\n");
+        }
+      }
+    }
+
+    GIVEN("60 Hz hum on a DC voltage") {
+      set_hum(60.0);
+
+      THEN("a window of 256 samples lets the hum through") {
+        CHECK(rejection_dB() < 30.0);
+      }
+
+      WHEN("integrating over whole periods of 60 Hz") {
+        REQUIRE(reply("sync 60") == "OK\r\n");
+
+        THEN("the fraction of a sample per window is corrected for") {
+          CHECK(rejection_dB() > 80.0);
+        }
+      }
+
+      WHEN("the mains frequency is detected") {
+        REQUIRE(reply("sync auto") == "OK\r\n");
+
+        THEN("the window follows the hum") {
+          CHECK(rejection_dB() > 80.0);
+          REQUIRE(reply("rate 0") == "OK\r\n");
+          CHECK(reply("sync?") == "auto 60\r\n");
+        }
+      }
+    }
+  }
+
+  // how fast the simulation runs, not what a reading costs on the MSP430,
+  // as the simulator does not account for instruction cycles
+  TEST_CASE("host time to simulate a reading") {
+    sim.restart();
+
+    sim.set_waveform([](const int channel, const uint64_t sample) {
+      return static_cast<int32_t>(((sample * 7919U) % 0x1000U) << channel);
+    });
+
+    BENCHMARK("one reading (host time, not MSP430 cycles)") {
+      sim.clear_output();
+      return run_for_lines(1, 1.0);
+    };
+  }
+
+} // namespace meter
@@ -6,15 +6,15 @@
 
 namespace {
 
-  auto upper_text_buffer_ = Array<char, 6>{"00.00"};
-  auto lower_text_buffer_ = Array<char, 6>{"0.000"};
+  /// all segments lit until the first reading
+  [[MSP430_STATIC]] auto segments_ = Array<u8, 8>{};
 
-  auto meter_ = meter::Meter{upper_text_buffer_, lower_text_buffer_};
-  auto readout_ = meter::Readout{};
+  [[MSP430_STATIC]] auto meter_ = meter::Meter{segments_};
+  [[MSP430_STATIC]] auto readout_ = meter::Readout{};
 
-  [[gnu::interrupt]] void default_isr() {}
+  [[MSP430_INTERRUPT]] void default_isr() {}
 
-  [[gnu::interrupt]] void eusci_a0_rxtx_isr() {
+  [[MSP430_INTERRUPT]] void eusci_a0_rxtx_isr() {
     switch (msp430i2::UCA0::interrupt_vector()) {
     default:
       break;
@@ -31,7 +31,7 @@ namespace {
     }
   }
 
-  [[gnu::interrupt]] void eusci_b0_rxtx_isr() {
+  [[MSP430_INTERRUPT]] void eusci_b0_rxtx_isr() {
     switch (msp430i2::UCB0::interrupt_vector()) {
     default:
       break;
@@ -41,7 +41,7 @@ namespace {
     }
   }
 
-  [[gnu::interrupt]] void sd24_isr() {
+  [[MSP430_INTERRUPT]] void sd24_isr() {
     switch (msp430i2::SD24::interrupt_vector()) {
     default:
       break;
@@ -53,7 +53,13 @@ namespace {
     }
   }
 
-  [[gnu::interrupt]] void io_port_p2_isr() {
+  [[MSP430_INTERRUPT]] void ta0_isr() {
+    if (meter_.timer_a0_ccr0_isr()) {
+      msp430::stay_awake();
+    }
+  }
+
+  [[MSP430_INTERRUPT]] void io_port_p2_isr() {
     switch (load(msp430i2::P2IV)) {
     default:
       break;
@@ -82,11 +88,16 @@ namespace {
        nullptr,           nullptr,           nullptr,     nullptr,
        nullptr,           nullptr,           nullptr,     nullptr,
        default_isr,       io_port_p2_isr,    default_isr, default_isr,
-       default_isr,       default_isr,       default_isr, sd24_isr,
+       default_isr,       default_isr,       ta0_isr,     sd24_isr,
        eusci_b0_rxtx_isr, eusci_a0_rxtx_isr, default_isr, default_isr,
        default_isr,       default_isr,       default_isr, msp430i2::on_reset}};
 
-  [[gnu::section(".calibration_data")]] auto cal = meter::Calibration_constants{
+#ifndef __MSP430__
+  [[maybe_unused]] const auto vectors_installed =
+      host::install_vectors(vtable.data(), static_cast<int>(vtable.size()));
+#endif
+
+  [[MSP430_CALIBRATION_DATA]] auto cal = meter::Calibration_constants{
       meter::default_calibration};
 
 } // namespace
@@ -108,7 +119,7 @@ int main() {
       meter::ns1_pressed_pin | meter::encoder_a_pin | meter::encoder_b_pin);
 
   msp430::SPI<msp430i2::UCB0>::configure();
-  msp430::UART<msp430i2::UCA0>::configure();
+  msp430::UART<msp430i2::UCA0>::configure<meter::serial_baud_rate>();
 
   msp430i2::Digital_io::select_function(meter::rx_pin          // UCA0RXD
                                             | meter::tx_pin    // UCA0TXD
@@ -128,9 +139,7 @@ int main() {
 
     auto status = meter::Meter_status::OK;
 
-    for (auto op =
-             meter::Normal_operation{upper_text_buffer_, lower_text_buffer_,
-                                     meter_, readout_};
+    for (auto op = meter::Normal_operation{segments_, meter_, readout_};
          status == meter::Meter_status::OK; status = op()) {
       msp430i2::Digital_io::clear(meter::heartbeat_pin);
       msp430::go_to_sleep();
@@ -140,7 +149,6 @@ int main() {
     switch (status) {
     case meter::Meter_status::InformationMemoryIntegrity:
     case meter::Meter_status::ConversionOverflow:
-    case meter::Meter_status::SerialBusy:
     case meter::Meter_status::StringConversionFailure:
       meter::error(status);
       break;
@@ -2,6 +2,8 @@
 
 #include "meter.hpp"
 #include "msp/uart.hpp"
+#include "telemetry.hpp"
+#include "util/tokenizer.hpp"
 
 namespace meter {
 
@@ -10,24 +12,109 @@ namespace meter {
 
   namespace {
 
-    /// \returns the scaled voltage reading in uV
-    constexpr int32_t apply(const int32_t conversion_result,
-                            const Channel_calibration &cal) {
-      return static_cast<int32_t>(
-          (int64_t{conversion_result - cal.offset} * cal.full_scale_voltage)
-          / cal.full_scale_reading);
+    [[MSP430_STATIC]] auto converter = AD_converter{};
+    [[MSP430_STATIC]] auto serial =
+        msp430::UART<msp430i2::UCA0, serial_queue_length>{};
+
+    [[MSP430_STATIC]] auto tx_buffer = Array<char, 80>{};
+    static_assert(tx_buffer.size() >= telemetry::max_frame_length + 4);
+    static_assert(tx_buffer.size() >= telemetry::max_batch_frame_length);
+    static_assert(tx_buffer.size() >= modbus::max_response_length);
+
+    /// the Modbus request being received or waiting for its response
+    [[MSP430_STATIC]] auto modbus_receiver = modbus::Receiver{};
+
+    /// the readings, which have not been sent in the batched format yet
+    [[MSP430_STATIC]] auto batch = telemetry::Batch{};
+
+    constexpr auto make_baud_rate_settings() {
+      auto settings =
+          Array<msp430::Baud_rate_settings, serial_baud_rates.size()>{};
+      for (auto i = 0; i < serial_baud_rates.size(); ++i) {
+        settings[i] = msp430::compute_baud_rate_settings(
+            msp430i2::dco_frequency_Hz, serial_baud_rates[i]);
+      }
+      return settings;
+    }
+
+    constexpr auto baud_rate_settings = make_baud_rate_settings();
+
+    constexpr bool accurate() {
+      for (auto i = 0; i < serial_baud_rates.size(); ++i) {
+        if ((serial_baud_rates[i] < msp430::min_baud_rate)
+            || (serial_baud_rates[i] > msp430::max_baud_rate)
+            || (msp430::baud_rate_error_permille(msp430i2::dco_frequency_Hz,
+                                                 serial_baud_rates[i],
+                                                 baud_rate_settings[i])
+                > msp430::max_baud_rate_error_permille)) {
+          return false;
+        }
+      }
+      return true;
     }
-    static_assert(apply(0x7f'ffff, {30'000'000, 30'000'000, 0x7f'ffff, 0})
-                  == 30'000'000);
-    static_assert(apply(0x6e'0000, {30'000'000, 30'000'000, 0x6e'0000, 0})
-                  == 30'000'000);
-    static_assert(apply(0x70'0000, {30'000'000, 30'000'000, 0x6e'0000, 0})
-                  > 30'000'000);
+    static_assert(accurate());
 
-    auto converter = AD_converter{};
-    auto serial = msp430::UART<msp430i2::UCA0>{};
+    constexpr auto make_frame_gaps() {
+      auto gaps = Array<uint16_t, serial_baud_rates.size()>{};
+      for (auto i = 0; i < serial_baud_rates.size(); ++i) {
+        gaps[i] = modbus::frame_gap_cycles(msp430i2::dco_frequency_Hz,
+                                           serial_baud_rates[i]);
+      }
+      return gaps;
+    }
+
+    /// the silence, which ends a Modbus frame, in SMCLK cycles
+    constexpr auto frame_gaps = make_frame_gaps();
+
+    /// The description of a SCPI error `code`, see `interpret_scpi()`.
+    constexpr const char *scpi_message(const int16_t code) {
+      switch (code) {
+      case 0:
+        return "No error";
+      case -104:
+        return "Data type error";
+      case -108:
+        return "Parameter not allowed";
+      case -109:
+        return "Missing parameter";
+      case -113:
+        return "Undefined header";
+      case -222:
+        return "Data out of range";
+      case -223:
+        return "Too much data";
+      default:
+        return "Error";
+      }
+    }
+
+    /// \return The calibrated `extremes`, or zeros, if there were no samples.
+    Extremes scaled(const Extremes &extremes, const Channel_scale &scale) {
+      if (extremes.empty()) {
+        return {0, 0};
+      }
+      const auto first = apply(extremes.minimum, scale);
+      const auto second = apply(extremes.maximum, scale);
+      return {std::min(first, second), std::max(first, second)};
+    }
 
-    auto tx_buffer = Array<char, 80>{};
+    /// Shows a `value` in millionths of its unit with as many fractional
+    /// digits as fit.
+    void render_micro(Slice<u8, 4> row, const int64_t value) {
+      // a negative value needs a digit for its sign
+      const auto magnitude = (value < 0) ? -value * 10 : value;
+      if (magnitude < 10'000'000) {
+        render_readout<1, 3>(row, static_cast<int>(value / 1'000));
+      } else if (magnitude < 100'000'000) {
+        render_readout<2, 2>(row, static_cast<int>(value / 10'000));
+      } else if (magnitude < 1'000'000'000) {
+        render_readout<3, 1>(row, static_cast<int>(value / 100'000));
+      } else {
+        // shows OL beyond four digits
+        render_readout<4, 0>(row, static_cast<int>(std::clamp<int64_t>(
+                                      value / 1'000'000, -10'000, 10'000)));
+      }
+    }
 
   } // namespace
 
@@ -47,65 +134,347 @@ namespace meter {
     }
   }
 
+  void Meter::start_acquisition() {
+    converter.reset();
+    AD_converter::start_conversion();
+  }
+
+  uint16_t Meter::dropped_frames() const { return converter.dropped_frames(); }
+
+  uint16_t Meter::sample_count() const { return converter.collected_frames(); }
+
+  Serial_statistics Meter::serial_statistics() const {
+    return {.queued_bytes = serial.queued_bytes(),
+            .high_water_mark = serial.high_water_mark(),
+            .dropped_records = serial.dropped_records()};
+  }
+
+  void Meter::set_overflow_policy(const msp430::Overflow_policy policy) {
+    serial.set_overflow_policy(policy);
+  }
+
+  void Meter::set_output_format(const Output_format format) {
+    output_format_ = format;
+    calibration_pending_ = true;
+    batch.clear();
+  }
+
+  bool Meter::set_batch_length(const Size length) {
+    if ((length < 1) || (length > telemetry::max_batch_length)) {
+      return false;
+    }
+    batch_length_ = length;
+    return true;
+  }
+
+  bool Meter::set_channel_mask(const uint8_t mask) {
+    if (mask >= (1U << used_channels)) {
+      return false;
+    }
+    channel_mask_ = mask;
+    calibration_pending_ = true;
+    filter_.restart();
+    return true;
+  }
+
+  bool Meter::start_modbus(const uint8_t address) {
+    if ((address == modbus::broadcast_address)
+        || (address > modbus::max_address)) {
+      return false;
+    }
+    calibration_.bus_address = address;
+    msp430::Timer_TA0::configure(msp430::TASSEL::SMCLK, 1U);
+    msp430::Timer_TA0::enable_interrupt();
+    modbus_receiver.release();
+    protocol_ = Protocol::Modbus;
+    return true;
+  }
+
+  modbus::Exception Meter::read_input_register(const uint16_t address,
+                                               uint16_t &value) const {
+    // the first register of the value, which `address` is part of
+    auto first = static_cast<uint16_t>(address & ~1U);
+    auto words = 2;
+    auto wide = int64_t{0};
+    if (address < 8U) {
+      wide = voltages_uV_[address / 2U];
+    } else if (address < 10U) {
+      wide = power_uW_;
+    } else if (address < 12U) {
+      wide = apparent_power_uVA_;
+    } else if (address < 14U) {
+      first = address;
+      words = 1;
+      wide = (address == 12U) ? int64_t{power_factor_permille_}
+                              : int64_t{sample_count()};
+    } else if ((address >= 16U) && (address < 32U)) {
+      const auto index = static_cast<int>((address - 16U) / 4U);
+      const auto extremes =
+          scaled(converter.get_extremes(index), scales_[index]);
+      wide = (((address - 16U) % 4U) < 2U) ? extremes.minimum
+                                             : extremes.maximum;
+    } else if ((address >= 32U) && (address < 40U)) {
+      first = static_cast<uint16_t>(address & ~3U);
+      words = 4;
+      wide = (address < 36U) ? energy_.energy_uWh() : energy_.charge_uAh();
+    } else {
+      return modbus::Exception::IllegalDataAddress;
+    }
+    value = modbus::word_of(wide, address - first, words);
+    return modbus::Exception::None;
+  }
+
+  modbus::Exception Meter::read_holding_register(const uint16_t address,
+                                                 uint16_t &value) const {
+    if (address < 2U) {
+      value = modbus::word_of(converter.averaging_length(), address, 2);
+    } else if (address < 6U) {
+      value = std::to_underlying(
+          converter.mode(static_cast<int>(address) - 2));
+    } else if (address < 10U) {
+      const auto index = static_cast<int>(address - 6U);
+      value = converter.auto_range(index)
+                  ? 0U
+                  : static_cast<uint16_t>(1U << converter.range(index));
+    } else if (address == 10U) {
+      value = std::to_underlying(converter.line_sync());
+    } else if (address == 11U) {
+      value = calibration_.bus_address;
+    } else if (address == 12U) {
+      value = (protocol_ == Protocol::Modbus) ? 1U : 0U;
+    } else if (address == 13U) {
+      value = 0U;
+    } else {
+      return modbus::Exception::IllegalDataAddress;
+    }
+    return modbus::Exception::None;
+  }
+
+  modbus::Exception Meter::write_holding_register(const uint16_t address,
+                                                  const uint16_t value) {
+    auto valid = true;
+    if (address == 0U) {
+      averaging_high_word_ = value;
+    } else if (address == 1U) {
+      valid = converter.set_averaging_length(static_cast<int32_t>(
+          (uint32_t{averaging_high_word_} << 16U) | value));
+    } else if (address < 6U) {
+      valid = value <= std::to_underlying(Channel_mode::AC);
+      if (valid) {
+        converter.set_mode(static_cast<int>(address) - 2,
+                           Channel_mode{static_cast<uint8_t>(value)});
+      }
+    } else if (address < 10U) {
+      const auto index = static_cast<int>(address - 6U);
+      if (value == 0U) {
+        converter.set_auto_range(index);
+      } else {
+        valid = converter.set_range(index, averaging_shift(value));
+      }
+    } else if (address == 10U) {
+      valid = value <= std::to_underlying(Line_sync::Auto);
+      if (valid) {
+        converter.set_line_sync(Line_sync{static_cast<uint8_t>(value)});
+      }
+    } else if (address == 11U) {
+      valid = (value != modbus::broadcast_address)
+              && (value <= modbus::max_address);
+      if (valid) {
+        calibration_.bus_address = static_cast<uint8_t>(value);
+      }
+    } else if (address == 12U) {
+      valid = value <= 1U;
+      if (value == 0U) {
+        // the response is still sent, the next command is a text line
+        msp430::Timer_TA0::stop();
+        protocol_ = Protocol::Text;
+      }
+    } else if (address == 13U) {
+      valid = value == 1U;
+      if (valid) {
+        // stored with the next reading
+        command_ = Command::Flash;
+      }
+    } else {
+      return modbus::Exception::IllegalDataAddress;
+    }
+    return valid ? modbus::Exception::None
+                 : modbus::Exception::IllegalDataValue;
+  }
+
+  modbus::Exception Meter::read_snapshot(modbus::Snapshot &snapshot) const {
+    if (latch_pending_) {
+      return modbus::Exception::ServerDeviceBusy;
+    }
+    snapshot = snapshot_;
+    return modbus::Exception::None;
+  }
+
+  modbus::Exception Meter::latch(const uint16_t number) {
+    converter.restart_window();
+    snapshot_.latch = number;
+    latch_pending_ = true;
+    latched_ = true;
+    return modbus::Exception::None;
+  }
+
+  int32_t Meter::averaging_length() const {
+    return converter.averaging_length();
+  }
+
+  bool Meter::set_averaging_length(const int32_t length) {
+    return converter.set_averaging_length(length);
+  }
+
+  void Meter::compile_calibration() {
+    for (auto i = 0; i < used_channels; ++i) {
+      compile_scale(i);
+    }
+    converter.set_power_channels(calibration_.voltage_channel_index,
+                                 calibration_.current_channel_index);
+    calibration_pending_ = true;
+  }
+
+  /// Compiles the calibration of `channel` for the range of its last
+  /// reading.
+  void Meter::compile_scale(const int channel) {
+    const auto range = converter.range(channel);
+    scales_[channel] =
+        compile(at_gain(calibration_.channel[channel], 1 << range,
+                        calibration_.range_trims[channel][range]));
+    scale_ranges_[channel] = static_cast<uint8_t>(range);
+    calibration_pending_ = true;
+  }
+
+  /// The calibration is kept for a gain of 1, so the readings are converted
+  /// back from the range they were taken in.
+  void Meter::calibrate_offset(const int channel) {
+    const auto gain = int32_t{1} << converter.range(channel);
+    const auto result = converter.get_conversion_result(channel);
+    calibration_.channel[channel].offset =
+        (result + ((result < 0) ? -(gain / 2) : (gain / 2))) / gain;
+  }
+
+  void Meter::calibrate_gain(const int channel) {
+    auto &cal = calibration_.channel[channel];
+    const auto range = converter.range(channel);
+    const auto divisor =
+        (int64_t{65'536} + calibration_.range_trims[channel][range]) << range;
+    const auto reading =
+        int64_t{conversion_results_[channel] - scales_[channel].offset}
+        * 65'536;
+    cal.full_scale_reading =
+        static_cast<int32_t>(reading / divisor)
+        * (cal.full_scale_voltage / cal.calibration_voltage);
+  }
+
+  bool Meter::acquire() { return converter.collect(); }
+
   Meter_status Meter::step() {
     if (AD_converter::overflow()) {
       return Meter_status::ConversionOverflow;
     }
 
     for (auto i = 0; i < used_channels; ++i) {
-      conversion_results_[i] = converter.get_conversion_result(i);
+      if (converter.range(i) != scale_ranges_[i]) {
+        compile_scale(i);
+      }
+      conversion_results_[i] = converter.get_reading(i, scales_[i].offset);
     }
 
-    switch (std::exchange(command_, Command::None_)) {
+    const auto command = std::exchange(command_, Command::None_);
+    switch (command) {
     case Command::Back:
       menu_active_ = false;
+      count_ = 0;
       break;
     case Command::Ch1Offset:
-      calibration_.channel[0].offset = conversion_results_[0];
+      calibrate_offset(0);
       break;
     case Command::Ch1Gain:
-      calibration_.channel[0].full_scale_reading =
-          (conversion_results_[0] - calibration_.channel[0].offset)
-          * (calibration_.channel[0].full_scale_voltage
-             / calibration_.channel[0].calibration_voltage);
+      calibrate_gain(0);
       break;
     case Command::Ch2Offset:
-      calibration_.channel[1].offset = conversion_results_[1];
+      calibrate_offset(1);
       break;
     case Command::Ch2Gain:
-      calibration_.channel[1].full_scale_reading =
-          (conversion_results_[1] - calibration_.channel[1].offset)
-          * (calibration_.channel[1].full_scale_voltage
-             / calibration_.channel[1].calibration_voltage);
+      calibrate_gain(1);
       break;
     case Command::Ch3Offset:
-      calibration_.channel[2].offset = conversion_results_[2];
+      calibrate_offset(2);
       break;
     case Command::Ch3Gain:
-      calibration_.channel[2].full_scale_reading =
-          (conversion_results_[2] - calibration_.channel[2].offset)
-          * (calibration_.channel[2].full_scale_voltage
-             / calibration_.channel[2].calibration_voltage);
+      calibrate_gain(2);
       break;
     case Command::Ch4Offset:
-      calibration_.channel[3].offset = conversion_results_[3];
+      calibrate_offset(3);
       break;
     case Command::Ch4Gain:
-      calibration_.channel[3].full_scale_reading =
-          (conversion_results_[3] - calibration_.channel[3].offset)
-          * (calibration_.channel[3].full_scale_voltage
-             / calibration_.channel[3].calibration_voltage);
+      calibrate_gain(3);
+      break;
+    case Command::Averaging: {
+      // cycles through the power-of-two lengths
+      const auto length = converter.averaging_length();
+      converter.set_averaging_length(
+          (length < max_averaging_length) && (averaging_shift(length) >= 0)
+              ? (length << 1)
+              : 1);
+      break;
+    }
+    case Command::Format:
+      set_output_format(
+          (output_format_ == Output_format::Text)     ? Output_format::Binary
+          : (output_format_ == Output_format::Binary) ? Output_format::Batched
+                                                      : Output_format::Text);
+      break;
+    case Command::Hold:
+      converter.reset_hold();
       break;
     case Command::Flash:
       menu_active_ = false;
+      count_ = 0;
       return Meter_status::StoreCalibration;
     case Command::None_:
     case Command::Num_:
       break;
     }
 
+    if (command != Command::None_) {
+      compile_calibration();
+    }
+
     for (auto i = 0; i < used_channels; ++i) {
-      voltages_uV_[i] = apply(conversion_results_[i], calibration_.channel[i]);
+      voltages_uV_[i] = apply(conversion_results_[i], scales_[i]);
+    }
+
+    {
+      const auto &voltage = calibration_.voltage_channel_index;
+      const auto &current = calibration_.current_channel_index;
+      power_uW_ = meter::power_uW(
+          mean_product(converter.get_mean_product(),
+                       converter.get_conversion_result(voltage),
+                       scales_[voltage].offset,
+                       converter.get_conversion_result(current),
+                       scales_[current].offset),
+          scales_[voltage], scales_[current]);
+      apparent_power_uVA_ = meter::apparent_power_uVA(
+          converter.get_rms(voltage, scales_[voltage].offset),
+          converter.get_rms(current, scales_[current].offset),
+          scales_[voltage], scales_[current]);
+      power_factor_permille_ =
+          meter::power_factor_permille(power_uW_, apparent_power_uVA_);
+      energy_.add(power_uW_,
+                  apply(converter.get_conversion_result(current),
+                        scales_[current]),
+                  converter.window_length());
+      clock_.advance(converter.window_length());
+    }
+
+    if (latch_pending_ || !latched_) {
+      snapshot_.timestamp_ms = clock_.ms();
+      snapshot_.readings = voltages_uV_;
+      snapshot_.power_uW = power_uW_;
+      latch_pending_ = false;
     }
 
     if (menu_active_) {
@@ -114,91 +483,1021 @@ namespace meter {
       case Command::Num_:
         break;
       case Command::Back:
-        print(upper_text_buffer_, "rEt");
-        lower_text_buffer_.fill('\0');
+        to_7segment(upper_row(), "rEt");
+        to_7segment(lower_row(), "");
         break;
       case Command::Ch1Offset:
-        print(upper_text_buffer_, "1 0.0");
-        format_readout<1, 3>(Slice{lower_text_buffer_},
-                             static_cast<int>(voltages_uV_[0] / 1'000));
+        to_7segment(upper_row(), "1 0.0");
+        render_readout<1, 3>(
+            lower_row(), static_cast<int>(divide<1'000>(voltages_uV_[0])));
         break;
       case Command::Ch1Gain:
-        print(upper_text_buffer_, "1 ");
-        format_readout<1, 1>(
-            slice<2, 4>(upper_text_buffer_),
+        to_7segment(upper_row(), "1 ");
+        render_readout<1, 1>(
+            slice<2, 2>(segments_),
             static_cast<int>(calibration_.channel[0].calibration_voltage
                              / 100'000));
-        format_readout<1, 3>(Slice{lower_text_buffer_},
-                             static_cast<int>(voltages_uV_[0] / 1'000));
+        render_readout<1, 3>(
+            lower_row(), static_cast<int>(divide<1'000>(voltages_uV_[0])));
         break;
       case Command::Ch2Offset:
-        print(upper_text_buffer_, "2 0.0");
-        format_readout<1, 3>(Slice{lower_text_buffer_},
-                             static_cast<int>(voltages_uV_[1] / 1'000));
+        to_7segment(upper_row(), "2 0.0");
+        render_readout<1, 3>(
+            lower_row(), static_cast<int>(divide<1'000>(voltages_uV_[1])));
         break;
       case Command::Ch2Gain:
-        print(upper_text_buffer_, "2 ");
-        format_readout<1, 1>(
-            slice<2, 4>(upper_text_buffer_),
+        to_7segment(upper_row(), "2 ");
+        render_readout<1, 1>(
+            slice<2, 2>(segments_),
             static_cast<int>(calibration_.channel[1].calibration_voltage
                              / 100'000));
-        format_readout<1, 3>(Slice{lower_text_buffer_},
-                             static_cast<int>(voltages_uV_[1] / 1'000));
+        render_readout<1, 3>(
+            lower_row(), static_cast<int>(divide<1'000>(voltages_uV_[1])));
         break;
       case Command::Ch3Offset:
-        print(upper_text_buffer_, "3 0.0");
-        format_readout<1, 3>(Slice{lower_text_buffer_},
-                             static_cast<int>(voltages_uV_[2] / 1'000));
+        to_7segment(upper_row(), "3 0.0");
+        render_readout<1, 3>(
+            lower_row(), static_cast<int>(divide<1'000>(voltages_uV_[2])));
         break;
       case Command::Ch3Gain:
-        print(upper_text_buffer_, "3 ");
-        format_readout<1, 1>(
-            slice<2, 4>(upper_text_buffer_),
+        to_7segment(upper_row(), "3 ");
+        render_readout<1, 1>(
+            slice<2, 2>(segments_),
             static_cast<int>(calibration_.channel[2].calibration_voltage
                              / 100'000));
-        format_readout<1, 3>(Slice{lower_text_buffer_},
-                             static_cast<int>(voltages_uV_[2] / 1'000));
+        render_readout<1, 3>(
+            lower_row(), static_cast<int>(divide<1'000>(voltages_uV_[2])));
         break;
       case Command::Ch4Offset:
-        print(upper_text_buffer_, "4 0.0");
-        format_readout<1, 3>(Slice{lower_text_buffer_},
-                             static_cast<int>(voltages_uV_[3] / 1'000));
+        to_7segment(upper_row(), "4 0.0");
+        render_readout<1, 3>(
+            lower_row(), static_cast<int>(divide<1'000>(voltages_uV_[3])));
         break;
       case Command::Ch4Gain:
-        print(upper_text_buffer_, "4 ");
-        format_readout<1, 1>(
-            slice<2, 4>(upper_text_buffer_),
+        to_7segment(upper_row(), "4 ");
+        render_readout<1, 1>(
+            slice<2, 2>(segments_),
             static_cast<int>(calibration_.channel[3].calibration_voltage
                              / 100'000));
-        format_readout<1, 3>(Slice{lower_text_buffer_},
-                             static_cast<int>(voltages_uV_[3] / 1'000));
+        render_readout<1, 3>(
+            lower_row(), static_cast<int>(divide<1'000>(voltages_uV_[3])));
+        break;
+      case Command::Averaging:
+        to_7segment(upper_row(), "AUG");
+        if (const auto shift = averaging_shift(converter.averaging_length());
+            shift >= 0) {
+          render_readout<4, 0>(lower_row(), shift);
+        } else {
+          to_7segment(lower_row(), "----");
+        }
+        break;
+      case Command::Format:
+        to_7segment(upper_row(), "Out");
+        to_7segment(lower_row(),
+                    (output_format_ == Output_format::Text)     ? "ASC"
+                    : (output_format_ == Output_format::Binary) ? "bin"
+                                                                : "bAt");
+        break;
+      case Command::Hold: {
+        const auto held = scaled(
+            converter.get_held_extremes(calibration_.voltage_channel_index),
+            scales_[calibration_.voltage_channel_index]);
+        to_7segment(upper_row(), "HOLd");
+        render_micro(lower_row(), int64_t{held.maximum} - held.minimum);
         break;
+      }
       case Command::Flash:
-        print(upper_text_buffer_, "FLSH");
-        lower_text_buffer_.fill('\0');
+        to_7segment(upper_row(), "FLSH");
+        to_7segment(lower_row(), "");
         break;
       }
     } else {
-      format_voltage(upper_text_buffer_);
-      format_current();
+      switch (static_cast<Page>(count_ / 2)) {
+      case Page::Readings:
+      case Page::Num_:
+        render_voltage(upper_row());
+        render_current();
+        break;
+      case Page::Power:
+        render_power();
+        break;
+      case Page::Energy:
+        render_energy();
+        break;
+      }
+    }
+
+    return transmit();
+  }
+
+  Meter_status Meter::transmit() {
+    // the readings would end up in the middle of the capture or the stream,
+    // a Modbus slave must not send on its own
+    if ((output_divider_ == 0U) || dumping_ || (stream_mask_ != 0U)
+        || (protocol_ == Protocol::Modbus)) {
+      return Meter_status::OK;
+    }
+    output_count_ = static_cast<uint16_t>(output_count_ + 1U);
+    if (output_count_ < output_divider_) {
+      return Meter_status::OK;
+    }
+    output_count_ = 0U;
+
+    // batches always hold all enabled channels
+    auto channels = channel_mask_;
+    if ((report_ == Report::Changes)
+        && (output_format_ != Output_format::Batched)) {
+      channels = filter_.select(voltages_uV_, channel_mask_, clock_.ms());
+      if (channels == 0U) {
+        return Meter_status::OK;
+      }
+    }
+
+    if (output_format_ != Output_format::Text) {
+      // a reading, which does not fit anymore, starts the next batch
+      auto next_batch = false;
+      if (output_format_ == Output_format::Batched) {
+        next_batch = !batch.add(conversion_results_, channels);
+        if (!next_batch && (batch.readings() < batch_length_)) {
+          return Meter_status::OK;
+        }
+      }
+      // frames, which are dropped by the queue, still use up their sequence
+      // number, so the receiver notices the loss
+      auto *const frame = reinterpret_cast<uint8_t *>(tx_buffer.data());
+      if (calibration_pending_ || (sequence_number_ == 0U)) {
+        const auto length = telemetry::encode_calibration(
+            frame, sequence_number_, scales_, channel_mask_);
+        ++sequence_number_;
+        calibration_pending_ = !serial.transmit(tx_buffer.data(), length);
+      }
+      auto length = Size{0};
+      if (output_format_ == Output_format::Batched) {
+        length = batch.finish(frame, sequence_number_);
+      } else if (report_ == Report::Changes) {
+        length = telemetry::encode_change(frame, sequence_number_, clock_.ms(),
+                                          conversion_results_, channels);
+      } else {
+        length = telemetry::encode_reading(frame, sequence_number_,
+                                           conversion_results_, channels);
+      }
+      ++sequence_number_;
+      serial.transmit(tx_buffer.data(), length);
+      if (next_batch) {
+        batch.add(conversion_results_, channels);
+      }
+      return Meter_status::OK;
     }
 
     // FIXME send what is being displayed
-    if (const auto num_chars = print(tx_buffer, voltages_uV_[0], "\t",
-                                     voltages_uV_[1], "\t", voltages_uV_[2],
-                                     "\t", voltages_uV_[3], "\r\n");
-        num_chars > 0) {
-      if (!serial.transmit(tx_buffer.begin(), num_chars)) {
-        return Meter_status::SerialBusy;
+    auto num_chars = Size{0};
+    if (report_ == Report::Changes) {
+      num_chars = print(tx_buffer, int32_t{sequence_number_}, "\t",
+                        int64_t{clock_.ms()});
+      ++sequence_number_;
+    }
+    for (auto i = 0; (i < used_channels) && (num_chars >= 0); ++i) {
+      if ((channels & (1U << static_cast<unsigned>(i))) == 0U) {
+        continue;
       }
-    } else {
+      // the reported channels vary, so their numbers precede the values
+      const auto used =
+          (report_ == Report::Changes)
+              ? print(tx_buffer.data() + num_chars,
+                      tx_buffer.size() - num_chars, "\t", int32_t{i + 1},
+                      "=", voltages_uV_[i])
+              : print(tx_buffer.data() + num_chars,
+                      tx_buffer.size() - num_chars,
+                      (num_chars > 0) ? "\t" : "", voltages_uV_[i]);
+      if (used <= 0) {
+        return Meter_status::StringConversionFailure;
+      }
+      num_chars += used;
+    }
+    if (num_chars < 0) {
+      return Meter_status::StringConversionFailure;
+    }
+    if (const auto used = print(tx_buffer.data() + num_chars,
+                                tx_buffer.size() - num_chars, "\r\n");
+        used != 2) {
       return Meter_status::StringConversionFailure;
     }
+    serial.transmit(tx_buffer.begin(), num_chars + 2);
 
     return Meter_status::OK;
   }
 
-  void Meter::handle_command() { parser_.evaluate(); }
+  /// Queues the next part of a capture dump, as far as the transmit queue has
+  /// room, so that neither the dump nor other records are dropped.
+  void Meter::continue_dump() {
+    const auto &scope = converter.scope();
+    const auto remaining = scope.length() - dump_position_;
+    const auto room = serial_queue_length - serial.queued_bytes();
+    if (remaining == 0) {
+      if ((room >= 2) && serial.transmit("\r\n", 2)) {
+        dumping_ = false;
+      }
+      return;
+    }
+    const auto chunk = std::min({remaining, room, tx_buffer.size()});
+    // a few large records rather than many small ones
+    if (chunk < std::min(remaining, Size{32})) {
+      return;
+    }
+    for (auto i = 0; i < chunk; ++i) {
+      tx_buffer[i] = static_cast<char>(scope.byte(dump_position_ + i));
+    }
+    if (serial.transmit(tx_buffer.data(), chunk)) {
+      dump_position_ += chunk;
+    }
+  }
+
+  /// Sends the raw `frame` of the channels in `stream_mask_` as a samples
+  /// frame, see telemetry.hpp. To be called from the conversion interrupt
+  /// service routine, so that no sample is missed while the main loop is busy.
+  void Meter::stream(const AD_converter::Frame &frame) {
+    auto buffer = Array<char, telemetry::max_reading_frame_length>{};
+    const auto length = telemetry::encode_reading(
+        reinterpret_cast<uint8_t *>(buffer.data()), stream_sequence_, frame,
+        stream_mask_, telemetry::Frame_type::Samples);
+    // a dropped frame still uses up its sequence number
+    ++stream_sequence_;
+    if (!serial.transmit_from_isr(buffer.data(), length)) {
+      stream_overruns_ = static_cast<uint16_t>(stream_overruns_ + 1U);
+    }
+  }
+
+  /// Answers the Modbus request, which has been received, if any.
+  void Meter::answer_modbus() {
+    if (!modbus_receiver.frame_ready()) {
+      return;
+    }
+    const auto length = modbus::respond(
+        modbus_receiver.frame(), modbus_receiver.length(),
+        calibration_.bus_address,
+        *this, reinterpret_cast<uint8_t *>(tx_buffer.data()));
+    modbus_receiver.release();
+    if (length > 0) {
+      serial.transmit(tx_buffer.data(), length);
+    }
+  }
+
+  void Meter::handle_command() {
+    // the reply to `baud` is still sent with the previous baud rate
+    if ((next_baud_rate_index_ >= 0) && serial.idle()) {
+      serial.configure(baud_rate_settings[next_baud_rate_index_]);
+      baud_rate_index_ = next_baud_rate_index_;
+      next_baud_rate_index_ = -1;
+    }
+    // further commands wait until the capture has been sent
+    if (dumping_) {
+      continue_dump();
+      return;
+    }
+    if (protocol_ == Protocol::Modbus) {
+      answer_modbus();
+      return;
+    }
+    if (!parser_.line_ready()) {
+      return;
+    }
+    auto length = Size{-1};
+    if (!parser_.too_long()) {
+      length = interpret(parser_.line(), tx_buffer.data(), tx_buffer.size());
+    }
+    if (length < 0) {
+      length = print(tx_buffer, "ERR\r\n");
+    }
+    parser_.release();
+    // the transmit queue belongs to the interrupt service routine while
+    // streaming, `stream off` is answered after the last frame; SCPI
+    // commands are not answered at all
+    if ((stream_mask_ != 0U) || (length == 0)) {
+      return;
+    }
+    if (!serial.transmit(tx_buffer.data(), length)) {
+      // the capture must not be sent without its header
+      dumping_ = false;
+    }
+    if (stream_start_mask_ != 0U) {
+      stream_mask_ = stream_start_mask_;
+      stream_start_mask_ = 0U;
+    }
+  }
+
+  /// Commands are a keyword followed by arguments, separated by blanks.
+  /// Queries end in '?' and are answered by their values, all other commands
+  /// by "OK". Keywords with a colon or starting with '*' are SCPI commands,
+  /// see `interpret_scpi()`.
+  ///
+  ///   rate <n>, rate?  transmit every n-th reading, none for 0
+  ///   mask <m>, mask?  transmit the channels selected by the bit mask m
+  ///   avg <n>, avg?    average n samples per reading
+  ///   adapt <n>        average adaptively over up to n samples, 0 for off
+  ///   adapt?           the maximum and the current length of every channel
+  ///   fmt text|bin|batch, fmt?
+  ///   batch <n>, batch?
+  ///                    send n readings per frame in the batched format
+  ///   report all|change, report?
+  ///                    transmit every reading or only the channels, which
+  ///                    changed by more than their deadband, as
+  ///                    "<sequence>\t<ms>\t<ch>=<value>..." in text format
+  ///   deadband <ch> <value>, deadband? <ch>
+  ///                    the change of channel 1..4 in uV or uA to report
+  ///   heartbeat <ms>, heartbeat?
+  ///                    report all channels at least this often, 0 for never
+  ///   mode <ch> dc|rms|ac, mode? <ch>
+  ///                    read the mean, the true RMS value or the RMS value
+  ///                    without DC of channel 1..4
+  ///   gain <ch> auto|1|2|4|8|16, gain? <ch>
+  ///                    select the PGA gain of channel 1..4 or let it follow
+  ///                    the signal, reported with the gain in use
+  ///   trim <ch> <gain> <trim>, trim? <ch>
+  ///                    the deviation of the gain of a range from its nominal
+  ///                    value in 1/65536, all ranges are reported
+  ///   scope <ch> rise|fall|above|below <level> <pre> <post>
+  ///                    capture the raw samples of the channels selected by
+  ///                    the mask, pre frames before and post frames from the
+  ///                    first one of channel 1..4 that meets the trigger
+  ///                    condition with the calibrated level on; auto-ranging
+  ///                    pauses meanwhile
+  ///   scope stop, scope?
+  ///                    the state, idle, armed, triggered or done, and the
+  ///                    length of the capture in bytes
+  ///   scope dump       the capture as a block "#<digits><length><data>",
+  ///                    followed by CR LF, see `Scope`
+  ///   stream <m>       send every raw sample of the channels selected by the
+  ///                    bit mask m as a binary samples frame right from the
+  ///                    conversion interrupt, preceded by a calibration frame
+  ///                    with sequence number 0, see telemetry.hpp; until
+  ///                    `stream off`, no readings are sent and all other
+  ///                    commands are ignored
+  ///   stream off, stream?
+  ///                    the mask and the number of frames dropped, because
+  ///                    the baud rate is too low for the selected channels
+  ///   baud <rate>, baud?
+  ///                    switch to 9600, 115200, 230400, 460800 or 921600 Bd
+  ///                    after the reply, until the next reset
+  ///   modbus <address> answer Modbus RTU requests to address 1..247 from now
+  ///                    on instead of commands and stop sending readings,
+  ///                    see modbus.hpp and `read_input_register()`; `save`
+  ///                    keeps the meter a slave after a reset
+  ///   modbus off, modbus?
+  ///                    forget the address, so the meter starts with the text
+  ///                    commands after `save`, or report it, 0 for none
+  ///   sync off|50|60|auto, sync?
+  ///                    average over whole mains periods of the given or
+  ///                    detected frequency, which is reported as well
+  ///   cal <ch> offset  take the current reading as offset of channel 1..4
+  ///   cal <ch> gain    take the current reading as calibration voltage
+  ///   cal <ch> <calibration voltage> <full-scale voltage>
+  ///       <full-scale reading> <offset>, cal? <ch>
+  ///   peak? <ch>       minimum, maximum and peak-to-peak value of the last
+  ///                    reading and the same for the hold
+  ///   peak reset       restart the hold
+  ///   power?           the real power in uW, the apparent power in uVA and
+  ///                    the power factor in thousandths of the last reading
+  ///   energy?          the energy in uWh and the charge in uAh so far
+  ///   energy reset     restart counting energy and charge
+  ///   save             write the calibration constants to flash
+  ///   stat?            queued bytes, queue high-water mark, dropped records,
+  ///                    dropped conversions, discarded received characters
+  ///
+  /// \return The length of the reply, 0 for none, or -1, if the command is
+  ///    invalid.
+  Size Meter::interpret(const std::string_view line, char *const reply,
+                        const Size reply_length) {
+    auto tokens = Tokenizer{line};
+    const auto keyword = tokens.next();
+
+    const auto ok = [&] { return print(reply, reply_length, "OK\r\n"); };
+    const auto answer = [&](const int32_t value) {
+      return print(reply, reply_length, value, "\r\n");
+    };
+    // parses the only argument
+    const auto argument = [&tokens](auto &value) {
+      return parse(tokens.next(), value) && tokens.done();
+    };
+    // parses a channel number into an index
+    const auto channel = [&tokens](int &index) {
+      if (!parse(tokens.next(), index) || (index < 1)
+          || (index > used_channels)) {
+        return false;
+      }
+      index -= 1;
+      return true;
+    };
+
+    if (matches(keyword, "stream")) {
+      const auto argument_token = tokens.next();
+      if (!tokens.done()) {
+        return -1;
+      }
+      if (matches(argument_token, "off")) {
+        stream_mask_ = 0U;
+        return ok();
+      }
+      auto mask = uint8_t{};
+      if (!parse(argument_token, mask) || (mask == 0U)
+          || (mask >= (1U << used_channels))) {
+        return -1;
+      }
+      if (stream_mask_ != 0U) {
+        stream_mask_ = mask;
+        return ok();
+      }
+      // the host needs the calibration to scale the samples
+      stream_sequence_ = 0U;
+      stream_overruns_ = 0U;
+      stream_start_mask_ = mask;
+      const auto length = ok();
+      const auto frame_length = telemetry::encode_calibration(
+          reinterpret_cast<uint8_t *>(reply + length), stream_sequence_,
+          scales_, mask);
+      ++stream_sequence_;
+      return length + frame_length;
+    }
+    // the replies would corrupt the stream
+    if (stream_mask_ != 0U) {
+      return -1;
+    }
+    if ((keyword.find(':') != std::string_view::npos)
+        || keyword.starts_with('*')) {
+      return interpret_scpi(keyword, tokens, reply, reply_length);
+    }
+    if (matches(keyword, "stream?") && tokens.done()) {
+      return print(reply, reply_length, int32_t{stream_mask_}, " ",
+                   int32_t{stream_overruns_}, "\r\n");
+    }
+    if (matches(keyword, "baud?") && tokens.done()) {
+      return answer(serial_baud_rates[baud_rate_index_]);
+    }
+    if (matches(keyword, "baud")) {
+      auto baud_rate = int32_t{};
+      if (!argument(baud_rate)) {
+        return -1;
+      }
+      const auto *const rate = std::find(
+          serial_baud_rates.begin(), serial_baud_rates.end(), baud_rate);
+      if (rate == serial_baud_rates.end()) {
+        return -1;
+      }
+      next_baud_rate_index_ =
+          static_cast<int>(rate - serial_baud_rates.begin());
+      return ok();
+    }
+    if (matches(keyword, "rate?") && tokens.done()) {
+      return answer(output_divider_);
+    }
+    if (matches(keyword, "rate")) {
+      auto divider = uint16_t{};
+      if (!argument(divider)) {
+        return -1;
+      }
+      set_output_divider(divider);
+      return ok();
+    }
+    if (matches(keyword, "mask?") && tokens.done()) {
+      return answer(channel_mask_);
+    }
+    if (matches(keyword, "mask")) {
+      auto mask = uint8_t{};
+      return (argument(mask) && set_channel_mask(mask)) ? ok() : -1;
+    }
+    if (matches(keyword, "avg?") && tokens.done()) {
+      return answer(converter.averaging_length());
+    }
+    if (matches(keyword, "avg")) {
+      auto length = int32_t{};
+      return (argument(length) && converter.set_averaging_length(length))
+                 ? ok()
+                 : -1;
+    }
+    if (matches(keyword, "adapt?") && tokens.done()) {
+      auto length = print(reply, reply_length, converter.adaptive_length());
+      for (auto i = 0; (i < used_channels) && (length > 0); ++i) {
+        const auto used = print(reply + length, reply_length - length, " ",
+                                converter.effective_length(i));
+        length = (used > 0) ? (length + used) : -1;
+      }
+      if (length > 0) {
+        const auto used =
+            print(reply + length, reply_length - length, "\r\n");
+        length = (used == 2) ? (length + used) : -1;
+      }
+      return length;
+    }
+    if (matches(keyword, "adapt")) {
+      auto length = int32_t{};
+      return (argument(length) && converter.set_adaptive_length(length))
+                 ? ok()
+                 : -1;
+    }
+    if (matches(keyword, "fmt?") && tokens.done()) {
+      return print(reply, reply_length,
+                   (output_format_ == Output_format::Text)     ? "text\r\n"
+                   : (output_format_ == Output_format::Binary) ? "bin\r\n"
+                                                               : "batch\r\n");
+    }
+    if (matches(keyword, "batch?") && tokens.done()) {
+      return answer(static_cast<int32_t>(batch_length_));
+    }
+    if (matches(keyword, "batch")) {
+      auto length = int32_t{};
+      return (argument(length) && set_batch_length(length)) ? ok() : -1;
+    }
+    if (matches(keyword, "fmt")) {
+      const auto format = tokens.next();
+      if (!tokens.done()) {
+        return -1;
+      }
+      if (matches(format, "text")) {
+        set_output_format(Output_format::Text);
+      } else if (matches(format, "bin")) {
+        set_output_format(Output_format::Binary);
+      } else if (matches(format, "batch")) {
+        set_output_format(Output_format::Batched);
+      } else {
+        return -1;
+      }
+      return ok();
+    }
+    if (matches(keyword, "report?") && tokens.done()) {
+      return print(reply, reply_length,
+                   (report_ == Report::All) ? "all\r\n" : "change\r\n");
+    }
+    if (matches(keyword, "report")) {
+      const auto report = tokens.next();
+      if (!tokens.done()) {
+        return -1;
+      }
+      if (matches(report, "all")) {
+        set_report(Report::All);
+      } else if (matches(report, "change")) {
+        set_report(Report::Changes);
+      } else {
+        return -1;
+      }
+      return ok();
+    }
+    if (matches(keyword, "deadband?")) {
+      auto index = 0;
+      if (!channel(index) || !tokens.done()) {
+        return -1;
+      }
+      return answer(filter_.deadband(index));
+    }
+    if (matches(keyword, "deadband")) {
+      auto index = 0;
+      auto deadband = int32_t{};
+      return (channel(index) && argument(deadband)
+              && filter_.set_deadband(index, deadband))
+                 ? ok()
+                 : -1;
+    }
+    if (matches(keyword, "heartbeat?") && tokens.done()) {
+      return print(reply, reply_length, int64_t{filter_.heartbeat_ms()},
+                   "\r\n");
+    }
+    if (matches(keyword, "heartbeat")) {
+      auto interval = int32_t{};
+      if (!argument(interval) || (interval < 0)) {
+        return -1;
+      }
+      filter_.set_heartbeat_ms(static_cast<uint32_t>(interval));
+      return ok();
+    }
+    if (matches(keyword, "mode?")) {
+      auto index = 0;
+      if (!channel(index) || !tokens.done()) {
+        return -1;
+      }
+      constexpr const char *names[] = {"dc\r\n", "rms\r\n", "ac\r\n"};
+      return print(reply, reply_length,
+                   names[std::to_underlying(converter.mode(index))]);
+    }
+    if (matches(keyword, "mode")) {
+      auto index = 0;
+      if (!channel(index)) {
+        return -1;
+      }
+      const auto mode = tokens.next();
+      if (!tokens.done()) {
+        return -1;
+      }
+      if (matches(mode, "dc")) {
+        converter.set_mode(index, Channel_mode::DC);
+      } else if (matches(mode, "rms")) {
+        converter.set_mode(index, Channel_mode::RMS);
+      } else if (matches(mode, "ac")) {
+        converter.set_mode(index, Channel_mode::AC);
+      } else {
+        return -1;
+      }
+      return ok();
+    }
+    if (matches(keyword, "gain?")) {
+      auto index = 0;
+      if (!channel(index) || !tokens.done()) {
+        return -1;
+      }
+      const auto gain = 1 << converter.range(index);
+      return converter.auto_range(index)
+                 ? print(reply, reply_length, "auto ", gain, "\r\n")
+                 : print(reply, reply_length, gain, " ", gain, "\r\n");
+    }
+    if (matches(keyword, "gain")) {
+      auto index = 0;
+      if (!channel(index)) {
+        return -1;
+      }
+      const auto gain = tokens.next();
+      if (matches(gain, "auto") && tokens.done()) {
+        converter.set_auto_range(index);
+        return ok();
+      }
+      auto value = int32_t{};
+      return (parse(gain, value) && tokens.done()
+              && converter.set_range(index, averaging_shift(value)))
+                 ? ok()
+                 : -1;
+    }
+    if (matches(keyword, "trim?")) {
+      auto index = 0;
+      if (!channel(index) || !tokens.done()) {
+        return -1;
+      }
+      const auto &trims = calibration_.range_trims[index];
+      static_assert(number_of_ranges == 5);
+      return print(reply, reply_length, trims[0], " ", trims[1], " ",
+                   trims[2], " ", trims[3], " ", trims[4], "\r\n");
+    }
+    if (matches(keyword, "trim")) {
+      auto index = 0;
+      auto gain = int32_t{};
+      auto trim = int16_t{};
+      if (!channel(index) || !parse(tokens.next(), gain)
+          || !argument(trim)) {
+        return -1;
+      }
+      const auto range = averaging_shift(gain);
+      if ((range < 0) || (range >= number_of_ranges)) {
+        return -1;
+      }
+      calibration_.range_trims[index][range] = trim;
+      compile_calibration();
+      return ok();
+    }
+    if (matches(keyword, "scope?") && tokens.done()) {
+      constexpr const char *names[] = {"idle ", "armed ", "triggered ",
+                                       "done "};
+      const auto &scope = converter.scope();
+      return print(reply, reply_length,
+                   names[std::to_underlying(scope.state())], scope.length(),
+                   "\r\n");
+    }
+    if (matches(keyword, "scope")) {
+      auto &scope = converter.scope();
+      const auto first = tokens.next();
+      if (matches(first, "stop") && tokens.done()) {
+        scope.stop();
+        return ok();
+      }
+      if (matches(first, "dump") && tokens.done()) {
+        const auto length = scope.length();
+        if (length == 0) {
+          return -1;
+        }
+        // an IEEE 488.2 definite length block: '#', the number of digits of
+        // the length, the length and the data
+        auto digits = 1;
+        for (auto rest = length / 10; rest > 0; rest /= 10) {
+          ++digits;
+        }
+        dumping_ = true;
+        dump_position_ = 0;
+        return print(reply, reply_length, "#", digits, length);
+      }
+      auto index = 0;
+      auto trigger = Trigger{};
+      auto level = int32_t{};
+      auto pre = Size{};
+      auto post = Size{};
+      if (!parse(first, index) || (index < 1) || (index > used_channels)) {
+        return -1;
+      }
+      index -= 1;
+      const auto type = tokens.next();
+      if (matches(type, "rise")) {
+        trigger = Trigger::Rising;
+      } else if (matches(type, "fall")) {
+        trigger = Trigger::Falling;
+      } else if (matches(type, "above")) {
+        trigger = Trigger::Above;
+      } else if (matches(type, "below")) {
+        trigger = Trigger::Below;
+      } else {
+        return -1;
+      }
+      if (!parse(tokens.next(), level) || !parse(tokens.next(), pre)
+          || !argument(post)) {
+        return -1;
+      }
+      // the samples are raw, i.e. in the range, which is converting now
+      const auto range = converter.current_range(index);
+      const auto scale =
+          compile(at_gain(calibration_.channel[index], 1 << range,
+                          calibration_.range_trims[index][range]));
+      return scope.arm(index, trigger, unapply(level, scale), channel_mask_,
+                       pre, post)
+                 ? ok()
+                 : -1;
+    }
+    if (matches(keyword, "modbus?") && tokens.done()) {
+      return answer(calibration_.bus_address);
+    }
+    if (matches(keyword, "modbus")) {
+      const auto argument_token = tokens.next();
+      if (!tokens.done()) {
+        return -1;
+      }
+      if (matches(argument_token, "off")) {
+        calibration_.bus_address = modbus::broadcast_address;
+        return ok();
+      }
+      auto address = uint8_t{};
+      return (parse(argument_token, address) && start_modbus(address))
+                 ? ok()
+                 : -1;
+    }
+    if (matches(keyword, "sync?") && tokens.done()) {
+      constexpr const char *names[] = {"off ", "50 ", "60 ", "auto "};
+      return print(reply, reply_length,
+                   names[std::to_underlying(converter.line_sync())],
+                   converter.line_frequency_Hz(), "\r\n");
+    }
+    if (matches(keyword, "sync")) {
+      const auto sync = tokens.next();
+      if (!tokens.done()) {
+        return -1;
+      }
+      if (matches(sync, "off")) {
+        converter.set_line_sync(Line_sync::Off);
+      } else if (matches(sync, "50")) {
+        converter.set_line_sync(Line_sync::Hz50);
+      } else if (matches(sync, "60")) {
+        converter.set_line_sync(Line_sync::Hz60);
+      } else if (matches(sync, "auto")) {
+        converter.set_line_sync(Line_sync::Auto);
+      } else {
+        return -1;
+      }
+      return ok();
+    }
+    if (matches(keyword, "cal?")) {
+      auto index = 0;
+      if (!channel(index) || !tokens.done()) {
+        return -1;
+      }
+      const auto &cal = calibration_.channel[index];
+      return print(reply, reply_length, cal.calibration_voltage, " ",
+                   cal.full_scale_voltage, " ", cal.full_scale_reading, " ",
+                   cal.offset, "\r\n");
+    }
+    if (matches(keyword, "cal")) {
+      auto index = 0;
+      if (!channel(index)) {
+        return -1;
+      }
+      const auto first = tokens.next();
+      if (matches(first, "offset") || matches(first, "gain")) {
+        if (!tokens.done()) {
+          return -1;
+        }
+        command_ = Command{(2 * index) + (matches(first, "gain") ? 2 : 1)};
+        return ok();
+      }
+      auto cal = Channel_calibration{};
+      if (!parse(first, cal.calibration_voltage)
+          || !parse(tokens.next(), cal.full_scale_voltage)
+          || !parse(tokens.next(), cal.full_scale_reading)
+          || !argument(cal.offset)) {
+        return -1;
+      }
+      calibration_.channel[index] = cal;
+      compile_calibration();
+      return ok();
+    }
+    if (matches(keyword, "peak?")) {
+      auto index = 0;
+      if (!channel(index) || !tokens.done()) {
+        return -1;
+      }
+      const auto window =
+          scaled(converter.get_extremes(index), scales_[index]);
+      const auto held =
+          scaled(converter.get_held_extremes(index), scales_[index]);
+      return print(reply, reply_length, window.minimum, " ", window.maximum,
+                   " ", window.maximum - window.minimum, " ", held.minimum,
+                   " ", held.maximum, " ", held.maximum - held.minimum,
+                   "\r\n");
+    }
+    if (matches(keyword, "peak")) {
+      if (!matches(tokens.next(), "reset") || !tokens.done()) {
+        return -1;
+      }
+      converter.reset_hold();
+      return ok();
+    }
+    if (matches(keyword, "power?") && tokens.done()) {
+      return print(reply, reply_length, power_uW_, " ", apparent_power_uVA_,
+                   " ", int16_t{power_factor_permille_}, "\r\n");
+    }
+    if (matches(keyword, "energy?") && tokens.done()) {
+      return print(reply, reply_length, energy_.energy_uWh(), " ",
+                   energy_.charge_uAh(), "\r\n");
+    }
+    if (matches(keyword, "energy")) {
+      if (!matches(tokens.next(), "reset") || !tokens.done()) {
+        return -1;
+      }
+      energy_.reset();
+      return ok();
+    }
+    if (matches(keyword, "save") && tokens.done()) {
+      command_ = Command::Flash;
+      return ok();
+    }
+    if (matches(keyword, "stat?") && tokens.done()) {
+      const auto statistics = serial_statistics();
+      return print(reply, reply_length,
+                   static_cast<int32_t>(statistics.queued_bytes), " ",
+                   static_cast<int32_t>(statistics.high_water_mark), " ",
+                   int32_t{statistics.dropped_records}, " ",
+                   int32_t{converter.dropped_frames()}, " ",
+                   int32_t{parser_.overruns()}, "\r\n");
+    }
+    return -1;
+  }
+
+  /// SCPI commands for instrument automation. The mnemonics of a header are
+  /// separated by colons and match in their short form, the capitals, or in
+  /// full. Unlike the other commands, commands are not answered and errors
+  /// are kept for `SYSTem:ERRor?`, so that nothing is left for a controller
+  /// to read, which does not expect it. Queries return the last reading
+  /// right away in V, A, W and Wh.
+  ///
+  ///   *IDN?            manufacturer, model, serial number and firmware
+  ///   *CLS             clear the error
+  ///   MEASure:VOLTage?, MEASure:CURRent?
+  ///                    the reading of the voltage or current channel
+  ///   MEASure:POWer?   the real power
+  ///   MEASure:ENERgy?  the energy so far
+  ///   MEASure:CHANnel? [<ch>]
+  ///                    the reading of channel 1..4 or of all of them,
+  ///                    separated by commas
+  ///   CONFigure:AVERage <n>, CONFigure:AVERage?
+  ///                    average n samples per reading
+  ///   CONFigure:RATE <n>, CONFigure:RATE?
+  ///                    transmit every n-th reading, none for 0, which keeps
+  ///                    readings from coming between queries and replies
+  ///   SYSTem:ERRor?    the first error since the last query as
+  ///                    <code>,"<description>", 0 for none
+  ///
+  /// \return The length of the reply, 0 for none.
+  Size Meter::interpret_scpi(std::string_view header, Tokenizer &tokens,
+                             char *const reply, const Size reply_length) {
+    const auto query = header.ends_with('?');
+    if (query) {
+      header.remove_suffix(1);
+    }
+    if (header.starts_with(':')) {
+      header.remove_prefix(1);
+    }
+    const auto colon = std::min(header.find(':'), header.size());
+    const auto root = header.substr(0, colon);
+    const auto leaf = header.substr(std::min(colon + 1, header.size()));
+    const auto parameter = tokens.next();
+    const auto done = tokens.done();
+
+    // the first error is kept until it is read
+    const auto fail = [this](const int16_t code) {
+      if (scpi_error_ == 0) {
+        scpi_error_ = code;
+      }
+      return Size{0};
+    };
+    const auto value = [&](const int32_t reading) {
+      return print(reply, reply_length, Millionths{reading}, "\r\n");
+    };
+    // the only parameter of a command, none for a query
+    const auto parameter_error = [&]() -> int16_t {
+      if (!done) {
+        return -108;
+      }
+      if (query != parameter.empty()) {
+        return query ? -108 : -109;
+      }
+      return 0;
+    };
+
+    if (matches_mnemonic(root, "*IDN") && leaf.empty() && query) {
+      return (parameter.empty() && done)
+                 ? print(reply, reply_length, "mspmeter,MSP430i2041,0,",
+                         firmware_version, "\r\n")
+                 : fail(-108);
+    }
+    if (matches_mnemonic(root, "*CLS") && leaf.empty() && !query) {
+      if (!parameter.empty() || !done) {
+        return fail(-108);
+      }
+      scpi_error_ = 0;
+      return 0;
+    }
+    if (matches_mnemonic(root, "MEASure") && query) {
+      const auto &voltage = calibration_.voltage_channel_index;
+      const auto &current = calibration_.current_channel_index;
+      if (matches_mnemonic(leaf, "CHANnel")) {
+        auto index = 0;
+        if (!done) {
+          return fail(-108);
+        }
+        if (parameter.empty()) {
+          auto length = Size{0};
+          for (auto i = 0; (i < used_channels) && (length >= 0); ++i) {
+            const auto used =
+                print(reply + length, reply_length - length,
+                      (i == 0) ? "" : ",", Millionths{voltages_uV_[i]});
+            length = (used > 0) ? (length + used) : -1;
+          }
+          const auto used =
+              (length > 0)
+                  ? print(reply + length, reply_length - length, "\r\n")
+                  : -1;
+          return (used > 0) ? (length + used) : fail(-223);
+        }
+        if (!parse(parameter, index)) {
+          return fail(-104);
+        }
+        if ((index < 1) || (index > used_channels)) {
+          return fail(-222);
+        }
+        return value(voltages_uV_[index - 1]);
+      }
+      if (const auto error = parameter_error(); error != 0) {
+        return fail(error);
+      }
+      if (matches_mnemonic(leaf, "VOLTage")) {
+        return value(voltages_uV_[voltage]);
+      }
+      if (matches_mnemonic(leaf, "CURRent")) {
+        return value(voltages_uV_[current]);
+      }
+      if (matches_mnemonic(leaf, "POWer")) {
+        return value(power_uW_);
+      }
+      if (matches_mnemonic(leaf, "ENERgy")) {
+        return print(reply, reply_length, Millionths{energy_.energy_uWh()},
+                     "\r\n");
+      }
+    }
+    if (matches_mnemonic(root, "CONFigure")
+        && (matches_mnemonic(leaf, "AVERage")
+            || matches_mnemonic(leaf, "RATE"))) {
+      const auto averaging = matches_mnemonic(leaf, "AVERage");
+      if (const auto error = parameter_error(); error != 0) {
+        return fail(error);
+      }
+      if (query) {
+        return print(reply, reply_length,
+                     averaging ? converter.averaging_length()
+                               : int32_t{output_divider_},
+                     "\r\n");
+      }
+      auto number = int32_t{};
+      if (!parse(parameter, number)) {
+        return fail(-104);
+      }
+      if (averaging) {
+        return converter.set_averaging_length(number) ? 0 : fail(-222);
+      }
+      if ((number < 0) || (number > 0xffff)) {
+        return fail(-222);
+      }
+      set_output_divider(static_cast<uint16_t>(number));
+      return 0;
+    }
+    if (matches_mnemonic(root, "SYSTem") && matches_mnemonic(leaf, "ERRor")
+        && query) {
+      if (const auto error = parameter_error(); error != 0) {
+        return fail(error);
+      }
+      const auto code = std::exchange(scpi_error_, int16_t{0});
+      return print(reply, reply_length, code, ",\"", scpi_message(code),
+                   "\"\r\n");
+    }
+    return fail(-113);
+  }
 
   bool Meter::eusci_a0_tx_buffer_empty_isr() {
     serial.on_tx_buffer_empty();
@@ -206,12 +1505,27 @@ namespace meter {
   }
 
   bool Meter::eusci_a0_rx_buffer_full_isr() {
-    return parser_.add_character(
-        static_cast<char>(msp430i2::UCA0::read_rx_buffer()));
+    const auto received = msp430i2::UCA0::read_rx_buffer();
+    if (protocol_ == Protocol::Modbus) {
+      // the frame ends, once the timer expires without another byte
+      modbus_receiver.add_byte(static_cast<uint8_t>(received));
+      msp430::Timer_TA0::restart_up(u16{frame_gaps[baud_rate_index_]});
+      return false;
+    }
+    return parser_.add_character(static_cast<char>(received));
   }
 
   bool Meter::sd24_1_conversion_done_isr() {
-    return converter.on_conversion_done();
+    const auto frame = AD_converter::conversion_results();
+    if (stream_mask_ != 0U) {
+      stream(frame);
+    }
+    return converter.on_conversion_done(frame);
+  }
+
+  bool Meter::timer_a0_ccr0_isr() {
+    msp430::Timer_TA0::stop();
+    return modbus_receiver.end_frame();
   }
 
   bool Meter::on_s1_down() {
@@ -229,40 +1543,54 @@ namespace meter {
         count_
             - encoder_.on_edge(std::to_underlying(
                 msp430i2::Digital_io::get() & (encoder_a_pin | encoder_b_pin))),
-        0, (std::to_underlying(Command::Num_) - 1) * 2);
+        0,
+        ((menu_active_ ? std::to_underlying(Command::Num_)
+                       : std::to_underlying(Page::Num_))
+         - 1)
+            * 2);
   }
 
-  void Meter::format_voltage(Array<char, 6> &text_buffer) {
+  void Meter::render_voltage(Slice<u8, 4> row) {
     if (conversion_results_[calibration_.voltage_channel_index]
         >= msp430i2::SD24::full_scale) {
-      print(text_buffer, "  OL");
+      to_7segment(row, "  OL");
     } else if (conversion_results_[calibration_.voltage_channel_index]
                <= msp430i2::SD24::negative_full_scale) {
-      print(text_buffer, "- OL");
+      to_7segment(row, "- OL");
     } else if (const auto voltage_mV =
-                   voltages_uV_[calibration_.voltage_channel_index] / 1'000;
+                   divide<1'000>(
+                       voltages_uV_[calibration_.voltage_channel_index]);
                voltage_mV < 10'000) {
-      format_readout<1, 3>(Slice{text_buffer},
-                           saturate_cast<int16_t>(voltage_mV));
+      render_readout<1, 3>(row, saturate_cast<int16_t>(voltage_mV));
     } else {
-      format_readout<2, 2>(Slice{text_buffer},
-                           saturate_cast<int16_t>(voltage_mV / 10));
+      render_readout<2, 2>(row,
+                           saturate_cast<int16_t>(divide<10>(voltage_mV)));
     }
   }
 
-  void Meter::format_current() {
+  void Meter::render_current() {
     if (conversion_results_[calibration_.current_channel_index]
         >= msp430i2::SD24::full_scale) {
-      print(lower_text_buffer_, "  OL");
+      to_7segment(lower_row(), "  OL");
     } else if (conversion_results_[calibration_.current_channel_index]
                <= msp430i2::SD24::negative_full_scale) {
-      print(lower_text_buffer_, "- OL");
+      to_7segment(lower_row(), "- OL");
     } else {
-      format_readout<1, 3>(
-          Slice{lower_text_buffer_},
-          static_cast<int16_t>(voltages_uV_[calibration_.current_channel_index]
-                               / 1'000));
+      render_readout<1, 3>(
+          lower_row(),
+          static_cast<int16_t>(divide<1'000>(
+              voltages_uV_[calibration_.current_channel_index])));
     }
   }
 
+  void Meter::render_power() {
+    render_micro(upper_row(), power_uW_);
+    render_readout<1, 3>(lower_row(), power_factor_permille_);
+  }
+
+  void Meter::render_energy() {
+    render_micro(upper_row(), energy_.energy_uWh());
+    render_micro(lower_row(), energy_.charge_uAh());
+  }
+
 } // namespace meter
@@ -5,22 +5,57 @@
 
 #include "adc.hpp"
 #include "config.hpp"
+#include "drivers/rotary_encoder.hpp"
 #include "future.hpp"
+#include "modbus.hpp"
+#include "msp/uart.hpp"
 #include "msp430.hpp"
 #include "msp430i2.hpp"
+#include "power.hpp"
 #include "readout.hpp"
-#include "rotary_encoder.hpp"
+#include "report.hpp"
 #include "util.hpp"
 
+#include <string_view>
+
 namespace meter {
 
+  class Tokenizer;
+
+  /// The version of the layout of `Calibration_constants`. Raise it, whenever
+  /// a member is added or changed.
+  constexpr auto calibration_layout = uint16_t{1U};
+
   struct Calibration_constants {
       Array<Channel_calibration, used_channels> channel;
       int32_t reference_voltage_uV{msp430i2::SD24::reference_uV};
       int16_t voltage_channel_index{0};
       int16_t current_channel_index{1};
+      /// The deviation of the gain of every range from its nominal value in
+      /// 1/2^16, see `at_gain()`.
+      Array<Array<int16_t, number_of_ranges>, used_channels> range_trims{};
+      /// The Modbus slave address, with which the meter starts, 0 for the
+      /// text commands, see `Meter::start_modbus()`.
+      uint8_t bus_address{modbus::broadcast_address};
+      /// `calibration_layout`, with which the constants were stored. It is
+      /// last, so that the members, which older versions stored, keep their
+      /// offsets.
+      uint16_t layout{calibration_layout};
   };
 
+  /// \return `stored` with neutral range trims and the default bus address,
+  ///    if it was not stored in the current layout, e.g. by an older version
+  ///    or in erased flash. The members in front of `range_trims` are kept.
+  constexpr Calibration_constants
+  in_current_layout(Calibration_constants stored) {
+    if (stored.layout != calibration_layout) {
+      stored.range_trims = {};
+      stored.bus_address = modbus::broadcast_address;
+      stored.layout = calibration_layout;
+    }
+    return stored;
+  }
+
   enum class Command {
     None_ = -1,
     Back,
@@ -32,27 +67,107 @@ namespace meter {
     Ch3Gain,
     Ch4Offset,
     Ch4Gain,
+    Averaging,
+    Format,
+    Hold,
     Flash,
     Num_
   };
 
+  /// What the display shows outside of the menu, selected with the encoder.
+  enum class Page {
+    /// voltage and current
+    Readings,
+    /// real power in W and power factor
+    Power,
+    /// energy in Wh and charge in Ah
+    Energy,
+    Num_
+  };
+
+  enum class Output_format {
+    /// tab-separated readings in µV, one line per reading
+    Text,
+    /// COBS-framed binary telemetry, see telemetry.hpp
+    Binary,
+    /// binary telemetry with several delta-encoded readings per frame
+    Batched
+  };
+
+  /// Which readings are transmitted, see `Exception_filter`
+  enum class Report {
+    /// every reading of every enabled channel
+    All,
+    /// the channels, which changed by more than their deadband, with a
+    /// sequence number and a timestamp
+    Changes
+  };
+
+  /// How the serial interface is used
+  enum class Protocol {
+    /// readings are sent on their own, commands are text lines
+    Text,
+    /// the meter is a Modbus RTU slave and only answers requests, see
+    /// `Meter::read_input_register()`
+    Modbus
+  };
+
+  /// Assembles the characters received over the serial interface into lines,
+  /// which are interpreted by the main loop.
+  ///    While a line is waiting to be interpreted, further characters are
+  /// discarded, so the line can be parsed in place. A controller should
+  /// therefore wait for the reply before sending the next command.
   class Command_parser {
     public:
+      /// To be called from the receive interrupt service routine.
+      /// \return Whether a line is ready to be interpreted.
       bool add_character(const char c) {
-        if (c == '\n') {
+        if (line_ready_) {
+          overruns_ = static_cast<uint16_t>(overruns_ + 1U);
+          return false;
+        }
+        if ((c == '\r') || (c == '\n')) {
+          if ((index_ == 0) && !too_long_) {
+            return false;
+          }
+          line_ready_ = true;
           return true;
         }
         if (index_ < state_.size()) {
           state_[index_] = c;
+          ++index_;
+        } else {
+          too_long_ = true;
         }
         return false;
       }
 
-      void evaluate() {}
+      bool line_ready() const { return line_ready_; }
+      bool too_long() const { return too_long_; }
+
+      /// \return The received line without its terminator. Only valid, while
+      ///    `line_ready()`.
+      std::string_view line() const {
+        return {state_.data(), static_cast<std::size_t>(index_)};
+      }
+
+      /// Makes room for the next line.
+      void release() {
+        index_ = 0;
+        too_long_ = false;
+        line_ready_ = false;
+      }
+
+      /// \return The number of characters, which were discarded, because the
+      ///    previous line was still being interpreted.
+      uint16_t overruns() const { return overruns_; }
 
     private:
-      Array<char, 32> state_{};
-      int index_{0};
+      Array<char, 48> state_{};
+      Size index_{0};
+      bool too_long_{false};
+      volatile bool line_ready_{false};
+      volatile uint16_t overruns_{0U};
   };
 
   enum class Meter_status {
@@ -64,10 +179,6 @@ namespace meter {
     /// An ADC conversion result was not collected before a new one was
     /// available. This should never happen, because it is a systematic error.
     ConversionOverflow = -3,
-    /// This is a systematic error, which is caused by having a too-low serial
-    /// interface speed. New measurements are present before the old ones could
-    /// be transmitted.
-    SerialBusy = -2,
     /// The conversion of the measured values to string failed due to the buffer
     /// being too small to hold the converted value.
     StringConversionFailure = -1,
@@ -75,38 +186,169 @@ namespace meter {
     StoreCalibration = 1
   };
 
+  struct Serial_statistics {
+      Size queued_bytes;
+      Size high_water_mark;
+      uint16_t dropped_records;
+  };
+
   /// In debug builds, this will trap execution. In release builds, the system
   /// will be reset.
   [[noreturn]] void error(Meter_status code);
 
   class Meter {
     public:
-      constexpr Meter(Array<char, 6> &upper_text_buffer,
-                      Array<char, 6> &lower_text_buffer)
-          : upper_text_buffer_{upper_text_buffer},
-            lower_text_buffer_{lower_text_buffer} {}
+      /// \param segments The image of the display, upper row first.
+      constexpr explicit Meter(Array<u8, 8> &segments) : segments_{segments} {}
 
       constexpr const auto &cal() const { return calibration_; }
-      void set_calibration(const Calibration_constants &cal) {
+      void set_calibration(const Calibration_constants &stored) {
+        const auto cal = in_current_layout(stored);
+        const auto join_bus = (cal.bus_address != calibration_.bus_address)
+                              && (cal.bus_address
+                                  != modbus::broadcast_address);
         calibration_ = cal;
+        compile_calibration();
+        if (join_bus) {
+          start_modbus(cal.bus_address);
+        }
+      }
+
+      void start_acquisition();
+      uint16_t dropped_frames() const;
+      /// The number of samples taken so far, wrapping around.
+      uint16_t sample_count() const;
+
+      Serial_statistics serial_statistics() const;
+      void set_overflow_policy(msp430::Overflow_policy policy);
+
+      int32_t averaging_length() const;
+      bool set_averaging_length(int32_t length);
+
+      constexpr Output_format output_format() const { return output_format_; }
+      void set_output_format(Output_format format);
+
+      /// The number of readings sent in one frame in the batched format.
+      constexpr Size batch_length() const { return batch_length_; }
+      bool set_batch_length(Size length);
+
+      /// Only every `divider`-th reading is transmitted, none for 0.
+      constexpr uint16_t output_divider() const { return output_divider_; }
+      void set_output_divider(const uint16_t divider) {
+        output_divider_ = divider;
+        output_count_ = 0U;
+      }
+
+      /// The mean of the instantaneous power during the last reading in uW,
+      /// i.e. the real power of AC loads.
+      constexpr int32_t power_uW() const { return power_uW_; }
+      /// The product of the true RMS values of voltage and current in uVA.
+      constexpr int32_t apparent_power_uVA() const {
+        return apparent_power_uVA_;
+      }
+      constexpr int16_t power_factor_permille() const {
+        return power_factor_permille_;
       }
+      constexpr const Energy_counter &energy() const { return energy_; }
+
+      constexpr Report report() const { return report_; }
+      void set_report(const Report report) {
+        report_ = report;
+        filter_.restart();
+      }
+      constexpr Exception_filter &exception_filter() { return filter_; }
+      /// The time of the last reading since the start.
+      uint32_t timestamp_ms() const { return clock_.ms(); }
+
+      Protocol protocol() const { return protocol_; }
+      constexpr uint8_t modbus_address() const {
+        return calibration_.bus_address;
+      }
+      /// Answers Modbus RTU requests to `address` instead of commands from
+      /// now on. The address is part of the calibration, so once it is
+      /// stored, the meter starts as a slave.
+      bool start_modbus(uint8_t address);
+
+      /// The input registers of the Modbus slave, 32-bit values take two
+      /// registers, 64-bit values four:
+      ///
+      ///   0-7    the last reading of channel 1..4 in uV or uA (int32)
+      ///   8      the real power in uW (int32)
+      ///   10     the apparent power in uVA (int32)
+      ///   12     the power factor in thousandths (int16)
+      ///   13     the number of samples so far, wrapping around (uint16)
+      ///   16-31  the minimum and the maximum of channel 1..4 during the
+      ///          last reading (int32 each)
+      ///   32     the energy in uWh (int64)
+      ///   36     the charge in uAh (int64)
+      modbus::Exception read_input_register(uint16_t address,
+                                            uint16_t &value) const;
+      /// The holding registers of the Modbus slave:
+      ///
+      ///   0      the averaging length (uint32); the high word takes effect
+      ///          with the low word
+      ///   2-5    the mode of channel 1..4: 0 DC, 1 RMS, 2 AC
+      ///   6-9    the PGA gain of channel 1..4: 1, 2, 4, 8, 16 or 0 for auto
+      ///   10     the line synchronization: 0 off, 1 50 Hz, 2 60 Hz, 3 auto
+      ///   11     the slave address, 1..247
+      ///   12     the protocol: 1 Modbus, 0 for the text commands after the
+      ///          response
+      ///   13     write 1 to store the calibration including the address
+      ///          like `save`, reads 0
+      modbus::Exception read_holding_register(uint16_t address,
+                                              uint16_t &value) const;
+      modbus::Exception write_holding_register(uint16_t address,
+                                               uint16_t value);
+      /// The first reading, which started after the last latch, or the last
+      /// reading, if there was none.
+      modbus::Exception read_snapshot(modbus::Snapshot &snapshot) const;
+      /// Starts the next reading with the next sample, usually on all meters
+      /// on the bus at once by a broadcast.
+      modbus::Exception latch(uint16_t number);
+
+      /// Bit i enables the transmission of channel i.
+      constexpr uint8_t channel_mask() const { return channel_mask_; }
+      bool set_channel_mask(uint8_t mask);
+
+      /// Drains the samples converted in the background.
+      /// \return Whether a new reading is available to `step()`.
+      bool acquire();
 
       Meter_status step();
+      /// Interprets a command line received over the serial interface, if
+      /// there is one, and queues the reply.
       void handle_command();
 
       bool eusci_a0_tx_buffer_empty_isr();
       bool eusci_a0_rx_buffer_full_isr();
       bool sd24_1_conversion_done_isr();
+      bool timer_a0_ccr0_isr();
       bool on_s1_down();
 
       void update_encoder();
 
     private:
-      void format_voltage(Array<char, 6> &text_buffer);
-      void format_current();
+      void compile_calibration();
+      void compile_scale(int channel);
+      void calibrate_offset(int channel);
+      void calibrate_gain(int channel);
+      Meter_status transmit();
+      void continue_dump();
+      void stream(const AD_converter::Frame &frame);
+      void answer_modbus();
+      Size interpret(std::string_view line, char *reply, Size reply_length);
+      Size interpret_scpi(std::string_view header, Tokenizer &tokens,
+                          char *reply, Size reply_length);
+
+      Slice<u8, 4> upper_row() { return slice<0, 4>(segments_); }
+      Slice<u8, 4> lower_row() { return slice<4, 4>(segments_); }
+
+      void render_voltage(Slice<u8, 4> row);
+      void render_current();
+      void render_power();
+      void render_energy();
 
-      Array<char, 6> &upper_text_buffer_;
-      Array<char, 6> &lower_text_buffer_;
+      Array<u8, 8> &segments_;
 
       Command_parser parser_{};
       Rotary_encoder<std::underlying_type_t<decltype(encoder_a_pin)>,
@@ -115,10 +357,55 @@ namespace meter {
           encoder_{};
 
       Calibration_constants calibration_{};
+      Array<Channel_scale, used_channels> scales_{};
+      /// the range of every channel, which `scales_` were compiled for
+      Array<uint8_t, used_channels> scale_ranges_{};
 
       Array<int32_t, used_channels> conversion_results_{};
       Array<int32_t, used_channels> voltages_uV_{};
 
+      int32_t power_uW_{0};
+      int32_t apparent_power_uVA_{0};
+      int16_t power_factor_permille_{0};
+      Energy_counter energy_{};
+
+      Output_format output_format_{Output_format::Text};
+      uint16_t output_divider_{1U};
+      Size batch_length_{8};
+      uint16_t output_count_{0U};
+      uint8_t channel_mask_{(1U << used_channels) - 1U};
+      uint8_t sequence_number_{0U};
+      Report report_{Report::All};
+      Exception_filter filter_{};
+      Sample_clock clock_{};
+      /// whether the binary receiver still has to be sent the calibration
+      bool calibration_pending_{true};
+      /// whether a capture is being sent, see `continue_dump()`
+      bool dumping_{false};
+      Size dump_position_{0};
+      /// the channels, whose samples the conversion interrupt sends right
+      /// away, see `stream()`
+      volatile uint8_t stream_mask_{0U};
+      /// the channels to stream, once the reply has been queued
+      uint8_t stream_start_mask_{0U};
+      uint8_t stream_sequence_{0U};
+      /// the number of samples frames, which did not fit into the queue
+      volatile uint16_t stream_overruns_{0U};
+      /// the index into `serial_baud_rates` of the baud rate in use and the
+      /// one to switch to, once the reply has been sent, -1 for none
+      int baud_rate_index_{0};
+      int next_baud_rate_index_{-1};
+      volatile Protocol protocol_{Protocol::Text};
+      modbus::Snapshot snapshot_{};
+      /// whether the reading of the last latch is still being taken
+      bool latch_pending_{false};
+      /// whether `snapshot_` holds the reading of a latch
+      bool latched_{false};
+      /// the first SCPI error since the last `SYSTem:ERRor?`, 0 for none
+      int16_t scpi_error_{0};
+      /// the high word of the averaging length written last
+      uint16_t averaging_high_word_{0U};
+
       bool menu_active_{false};
       int count_{0};
       Command command_{Command::None_};
@@ -126,12 +413,8 @@ namespace meter {
 
   class Normal_operation {
     public:
-      Normal_operation(Array<char, 6> &upper_text_buffer,
-                       Array<char, 6> &lower_text_buffer, Meter &meter,
-                       Readout &readout)
-          : upper_text_buffer_{upper_text_buffer},
-            lower_text_buffer_{lower_text_buffer}, meter_{meter},
-            readout_{readout} {
+      Normal_operation(Array<u8, 8> &segments, Meter &meter, Readout &readout)
+          : segments_{segments}, meter_{meter}, readout_{readout} {
         // TODO choose a timeout that is slightly above the SD24 conversion time
         //  of 250 µs * 256 samples averaged in software = 64 ms
 #if 0
@@ -139,7 +422,7 @@ namespace meter {
             msp430::Watchdog_timer_clock_source::ACLK,
             msp430::Watchdog_timer_interval::By8192);
 #endif
-        AD_converter::start_conversion();
+        meter_.start_acquisition();
       }
 
       ~Normal_operation() {
@@ -148,25 +431,53 @@ namespace meter {
       }
 
       Meter_status operator()() {
-        const auto status = meter_.step();
+        meter_.handle_command();
+        auto status = Meter_status::OK;
+        if (meter_.acquire()) {
+          status = meter_.step();
+        }
         if (status < Meter_status::OK) {
-          print(upper_text_buffer_, "Err");
-          format_readout<4, 0>(Slice{lower_text_buffer_},
+          to_7segment(slice<0, 4>(segments_), "Err");
+          render_readout<4, 0>(slice<4, 4>(segments_),
                                std::to_underlying(status));
+          // the error must be visible before the caller halts the meter
+          while (!readout_.idle()) {
+            msp430::no_operation();
+          }
+          readout_.update(segments_);
+          while (!readout_.idle()) {
+            msp430::no_operation();
+          }
+          return status;
         }
-        readout_.update(upper_text_buffer_, lower_text_buffer_);
-        while (!readout_.idle()) {
-        }
-        AD_converter::start_conversion();
+        refresh_display();
         return status;
       }
 
     private:
-      Array<char, 6> &upper_text_buffer_;
-      Array<char, 6> &lower_text_buffer_;
+      static constexpr auto display_refresh_period =
+          sampling_frequency_Hz / display_refresh_Hz;
+      static_assert((display_refresh_period > 0)
+                    && (display_refresh_period <= 0xffff));
+
+      /// Runs the display task at `display_refresh_Hz`, while the SPI shifts
+      /// out the segments in the background.
+      void refresh_display() {
+        const auto now = meter_.sample_count();
+        if (static_cast<uint16_t>(now - last_refresh_)
+            < display_refresh_period) {
+          return;
+        }
+        last_refresh_ = now;
+        readout_.update(segments_);
+      }
+
+      Array<u8, 8> &segments_;
 
       Meter &meter_;
       Readout &readout_;
+
+      uint16_t last_refresh_{0U};
   };
 
 } // namespace meter
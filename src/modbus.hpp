@@ -0,0 +1,371 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#ifndef MSPMETER_MODBUS_HPP
+#define MSPMETER_MODBUS_HPP
+
+#include "config.hpp"
+#include "future.hpp"
+#include "util/crc16.hpp"
+
+#include <algorithm>
+
+/// A Modbus RTU slave, the alternative to the text commands for SCADA
+/// systems, which poll many meters on one bus.
+///    A frame is `address, function code, data, CRC-16` with the CRC sent low
+/// byte first and all other multi-byte fields high byte first. Frames are
+/// separated by at least 3.5 character times of silence, which the receive
+/// interrupt measures with Timer_A0. Requests to other addresses and frames
+/// with a wrong CRC are ignored; requests to the broadcast address are
+/// executed, but not answered.
+///
+///   0x03 Read Holding Registers, 0x04 Read Input Registers:
+///                request  first register (uint16), count (uint16)
+///                response byte count (uint8), the registers (uint16 each)
+///   0x06 Write Single Register:
+///                request and response  register (uint16), value (uint16)
+///   0x10 Write Multiple Registers:
+///                request  first register (uint16), count (uint16),
+///                         byte count (uint8), the values (uint16 each)
+///                response first register (uint16), count (uint16)
+///   0x41 Read Snapshot:
+///                request  nothing
+///                response byte count (uint8), the `Snapshot`
+///   0x42 Latch:
+///                request and response  latch number (uint16)
+///
+/// The last two are user-defined functions for many meters on one bus: the
+/// master broadcasts a Latch, so that all meters start a reading at the same
+/// time, and then polls each one for the result.
+/// A request, which cannot be executed, is answered by the function code
+/// with the most significant bit set and an exception code. Values wider than
+/// a register take several consecutive ones, the most significant word first.
+namespace meter::modbus {
+
+  enum class Function : uint8_t {
+    ReadHoldingRegisters = 0x03U,
+    ReadInputRegisters = 0x04U,
+    WriteSingleRegister = 0x06U,
+    WriteMultipleRegisters = 0x10U,
+    ReadSnapshot = 0x41U,
+    Latch = 0x42U
+  };
+
+  enum class Exception : uint8_t {
+    None = 0x00U,
+    IllegalFunction = 0x01U,
+    IllegalDataAddress = 0x02U,
+    IllegalDataValue = 0x03U,
+    /// the reading, which was latched, is not complete yet
+    ServerDeviceBusy = 0x06U
+  };
+
+  constexpr auto broadcast_address = uint8_t{0U};
+  constexpr auto max_address = uint8_t{247U};
+
+  /// The longest request, which is received, and the number of registers,
+  /// which can be read or written at once. The limits of the protocol would
+  /// take more RAM than the meter has to spare.
+  constexpr auto max_request_length = 48;
+  constexpr auto max_read_count = 32;
+  constexpr auto max_write_count = (max_request_length - 9) / 2;
+  constexpr auto max_response_length = 5 + (2 * max_read_count);
+
+  /// The number of clock cycles of the silence, which ends a frame: 3.5
+  /// characters of 10 bits (8N1) at `baud_rate` up to 19200 Bd and 1.75 ms
+  /// above, as the specification requires, so that a master may pause
+  /// between bytes at high baud rates.
+  constexpr uint16_t frame_gap_cycles(const int32_t clock_Hz,
+                                      const int32_t baud_rate) {
+    if (baud_rate > 19'200) {
+      return static_cast<uint16_t>(
+          ((int64_t{clock_Hz} * 1'750) + 999'999) / 1'000'000);
+    }
+    return static_cast<uint16_t>(
+        ((int64_t{clock_Hz} * 35) + baud_rate - 1) / baud_rate);
+  }
+  static_assert(frame_gap_cycles(16'384'000, 9'600) == 59'734);
+  static_assert(frame_gap_cycles(16'384'000, 19'200) == 29'867);
+  static_assert(frame_gap_cycles(16'384'000, 115'200) == 28'672);
+
+  /// \return Word `index` of the representation of `value` in `words`
+  ///    registers, the most significant one first.
+  constexpr uint16_t word_of(const int64_t value, const int index,
+                             const int words) {
+    return static_cast<uint16_t>(static_cast<uint64_t>(value)
+                                 >> (16U * static_cast<unsigned>(
+                                           words - 1 - index)));
+  }
+  static_assert(word_of(-2, 0, 2) == 0xffffU);
+  static_assert(word_of(0x1'2345, 1, 2) == 0x2345U);
+  static_assert(word_of(int64_t{1} << 48, 0, 4) == 1U);
+
+  /// The readings of the window, which started with the last Latch.
+  struct Snapshot {
+      uint16_t latch{0U};
+      /// the end of the window since the start of the acquisition
+      uint32_t timestamp_ms{0U};
+      /// in uV or uA
+      Array<int32_t, used_channels> readings{};
+      int32_t power_uW{0};
+  };
+
+  /// The length of the encoding of a `Snapshot`, which consists of its
+  /// members in order, high byte first.
+  constexpr auto snapshot_length = 2 + 4 + (4 * used_channels) + 4;
+  static_assert(3 + snapshot_length + 2 <= max_response_length);
+
+  /// \param data Room for `snapshot_length` bytes.
+  constexpr void encode(const Snapshot &snapshot, uint8_t *data) {
+    const auto put32 = [&data](const uint32_t value) {
+      for (auto shift = 24; shift >= 0; shift -= 8) {
+        *data = static_cast<uint8_t>(value >> static_cast<unsigned>(shift));
+        ++data;
+      }
+    };
+    data[0] = static_cast<uint8_t>(snapshot.latch >> 8U);
+    data[1] = static_cast<uint8_t>(snapshot.latch);
+    data += 2;
+    put32(snapshot.timestamp_ms);
+    for (const auto reading : snapshot.readings) {
+      put32(static_cast<uint32_t>(reading));
+    }
+    put32(static_cast<uint32_t>(snapshot.power_uW));
+  }
+
+  constexpr Snapshot decode(const uint8_t *data) {
+    const auto get32 = [&data]() {
+      auto value = uint32_t{0U};
+      for (auto i = 0; i < 4; ++i) {
+        value = (value << 8U) | *data;
+        ++data;
+      }
+      return value;
+    };
+    auto snapshot = Snapshot{};
+    snapshot.latch = static_cast<uint16_t>((unsigned{data[0]} << 8U) | data[1]);
+    data += 2;
+    snapshot.timestamp_ms = get32();
+    for (auto &reading : snapshot.readings) {
+      reading = static_cast<int32_t>(get32());
+    }
+    snapshot.power_uW = static_cast<int32_t>(get32());
+    return snapshot;
+  }
+
+  /// Assembles the bytes received over the serial interface into frames.
+  ///    While a frame is waiting to be answered, further bytes are
+  /// discarded, like with the `Command_parser`. The master has to wait for
+  /// the response anyway.
+  class Receiver {
+    public:
+      /// To be called from the receive interrupt service routine.
+      void add_byte(const uint8_t byte) {
+        if (frame_ready_) {
+          overruns_ = static_cast<uint16_t>(overruns_ + 1U);
+          return;
+        }
+        if (length_ < buffer_.size()) {
+          buffer_[length_] = byte;
+          ++length_;
+        } else {
+          too_long_ = true;
+        }
+      }
+
+      /// To be called, when the line has been silent for 3.5 characters.
+      /// \return Whether a frame is ready to be answered.
+      bool end_frame() {
+        if (frame_ready_ || (length_ == 0)) {
+          return false;
+        }
+        if (too_long_) {
+          release();
+          return false;
+        }
+        frame_ready_ = true;
+        return true;
+      }
+
+      bool frame_ready() const { return frame_ready_; }
+
+      /// Only valid, while `frame_ready()`.
+      const uint8_t *frame() const { return buffer_.data(); }
+      Size length() const { return length_; }
+
+      /// Makes room for the next frame.
+      void release() {
+        length_ = 0;
+        too_long_ = false;
+        frame_ready_ = false;
+      }
+
+      /// \return The number of bytes, which were discarded, because the
+      ///    previous frame was still being answered.
+      uint16_t overruns() const { return overruns_; }
+
+    private:
+      Array<uint8_t, max_request_length> buffer_{};
+      Size length_{0};
+      bool too_long_{false};
+      volatile bool frame_ready_{false};
+      volatile uint16_t overruns_{0U};
+  };
+
+  namespace detail {
+
+    constexpr uint16_t get(const uint8_t *const data) {
+      return static_cast<uint16_t>((static_cast<unsigned>(data[0]) << 8U)
+                                   | data[1]);
+    }
+
+    constexpr void put(uint8_t *const data, const uint16_t value) {
+      data[0] = static_cast<uint8_t>(value >> 8U);
+      data[1] = static_cast<uint8_t>(value);
+    }
+
+    constexpr Size append_crc(uint8_t *const frame, const Size length) {
+      const auto crc = Crc16_modbus::compute(frame, length);
+      frame[length] = static_cast<uint8_t>(crc);
+      frame[length + 1] = static_cast<uint8_t>(crc >> 8U);
+      return length + 2;
+    }
+
+    /// Executes the protocol data unit of `request`, which is `length` bytes
+    /// long without the CRC, and puts the data of the response after its
+    /// function code.
+    template <class Registers_>
+    Exception execute(const uint8_t *const request, const Size length,
+                      Registers_ &registers, uint8_t *const response,
+                      Size &data_length) {
+      const auto function = static_cast<Function>(request[1]);
+      switch (function) {
+      case Function::ReadHoldingRegisters:
+      case Function::ReadInputRegisters: {
+        if (length != 6) {
+          return Exception::IllegalDataValue;
+        }
+        const auto first = get(request + 2);
+        const auto count = get(request + 4);
+        if ((count < 1) || (count > max_read_count)) {
+          return Exception::IllegalDataValue;
+        }
+        if (int32_t{first} + count > 0x1'0000) {
+          return Exception::IllegalDataAddress;
+        }
+        response[2] = static_cast<uint8_t>(2 * count);
+        for (auto i = 0; i < count; ++i) {
+          const auto address = static_cast<uint16_t>(first + i);
+          auto value = uint16_t{0U};
+          const auto exception =
+              (function == Function::ReadHoldingRegisters)
+                  ? registers.read_holding_register(address, value)
+                  : registers.read_input_register(address, value);
+          if (exception != Exception::None) {
+            return exception;
+          }
+          put(response + 3 + (2 * i), value);
+        }
+        data_length = 1 + (2 * count);
+        return Exception::None;
+      }
+      case Function::WriteSingleRegister:
+        if (length != 6) {
+          return Exception::IllegalDataValue;
+        }
+        std::copy_n(request + 2, 4, response + 2);
+        data_length = 4;
+        return registers.write_holding_register(get(request + 2),
+                                                get(request + 4));
+      case Function::WriteMultipleRegisters: {
+        if (length < 7) {
+          return Exception::IllegalDataValue;
+        }
+        const auto first = get(request + 2);
+        const auto count = get(request + 4);
+        if ((count < 1) || (count > max_write_count)
+            || (request[6] != 2 * count) || (length != 7 + (2 * count))) {
+          return Exception::IllegalDataValue;
+        }
+        if (int32_t{first} + count > 0x1'0000) {
+          return Exception::IllegalDataAddress;
+        }
+        for (auto i = 0; i < count; ++i) {
+          const auto exception = registers.write_holding_register(
+              static_cast<uint16_t>(first + i), get(request + 7 + (2 * i)));
+          if (exception != Exception::None) {
+            return exception;
+          }
+        }
+        std::copy_n(request + 2, 4, response + 2);
+        data_length = 4;
+        return Exception::None;
+      }
+      case Function::ReadSnapshot: {
+        if (length != 2) {
+          return Exception::IllegalDataValue;
+        }
+        auto snapshot = Snapshot{};
+        const auto exception = registers.read_snapshot(snapshot);
+        if (exception != Exception::None) {
+          return exception;
+        }
+        response[2] = uint8_t{snapshot_length};
+        encode(snapshot, response + 3);
+        data_length = 1 + snapshot_length;
+        return Exception::None;
+      }
+      case Function::Latch:
+        if (length != 4) {
+          return Exception::IllegalDataValue;
+        }
+        std::copy_n(request + 2, 2, response + 2);
+        data_length = 2;
+        return registers.latch(get(request + 2));
+      }
+      return Exception::IllegalFunction;
+    }
+
+  } // namespace detail
+
+  /// Executes a `request` to the slave with `address` on the `registers`,
+  /// which provide
+  ///
+  ///   Exception read_input_register(uint16_t address, uint16_t &value)
+  ///   Exception read_holding_register(uint16_t address, uint16_t &value)
+  ///   Exception write_holding_register(uint16_t address, uint16_t value)
+  ///   Exception read_snapshot(Snapshot &snapshot)
+  ///   Exception latch(uint16_t number)
+  ///
+  /// The registers of a request are accessed in ascending order, a write
+  /// stops at the first one, which fails.
+  /// \param response Room for `max_response_length` bytes.
+  /// \return The length of the response, 0 for none.
+  template <class Registers_>
+  Size respond(const uint8_t *const request, const Size length,
+               const uint8_t address, Registers_ &registers,
+               uint8_t *const response) {
+    // the CRC of a frame including its CRC is 0
+    if ((length < 4)
+        || (Crc16_modbus::compute(request, length) != 0U)
+        || ((request[0] != address) && (request[0] != broadcast_address))) {
+      return 0;
+    }
+    auto data_length = Size{0};
+    const auto exception = detail::execute(request, length - 2, registers,
+                                           response, data_length);
+    if (request[0] == broadcast_address) {
+      return 0;
+    }
+    response[0] = request[0];
+    response[1] = request[1];
+    if (exception != Exception::None) {
+      response[1] = static_cast<uint8_t>(request[1] | 0x80U);
+      response[2] = std::to_underlying(exception);
+      return detail::append_crc(response, 3);
+    }
+    return detail::append_crc(response, 2 + data_length);
+  }
+
+} // namespace meter::modbus
+
+#endif // MSPMETER_MODBUS_HPP
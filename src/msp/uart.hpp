@@ -3,49 +3,294 @@
 #ifndef MSPMETER_UART_HPP
 #define MSPMETER_UART_HPP
 
+#include "msp430.hpp"
 #include "msp430i2.hpp"
+#include "util/ring_buffer.hpp"
+
+#include <algorithm>
+#include <bit>
 
 namespace msp430 {
 
-  template <class Peripheral_> class UART {
+  /// The clock prescaler and modulation settings of the eUSCI_A in UART mode.
+  struct Baud_rate_settings {
+      uint16_t UCBRx;
+      uint8_t UCBRFx;
+      uint8_t UCBRSx;
+      bool UCOS16;
+  };
+
+  /// Fractional portions of `clock / baud rate` in units of 10^-4 and the
+  /// UCBRSx pattern to use from there on (family user's guide, table
+  /// "UCBRSx Settings for Fractional Portion of N").
+  constexpr auto ucbrs_table = Array<Array<uint16_t, 2>, 36>{
+      {{0, 0x00U},    {529, 0x01U},  {715, 0x02U},  {835, 0x04U},
+       {1001, 0x08U}, {1252, 0x10U}, {1430, 0x20U}, {1670, 0x11U},
+       {2147, 0x21U}, {2224, 0x22U}, {2503, 0x44U}, {3000, 0x25U},
+       {3335, 0x49U}, {3575, 0x4aU}, {3753, 0x52U}, {4003, 0x92U},
+       {4286, 0x53U}, {4378, 0x55U}, {5002, 0xaaU}, {5715, 0x6bU},
+       {6003, 0xadU}, {6254, 0xb5U}, {6432, 0xb6U}, {6667, 0xd6U},
+       {7001, 0xb7U}, {7147, 0xbbU}, {7503, 0xddU}, {7861, 0xedU},
+       {8004, 0xeeU}, {8333, 0xbfU}, {8464, 0xdfU}, {8572, 0xefU},
+       {8751, 0xf7U}, {9004, 0xfbU}, {9170, 0xfdU}, {9288, 0xfeU}}};
+
+  /// Computes the baud rate settings the way the family user's guide does.
+  constexpr Baud_rate_settings compute_baud_rate_settings(
+      const int32_t clock_Hz, const int32_t baud_rate) {
+    const auto divider = clock_Hz / baud_rate;
+    const auto fraction = static_cast<int32_t>(
+        ((int64_t{clock_Hz % baud_rate} * 10'000) + (baud_rate / 2))
+        / baud_rate);
+
+    auto ucbrs = uint8_t{0U};
+    for (const auto &entry : ucbrs_table) {
+      if (entry[0] <= fraction) {
+        ucbrs = static_cast<uint8_t>(entry[1]);
+      }
+    }
+
+    if (divider >= 16) {
+      return {.UCBRx = static_cast<uint16_t>(divider / 16),
+              .UCBRFx = static_cast<uint8_t>(
+                  (int64_t{clock_Hz % (16 * baud_rate)} * 16)
+                  / (16 * int64_t{baud_rate})),
+              .UCBRSx = ucbrs,
+              .UCOS16 = true};
+    }
+    return {.UCBRx = static_cast<uint16_t>(divider),
+            .UCBRFx = 0U,
+            .UCBRSx = ucbrs,
+            .UCOS16 = false};
+  }
+
+  /// The worst-case deviation of a bit edge within one character (start bit,
+  /// eight data bits, stop bit) from its ideal position in units of 10^-3 of
+  /// a bit period, when transmitting with `settings`.
+  constexpr int32_t
+  baud_rate_error_permille(const int32_t clock_Hz, const int32_t baud_rate,
+                           const Baud_rate_settings &settings) {
+    auto clock_cycles = int64_t{0};
+    auto max_error = int64_t{0};
+    for (auto bit = 0; bit < 10; ++bit) {
+      const auto modulation = (settings.UCBRSx >> (bit % 8)) & 1;
+      clock_cycles += settings.UCOS16
+                          ? ((16 * settings.UCBRx) + settings.UCBRFx
+                             + modulation)
+                          : (settings.UCBRx + modulation);
+      const auto error =
+          ((clock_cycles * baud_rate) - (int64_t{bit + 1} * clock_Hz)) * 1'000
+          / clock_Hz;
+      max_error = std::max(max_error, (error < 0) ? -error : error);
+    }
+    return static_cast<int32_t>(max_error);
+  }
+
+  /// A receiver samples each bit near its center, with an uncertainty of about
+  /// 1/16 bit. Edges, which are off by a few percent, are therefore safe.
+  constexpr auto max_baud_rate_error_permille = 50;
+
+  /// The range of baud rates, which `UART::configure()` accepts. From the
+  /// DCO, the highest one is off by 43/1000 of a bit at the last edge.
+  constexpr auto min_baud_rate = int32_t{9'600};
+  constexpr auto max_baud_rate = int32_t{921'600};
+  static_assert(baud_rate_error_permille(
+                    msp430i2::dco_frequency_Hz, max_baud_rate,
+                    compute_baud_rate_settings(msp430i2::dco_frequency_Hz,
+                                               max_baud_rate))
+                <= max_baud_rate_error_permille);
+
+  /// What to do with a record, which does not fit into the transmit queue.
+  enum class Overflow_policy {
+    /// drop queued records, which have not been started, oldest first
+    DropOldest,
+    /// drop the new record
+    DropNewest,
+    /// while the queue is more than half full, queue only every second record
+    Decimate
+  };
+
+  template <class Peripheral_, Size queue_length_ = 128> class UART {
     public:
-      /// Currently fixed for a baud rate of 9600 and using ACLK.
-      static void configure() {
+      /// Configures 8N1 at `baud_rate_` clocked from SMCLK, which runs at the
+      /// DCO frequency.
+      template <int32_t baud_rate_> static void configure() {
+        static_assert((baud_rate_ >= min_baud_rate)
+                      && (baud_rate_ <= max_baud_rate));
+        constexpr auto settings =
+            compute_baud_rate_settings(msp430i2::dco_frequency_Hz, baud_rate_);
+        static_assert(baud_rate_error_permille(msp430i2::dco_frequency_Hz,
+                                               baud_rate_, settings)
+                          <= max_baud_rate_error_permille,
+                      "the baud rate cannot be generated accurately enough");
+        configure(settings);
+      }
+
+      /// Configures 8N1 with precomputed `settings`, e.g. to switch the baud
+      /// rate at runtime. Only to be called while `idle()`.
+      static void configure(const Baud_rate_settings &settings) {
         Peripheral_::enable_reset();
-        Peripheral_::set_baud_rate_control(u16{3U});
-        Peripheral_::set_modulation_control(u16{0x92}, u16{0U}, false);
-        Peripheral_::set_control(b_or<u16>(msp430i2::UCSSEL::ACLK));
-        Peripheral_::set_interrupts(msp430i2::UCTXIE);
+        Peripheral_::set_baud_rate_control(u16{settings.UCBRx});
+        Peripheral_::set_modulation_control(u16{settings.UCBRSx},
+                                            u16{settings.UCBRFx},
+                                            settings.UCOS16);
+        Peripheral_::set_control(b_or<u16>(msp430i2::UCSSEL::SMCLK));
+        Peripheral_::set_interrupts(msp430i2::UCRXIE | msp430i2::UCTXIE);
+      }
+
+      constexpr Overflow_policy overflow_policy() const { return policy_; }
+      constexpr void set_overflow_policy(const Overflow_policy policy) {
+        policy_ = policy;
       }
 
+      /// Copies `data` into the transmit queue as one record, which is either
+      /// sent completely or dropped completely.
+      /// \return Whether the record was queued; it was dropped otherwise.
       bool transmit(const char *const data, const Size data_len) {
-        if ((data_len_ == 0) && (data_len > 0)) {
-          data_ = data + 1;
-          data_len_ = data_len;
-          Peripheral_::write_tx_buffer(static_cast<u8>(*data));
-          return true;
+        if (!make_room(data_len)) {
+          ++dropped_records_;
+          return false;
         }
-        return false;
+        enqueue(data, data_len);
+        start();
+        return true;
       }
 
-      /// To be called from the corresponding interrupt service routine.
-      bool on_tx_buffer_empty() { return transmit_next(); }
+      /// Like `transmit()`, but to be called from an interrupt service
+      /// routine, which the main loop must not interfere with by calling
+      /// `transmit()` meanwhile. The record is dropped, if it does not fit,
+      /// regardless of the overflow policy.
+      bool transmit_from_isr(const char *const data, const Size data_len) {
+        retire_sent_records();
+        if (!fits(data_len)) {
+          ++dropped_records_;
+          return false;
+        }
+        enqueue(data, data_len);
+        send_first();
+        return true;
+      }
 
-    private:
-      bool transmit_next() {
-        if (data_len_ > 1) {
-          const auto next_char = *data_;
-          data_ += 1;
-          data_len_ -= 1;
+      /// Whether the last queued byte has left the transmitter.
+      bool idle() const {
+        return queue_.empty() && !sending_ && !Peripheral_::busy();
+      }
+
+      /// The number of bytes waiting for transmission
+      Size queued_bytes() const { return queue_.size(); }
+      /// The maximum of `queued_bytes()` since reset
+      Size high_water_mark() const { return high_water_mark_; }
+      /// The number of records, which were dropped due to a full queue
+      uint16_t dropped_records() const { return dropped_records_; }
+
+      /// To be called from the corresponding interrupt service routine.
+      bool on_tx_buffer_empty() {
+        auto next_char = char{};
+        if (queue_.pop(next_char)) {
           Peripheral_::write_tx_buffer(static_cast<u8>(next_char));
           return true;
         }
-        data_len_ = 0;
+        sending_ = false;
         return false;
       }
 
-      const char *volatile data_{nullptr};
-      volatile Size data_len_{0};
+    private:
+      // the ring buffer takes a power of two and the length of a record,
+      // which may fill the queue, is kept in a byte
+      static_assert(std::has_single_bit(static_cast<unsigned>(queue_length_))
+                    && (queue_length_ <= 128));
+
+      /// Starts the transmission, if the interrupt service routine is idle and
+      /// thus is not going to pick up the queued bytes by itself.
+      void start() {
+        const auto critical_section = Critical_section{};
+        send_first();
+      }
+
+      void send_first() {
+        auto first_char = char{};
+        if (!sending_ && queue_.pop(first_char)) {
+          sending_ = true;
+          Peripheral_::write_tx_buffer(static_cast<u8>(first_char));
+        }
+      }
+
+      void enqueue(const char *const data, const Size data_len) {
+        for (auto i = Size{0}; i < data_len; ++i) {
+          queue_.push(data[i]);
+        }
+        record_lengths_.push(static_cast<uint8_t>(data_len));
+        queued_record_bytes_ += data_len;
+        high_water_mark_ = std::max(high_water_mark_, queue_.size());
+      }
+
+      /// Forgets the records, which have been sent completely.
+      /// \return The number of bytes already sent of the oldest record.
+      Size retire_sent_records() {
+        auto sent = queued_record_bytes_ - queue_.size();
+        while (!record_lengths_.empty() && (record_lengths_.peek(0) <= sent)) {
+          auto length = uint8_t{};
+          record_lengths_.pop(length);
+          sent -= length;
+          queued_record_bytes_ -= length;
+        }
+        return sent;
+      }
+
+      bool fits(const Size data_len) const {
+        return (queue_.capacity() - queue_.size() >= data_len)
+               && !record_lengths_.full();
+      }
+
+      bool make_room(const Size data_len) {
+        if ((data_len <= 0) || (data_len > queue_length_)) {
+          return false;
+        }
+        retire_sent_records();
+
+        switch (policy_) {
+        case Overflow_policy::DropNewest:
+          break;
+        case Overflow_policy::Decimate:
+          if (queue_.size() > (queue_length_ / 2)) {
+            skip_next_ = !skip_next_;
+            if (skip_next_) {
+              return false;
+            }
+          }
+          break;
+        case Overflow_policy::DropOldest: {
+          // the interrupt service routine must not pop meanwhile
+          const auto critical_section = Critical_section{};
+          const auto sent = retire_sent_records();
+          // a record, which is being sent, has to be completed
+          const auto first = (sent > 0) ? Size{1} : Size{0};
+          const auto offset =
+              (sent > 0) ? Size{record_lengths_.peek(0) - sent} : Size{0};
+          while (!fits(data_len) && (record_lengths_.size() > first)) {
+            const auto length = Size{record_lengths_.peek(first)};
+            queue_.erase(offset, length);
+            record_lengths_.erase(first, 1);
+            queued_record_bytes_ -= length;
+            ++dropped_records_;
+          }
+          break;
+        }
+        }
+        return fits(data_len);
+      }
+
+      meter::Ring_buffer<char, queue_length_> queue_{};
+      meter::Ring_buffer<uint8_t, 16> record_lengths_{};
+      /// the sum of `record_lengths_`, used to tell how far the oldest record
+      /// has been sent
+      Size queued_record_bytes_{0};
+      volatile bool sending_{false};
+
+      Overflow_policy policy_{Overflow_policy::DropOldest};
+      bool skip_next_{false};
+
+      Size high_water_mark_{0};
+      uint16_t dropped_records_{0U};
   };
 
 } // namespace msp430
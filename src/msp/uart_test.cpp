@@ -0,0 +1,232 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#include "uart.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
+
+#include <bit>
+#include <cmath>
+#include <string>
+#include <string_view>
+
+namespace msp430 {
+
+  namespace {
+
+    struct Table_row {
+        int32_t clock_Hz;
+        int32_t baud_rate;
+        Baud_rate_settings settings;
+    };
+
+    /// Records the bytes written to the transmit buffer.
+    struct Fake_uca {
+        static inline auto output = std::string{};
+
+        static void write_tx_buffer(const u8 byte_to_transmit) {
+          output.push_back(static_cast<char>(byte_to_transmit));
+        }
+
+        static bool busy() { return false; }
+    };
+
+    using Uart = UART<Fake_uca, 16>;
+
+    bool transmit(Uart &uart, const std::string_view record) {
+      return uart.transmit(record.data(), static_cast<Size>(record.size()));
+    }
+
+    /// Lets the transmitter finish the current character `count` times.
+    void drain(Uart &uart, const int count = 1'000) {
+      for (auto i = 0; (i < count) && uart.on_tx_buffer_empty(); ++i) {
+      }
+    }
+
+  } // namespace
+
+  static_assert(baud_rate_error_permille(
+                    msp430i2::dco_frequency_Hz, 460'800,
+                    compute_baud_rate_settings(msp430i2::dco_frequency_Hz,
+                                               460'800))
+                <= max_baud_rate_error_permille);
+
+  SCENARIO("baud rate settings for the eUSCI_A") {
+    GIVEN("the recommended settings from the family user's guide") {
+      const auto row = GENERATE(
+          Table_row{32'768, 9'600, {3, 0, 0x92, false}},
+          Table_row{1'000'000, 9'600, {6, 8, 0x20, true}},
+          Table_row{1'000'000, 19'200, {3, 4, 0x02, true}},
+          Table_row{1'000'000, 38'400, {1, 10, 0x00, true}},
+          Table_row{1'000'000, 115'200, {8, 0, 0xd6, false}},
+          Table_row{8'000'000, 115'200, {4, 5, 0x55, true}},
+          Table_row{16'000'000, 9'600, {104, 2, 0xd6, true}},
+          Table_row{16'000'000, 57'600, {17, 5, 0xdd, true}},
+          Table_row{16'000'000, 115'200, {8, 10, 0xf7, true}},
+          Table_row{16'000'000, 230'400, {4, 5, 0x55, true}},
+          Table_row{16'000'000, 460'800, {2, 2, 0xbb, true}});
+
+      THEN("the solver arrives at the same settings") {
+        const auto settings =
+            compute_baud_rate_settings(row.clock_Hz, row.baud_rate);
+        INFO(row.clock_Hz << " Hz / " << row.baud_rate << " Bd");
+        CHECK(settings.UCOS16 == row.settings.UCOS16);
+        CHECK(settings.UCBRx == row.settings.UCBRx);
+        CHECK(settings.UCBRFx == row.settings.UCBRFx);
+        CHECK(settings.UCBRSx == row.settings.UCBRSx);
+      }
+    }
+
+    GIVEN("the DCO as clock source") {
+      const auto baud_rate =
+          GENERATE(9'600, 19'200, 38'400, 57'600, 115'200, 230'400, 460'800,
+                   921'600);
+      const auto settings =
+          compute_baud_rate_settings(msp430i2::dco_frequency_Hz, baud_rate);
+
+      THEN("the average bit period matches the baud rate") {
+        const auto bit_period =
+            settings.UCOS16 ? ((16.0 * settings.UCBRx) + settings.UCBRFx)
+                            : static_cast<double>(settings.UCBRx);
+        const auto modulation = std::popcount(settings.UCBRSx) / 8.0;
+        const auto actual_rate =
+            msp430i2::dco_frequency_Hz / (bit_period + modulation);
+        CHECK(std::abs(actual_rate - baud_rate) / baud_rate < 0.005);
+      }
+
+      THEN("all supported rates are accurate enough") {
+        CHECK(baud_rate_error_permille(msp430i2::dco_frequency_Hz, baud_rate,
+                                       settings)
+              <= max_baud_rate_error_permille);
+      }
+    }
+
+    GIVEN("ACLK as clock source") {
+      THEN("high baud rates are rejected") {
+        constexpr auto aclk_Hz = msp430i2::dco_frequency_Hz / 500;
+        CHECK(baud_rate_error_permille(
+                  aclk_Hz, 115'200,
+                  compute_baud_rate_settings(aclk_Hz, 115'200))
+              > max_baud_rate_error_permille);
+      }
+    }
+  }
+
+  SCENARIO("queued UART transmission") {
+    Fake_uca::output.clear();
+    auto uart = Uart{};
+
+    GIVEN("an idle transmitter") {
+      WHEN("records are queued") {
+        REQUIRE(transmit(uart, "abc\n"));
+        REQUIRE(transmit(uart, "de\n"));
+
+        THEN("the first byte is sent right away") {
+          CHECK(Fake_uca::output == "a");
+          CHECK(uart.queued_bytes() == 6);
+          CHECK(uart.high_water_mark() == 6);
+        }
+
+        THEN("the interrupt service routine sends the rest in order") {
+          drain(uart);
+          CHECK(Fake_uca::output == "abc\nde\n");
+          CHECK(uart.queued_bytes() == 0);
+          CHECK(uart.dropped_records() == 0);
+        }
+
+        THEN("a record is started, once the transmitter became idle") {
+          drain(uart);
+          REQUIRE(transmit(uart, "f\n"));
+          drain(uart);
+          CHECK(Fake_uca::output == "abc\nde\nf\n");
+        }
+      }
+    }
+
+    GIVEN("a queue, which is full with the first record in transmission") {
+      REQUIRE(transmit(uart, "0000\n"));
+      REQUIRE(transmit(uart, "1111\n"));
+      REQUIRE(transmit(uart, "2222\n"));
+      drain(uart, 2);
+      REQUIRE(Fake_uca::output == "000");
+
+      WHEN("dropping the oldest records") {
+        uart.set_overflow_policy(Overflow_policy::DropOldest);
+        REQUIRE(transmit(uart, "33333\n"));
+        drain(uart);
+
+        THEN("the current record is completed, the next one is dropped") {
+          CHECK(Fake_uca::output == "0000\n2222\n33333\n");
+          CHECK(uart.dropped_records() == 1);
+          CHECK(uart.high_water_mark() == 14);
+        }
+      }
+
+      WHEN("queuing from an interrupt service routine") {
+        uart.set_overflow_policy(Overflow_policy::DropOldest);
+        CHECK_FALSE(uart.transmit_from_isr("33333\n", 6));
+        drain(uart, 2);
+        CHECK(uart.transmit_from_isr("4\n", 2));
+        drain(uart);
+
+        THEN("the new record is dropped regardless of the policy") {
+          CHECK(Fake_uca::output == "0000\n1111\n2222\n4\n");
+          CHECK(uart.dropped_records() == 1);
+          CHECK(uart.idle());
+        }
+      }
+
+      WHEN("dropping the newest record") {
+        uart.set_overflow_policy(Overflow_policy::DropNewest);
+        REQUIRE_FALSE(transmit(uart, "33333\n"));
+        drain(uart);
+
+        THEN("the queued records are sent") {
+          CHECK(Fake_uca::output == "0000\n1111\n2222\n");
+          CHECK(uart.dropped_records() == 1);
+        }
+      }
+
+      WHEN("decimating") {
+        uart.set_overflow_policy(Overflow_policy::Decimate);
+        CHECK_FALSE(transmit(uart, "3\n"));
+        CHECK(transmit(uart, "4\n"));
+        CHECK_FALSE(transmit(uart, "5\n"));
+        drain(uart);
+        CHECK(transmit(uart, "6\n"));
+        CHECK(transmit(uart, "7\n"));
+        drain(uart);
+
+        THEN("only every second record is queued until the queue drained") {
+          CHECK(Fake_uca::output == "0000\n1111\n2222\n4\n6\n7\n");
+          CHECK(uart.dropped_records() == 2);
+        }
+      }
+    }
+
+    GIVEN("a record, which fills the queue") {
+      REQUIRE(transmit(uart, "0123456789abcde\n"));
+      // but for the first byte, which is being sent
+      CHECK(uart.queued_bytes() == 15);
+
+      THEN("the records after it are accounted for") {
+        drain(uart, 2);
+        uart.set_overflow_policy(Overflow_policy::DropNewest);
+        CHECK(transmit(uart, "f\n"));
+        drain(uart);
+        CHECK(Fake_uca::output == "0123456789abcde\nf\n");
+        CHECK(uart.queued_bytes() == 0);
+        CHECK(uart.dropped_records() == 0);
+      }
+    }
+
+    GIVEN("a record larger than the queue") {
+      THEN("it is dropped with every policy") {
+        CHECK_FALSE(transmit(uart, "0123456789abcdefg"));
+        CHECK(uart.dropped_records() == 1);
+        CHECK(Fake_uca::output.empty());
+      }
+    }
+  }
+
+} // namespace msp430
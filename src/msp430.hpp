@@ -3,8 +3,22 @@
 #ifndef MSP430_HPP_
 #define MSP430_HPP_
 
+#include "future.hpp"
+
 #include <cstdint>
 
+#ifdef __MSP430__
+#define MSP430_INTERRUPT gnu::interrupt
+#define MSP430_STATIC
+#define MSP430_CALIBRATION_DATA gnu::section(".calibration_data")
+#else
+#define MSP430_INTERRUPT
+/// the static data of the firmware, which `host::Simulator::restart()`
+/// restores to its initial values
+#define MSP430_STATIC gnu::section("firmware_static")
+#define MSP430_CALIBRATION_DATA MSP430_STATIC
+#endif
+
 namespace msp430 {
 
   enum class SR : uint16_t {
@@ -31,8 +45,13 @@ namespace msp430 {
     return static_cast<SR>(std::to_underlying(lhs) | std::to_underlying(rhs));
   }
 
+#ifdef __MSP430__
   inline void enable_interrupts() { asm volatile("eint"); }
   inline void disable_interrupts() { asm volatile("dint { nop"); }
+#else
+  inline void enable_interrupts() { host::enable_interrupts(); }
+  inline void disable_interrupts() { host::disable_interrupts(); }
+#endif
 
   class Critical_section {
     public:
@@ -46,10 +65,18 @@ namespace msp430 {
       Critical_section &operator=(Critical_section &&) = default;
   };
 
+#ifdef __MSP430__
   [[gnu::always_inline]] inline void go_to_sleep() {
     asm volatile("nop { bis %0, SR { nop" : : "ri"(SR::CPUOFF));
   }
 
+  /// To be used in the body of busy waiting loops.
+  [[gnu::always_inline]] inline void no_operation() { asm volatile("nop"); }
+#else
+  inline void go_to_sleep() { host::sleep(); }
+  inline void no_operation() { host::spin(); }
+#endif
+
   [[gnu::always_inline]] inline void stay_awake() {
     __bic_SR_register_on_exit(std::to_underlying(SR::CPUOFF));
   }
@@ -90,7 +117,9 @@ namespace msp430 {
     SMCLK = 2U,
     Inverted_TAxCLK = 3U
   };
+  constexpr auto TACLR = u16{0x0004U};
   constexpr auto CCIE = u16{0x0010U};
+  constexpr auto CCIFG = u16{0x0001U};
 
   class Timer_TA0 {
     public:
@@ -105,13 +134,24 @@ namespace msp430 {
 
       static void enable_interrupt() { set_bits(ta0cctl0_, CCIE); }
 
-      void stop() { store(ta0ctl_, load(ta0ctl_) & ~(u16{3U} << 4U)); }
+      static void stop() {
+        store(ta0ctl_, load(ta0ctl_) & ~(u16{3U} << 4U));
+      }
 
       static void start_up(const u16 top) {
         store(ta0ccr0_, top);
         store(ta0ctl_, (load(ta0ctl_) & ~(u16{3U} << 4U)) | (u16{1U} << 4U));
       }
 
+      /// Counts up to `top` from zero again, e.g. to measure a timeout since
+      /// the last event, and discards an interrupt, which is still pending.
+      static void restart_up(const u16 top) {
+        store(ta0ccr0_, top);
+        clear_bits(ta0cctl0_, CCIFG);
+        store(ta0ctl_,
+              (load(ta0ctl_) & ~(u16{3U} << 4U)) | (u16{1U} << 4U) | TACLR);
+      }
+
       void start_continuous() {
         store(ta0ctl_, (load(ta0ctl_) & ~(u16{3U} << 4U)) | (u16{2U} << 4U));
       }
@@ -31,6 +31,7 @@ namespace msp430i2 {
     return true;
   }
 
+#ifdef __MSP430__
   extern "C" [[noreturn, gnu::naked]] void on_reset() {
     // init stack pointer
     extern const uint16_t _stack;
@@ -72,5 +73,6 @@ namespace msp430i2 {
 
     asm volatile("call #main");
   }
+#endif
 
 } // namespace msp430i2
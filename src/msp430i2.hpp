@@ -235,9 +235,11 @@ namespace msp430i2 {
   constexpr auto UCA0CTLW0 = Register<u16>{0x0140};
   constexpr auto UCA0BRW = Register<u16>{0x0146};
   constexpr auto UCA0MCTLW = Register<u16>{0x0148};
+  constexpr auto UCA0STATW = Register<u16>{0x014a};
   constexpr auto UCA0RXBUF = Register<const u16>{0x014c};
   constexpr auto UCA0TXBUF = Register<u16>{0x014e};
 
+  constexpr auto UCRXIE = u16{0x0001U};
   constexpr auto UCTXIE = u16{0x0002U};
   constexpr auto UCTXIFG = u16{0x0002U};
 
@@ -276,6 +278,7 @@ namespace msp430i2 {
   class UCA0 {
     public:
       static auto interrupt_vector() { return load(UCA0IV); }
+      static bool busy() { return (load(UCA0STATW) & UCBUSY) != u16{0U}; }
 
       static void enable_reset() { clear_bits(UCA0CTLW0, UCSWRST); }
 
@@ -320,6 +323,11 @@ namespace msp430i2 {
       }
   };
 
+  constexpr auto SD24XOSR = u16{0x0800U};
+  constexpr auto SD24OSR_256 = u16{0x0000U};
+  constexpr auto SD24OSR_128 = u16{0x0100U};
+  constexpr auto SD24OSR_64 = u16{0x0200U};
+  constexpr auto SD24OSR_32 = u16{0x0300U};
   constexpr auto SD24LSBTOG = u16{0x0080U};
   constexpr auto SD24OVIFG = u16{0x0020U};
   constexpr auto SD24DF = u16{0x0010U};
@@ -349,6 +357,8 @@ namespace msp430i2 {
       {{0x102}, {0x104}, {0x106}, {0x108}}};
   constexpr auto SD24MEMx = Array<Register<u16>, 4>{
       {{0x110}, {0x112}, {0x114}, {0x116}}};
+  constexpr auto SD24INCTLx = Array<Register<u8>, 4>{
+      {{0xb0}, {0xb1}, {0xb2}, {0xb3}}};
 
   class SD24 {
     public:
@@ -367,6 +377,30 @@ namespace msp430i2 {
         clear_bits(SD24CCTLx[channel], SD24SC);
       }
 
+      /// \return The SD24OSRx and SD24XOSR bits of SD24CCTLx for the given
+      ///    oversampling ratio.
+      static constexpr u16 oversampling_ratio_bits(const int ratio) {
+        switch (ratio) {
+        case 32:
+          return SD24OSR_32;
+        case 64:
+          return SD24OSR_64;
+        case 128:
+          return SD24OSR_128;
+        case 512:
+          return SD24XOSR | SD24OSR_256;
+        case 1'024:
+          return SD24XOSR | SD24OSR_128;
+        default:
+          return SD24OSR_256;
+        }
+      }
+
+      /// Sets the PGA gain of `channel` to 2^`gain_bits`, i.e. 1 to 16.
+      static void set_gain(const int channel, const u8 gain_bits) {
+        store(SD24INCTLx[channel], gain_bits);
+      }
+
       static constexpr auto full_scale = 0x7f'ffff;
       static constexpr auto negative_full_scale = -full_scale - 1;
       static constexpr auto reference_uV = int32_t{msp430i2::shared_ref_mV}
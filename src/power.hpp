@@ -0,0 +1,121 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#ifndef MSPMETER_POWER_HPP
+#define MSPMETER_POWER_HPP
+
+#include "calibration.hpp"
+#include "config.hpp"
+#include "future.hpp"
+
+#include <algorithm>
+
+namespace meter {
+
+  /// Scales `value` like `apply()`, but without the offset and for values
+  /// wider than a conversion result, e.g. the product of two of them. The
+  /// 96-bit intermediate product is formed from two 64-bit partial products,
+  /// only the result must fit into 64 bits.
+  constexpr int64_t scale_wide(const int64_t value,
+                               const Channel_scale &scale) {
+    const auto negative = (value < 0) != (scale.multiplier < 0);
+    const auto magnitude = static_cast<uint64_t>((value < 0) ? -value : value);
+    const auto multiplier = static_cast<uint64_t>(
+        (scale.multiplier < 0) ? -int64_t{scale.multiplier} : scale.multiplier);
+    const auto shift = static_cast<unsigned>(scale.shift);
+
+    const auto high = (magnitude >> 32U) * multiplier;
+    auto low = (magnitude & 0xffff'ffffU) * multiplier;
+    if (shift > 0U) {
+      low = (low + (uint64_t{1U} << (shift - 1U))) >> shift;
+    }
+    const auto result = static_cast<int64_t>((high << (32U - shift)) + low);
+    return negative ? -result : result;
+  }
+  static_assert(scale_wide(int64_t{0x7f'ffff} * 0x7f'ffff, {0, 1 << 30, 30})
+                == int64_t{0x7f'ffff} * 0x7f'ffff);
+  static_assert(scale_wide(-(int64_t{1} << 40), {0, 3, 1}) == -3 * (1LL << 39));
+  static_assert(scale_wide(5, {0, -1, 1}) == -3);
+
+  /// The mean product of the offset-corrected samples of two channels, from
+  /// the mean product of the raw samples and their means.
+  constexpr int64_t mean_product(const int64_t raw_mean_product,
+                                 const int32_t mean_a, const int32_t offset_a,
+                                 const int32_t mean_b,
+                                 const int32_t offset_b) {
+    return raw_mean_product - (int64_t{offset_b} * mean_a)
+           - (int64_t{offset_a} * mean_b) + (int64_t{offset_a} * offset_b);
+  }
+  static_assert(mean_product(6, 2, 0, 3, 0) == 6);
+  static_assert(mean_product((12 * 13), 12, 2, 13, 3) == 10 * 10);
+
+  /// \return The power in uW of the `mean_product` of the voltage channel
+  ///    (calibrated in uV) and the current channel (calibrated in uA).
+  constexpr int32_t power_uW(const int64_t mean_product,
+                             const Channel_scale &voltage,
+                             const Channel_scale &current) {
+    const auto power_pW =
+        scale_wide(scale_wide(mean_product, voltage), current);
+    // round to nearest
+    return static_cast<int32_t>(
+        (power_pW + ((power_pW < 0) ? -500'000 : 500'000)) / 1'000'000);
+  }
+
+  /// \return The apparent power in uVA of the true RMS values of the voltage
+  ///    and the current channel, both in counts around the offsets.
+  constexpr int32_t apparent_power_uVA(const uint32_t voltage_rms,
+                                       const uint32_t current_rms,
+                                       const Channel_scale &voltage,
+                                       const Channel_scale &current) {
+    const auto power = power_uW(
+        static_cast<int64_t>(uint64_t{voltage_rms} * current_rms), voltage,
+        current);
+    return (power < 0) ? -power : power;
+  }
+
+  /// \return The power factor in thousandths, negative, if power flows back,
+  ///    and 0 without any apparent power.
+  constexpr int16_t power_factor_permille(const int32_t real_power,
+                                          const int32_t apparent_power) {
+    if (apparent_power <= 0) {
+      return 0;
+    }
+    const auto numerator = int64_t{real_power} * 1'000;
+    const auto rounding = (numerator < 0) ? -(apparent_power / 2)
+                                          : (apparent_power / 2);
+    return static_cast<int16_t>(std::clamp<int64_t>(
+        (numerator + rounding) / apparent_power, -1'000, 1'000));
+  }
+  static_assert(power_factor_permille(500, 1'000) == 500);
+  static_assert(power_factor_permille(-2, 3) == -667);
+  static_assert(power_factor_permille(1'001, 1'000) == 1'000);
+  static_assert(power_factor_permille(1, 0) == 0);
+
+  /// Integrates the power and the current over time. Both are summed up per
+  /// sampling period, which lasts for about two years at 30 W.
+  class Energy_counter {
+    public:
+      void add(const int32_t power_uW, const int32_t current_uA,
+               const int32_t number_of_samples) {
+        energy_ += int64_t{power_uW} * number_of_samples;
+        charge_ += int64_t{current_uA} * number_of_samples;
+      }
+
+      void reset() {
+        energy_ = 0;
+        charge_ = 0;
+      }
+
+      int64_t energy_uWh() const { return energy_ / samples_per_hour; }
+      int64_t charge_uAh() const { return charge_ / samples_per_hour; }
+
+    private:
+      static constexpr auto samples_per_hour =
+          int64_t{sampling_frequency_Hz} * 3'600;
+
+      int64_t energy_{0};
+      int64_t charge_{0};
+  };
+
+} // namespace meter
+
+#endif // MSPMETER_POWER_HPP
@@ -6,6 +6,7 @@
 #include "future.hpp"
 #include "msp/spi.hpp"
 #include "util.hpp"
+#include "util/7segment.hpp"
 
 namespace meter {
 
@@ -13,16 +14,28 @@ namespace meter {
     public:
       bool idle() const { return idle_; }
 
-      void update(const Array<char, 6> &upper, const Array<char, 6> &lower) {
-        to_7segment(slice<0, 4>(display_buffer_), upper);
-        to_7segment(slice<4, 4>(display_buffer_), lower);
+      /// Shifts the segments out to the display, unless they are displayed
+      /// already or the previous update is still being shifted out.
+      /// \return Whether the display is being updated.
+      bool update(const Array<u8, 8> &segments) {
+        if (!idle_) {
+          return false;
+        }
+        if (valid_ && (segments == display_buffer_)) {
+          return false;
+        }
+        display_buffer_ = segments;
+        valid_ = true;
         idle_ = !spi_.transmit(display_buffer_.data(), display_buffer_.size());
+        return !idle_;
       }
 
       void on_tx_buffer_empty() { idle_ = !spi_.transmit_next(); }
 
     private:
+      /// what is shown on the display, once `valid_`
       Array<u8, 8> display_buffer_{};
+      bool valid_{false};
       msp430::SPI<msp430i2::UCB0> spi_{};
 
       volatile bool idle_{true};
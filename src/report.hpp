@@ -0,0 +1,96 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#ifndef MSPMETER_REPORT_HPP
+#define MSPMETER_REPORT_HPP
+
+#include "config.hpp"
+#include "future.hpp"
+
+namespace meter {
+
+  /// Keeps the time since the start of the acquisition in milliseconds,
+  /// counted in samples, so it runs exactly as fast as the readings. It wraps
+  /// around after about 49 days.
+  class Sample_clock {
+    public:
+      static constexpr auto samples_per_ms =
+          static_cast<int32_t>(sampling_frequency_Hz / 1'000);
+      static_assert(samples_per_ms * 1'000 == sampling_frequency_Hz);
+
+      void advance(const int32_t number_of_samples) {
+        samples_ += number_of_samples;
+        ms_ += static_cast<uint32_t>(samples_ / samples_per_ms);
+        samples_ %= samples_per_ms;
+      }
+
+      uint32_t ms() const { return ms_; }
+
+    private:
+      uint32_t ms_{0U};
+      int32_t samples_{0};
+  };
+
+  /// Selects the channels of a reading, which are worth reporting, when only
+  /// changes are reported: those, which moved by more than their deadband
+  /// since they were reported last. All channels are reported with the first
+  /// reading and whenever the heartbeat interval passed since they were all
+  /// reported last, so the receiver can tell a constant value from a dead
+  /// meter.
+  class Exception_filter {
+    public:
+      int32_t deadband(const int channel) const { return deadbands_[channel]; }
+      bool set_deadband(const int channel, const int32_t deadband) {
+        if (deadband < 0) {
+          return false;
+        }
+        deadbands_[channel] = deadband;
+        return true;
+      }
+
+      /// 0 for no heartbeat
+      uint32_t heartbeat_ms() const { return heartbeat_ms_; }
+      void set_heartbeat_ms(const uint32_t interval) {
+        heartbeat_ms_ = interval;
+      }
+
+      /// Reports all channels with the next reading.
+      void restart() { complete_ = false; }
+
+      /// Takes the selected channels as reported.
+      /// \return The mask of the channels in `channel_mask` to report of the
+      ///    calibrated `values`.
+      uint8_t select(const Array<int32_t, used_channels> &values,
+                     const uint8_t channel_mask, const uint32_t now_ms) {
+        const auto all = !complete_
+                         || ((heartbeat_ms_ > 0U)
+                             && (now_ms - last_complete_ms_ >= heartbeat_ms_));
+        auto selected = uint8_t{0U};
+        for (auto i = 0; i < used_channels; ++i) {
+          const auto bit = static_cast<uint8_t>(1U << static_cast<unsigned>(i));
+          if ((channel_mask & bit) == 0U) {
+            continue;
+          }
+          const auto change = int64_t{values[i]} - reported_[i];
+          if (all || (change > deadbands_[i]) || (change < -deadbands_[i])) {
+            reported_[i] = values[i];
+            selected |= bit;
+          }
+        }
+        if (all) {
+          complete_ = true;
+          last_complete_ms_ = now_ms;
+        }
+        return selected;
+      }
+
+    private:
+      Array<int32_t, used_channels> deadbands_{};
+      Array<int32_t, used_channels> reported_{};
+      uint32_t heartbeat_ms_{0U};
+      uint32_t last_complete_ms_{0U};
+      bool complete_{false};
+  };
+
+} // namespace meter
+
+#endif // MSPMETER_REPORT_HPP
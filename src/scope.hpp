@@ -0,0 +1,158 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#ifndef MSPMETER_SCOPE_HPP
+#define MSPMETER_SCOPE_HPP
+
+#include "config.hpp"
+#include "future.hpp"
+
+#include <bit>
+#include <limits>
+
+namespace meter {
+
+  enum class Trigger : uint8_t {
+    /// the sample reaches the level from below
+    Rising,
+    /// the sample reaches the level from above
+    Falling,
+    /// the sample is above the level
+    Above,
+    /// the sample is below the level
+    Below
+  };
+
+  /// Captures the raw samples of the selected channels around a trigger, so
+  /// that transients like inrush currents can be inspected, which do not show
+  /// in the averaged readings.
+  ///    The samples are packed as 24-bit little-endian values, frame by frame
+  /// and within a frame in the order of the channels, into a ring buffer of
+  /// `capture_buffer_size` bytes. The trigger is only accepted after the
+  /// pre-trigger frames have been recorded.
+  class Scope {
+    public:
+      enum class State : uint8_t { Idle, Armed, Triggered, Done };
+
+      static constexpr auto sample_size = 3;
+
+      /// \return The number of frames of the channels in `channel_mask`,
+      ///    which fit into the buffer.
+      static constexpr Size depth(const uint8_t channel_mask) {
+        const auto channels = std::popcount(channel_mask);
+        return (channels == 0) ? 0
+                               : capture_buffer_size / (sample_size * channels);
+      }
+
+      /// Starts a new capture of `pre` frames before and `post` frames from
+      /// the trigger on, which is evaluated on `channel`.
+      /// \return Whether the frames fit into the buffer.
+      bool arm(const int channel, const Trigger trigger, const int32_t level,
+               const uint8_t channel_mask, const Size pre, const Size post) {
+        if ((post < 1) || (pre < 0) || (pre + post > depth(channel_mask))) {
+          return false;
+        }
+        channel_ = channel;
+        trigger_ = trigger;
+        level_ = level;
+        channel_mask_ = channel_mask;
+        pre_ = pre;
+        remaining_ = post;
+        used_size_ =
+            (pre + post) * sample_size * std::popcount(channel_mask);
+        write_ = 0;
+        recorded_ = 0;
+        // an edge needs a sample on the other side of the level first
+        previous_ = (trigger == Trigger::Rising)
+                        ? std::numeric_limits<int32_t>::max()
+                        : std::numeric_limits<int32_t>::min();
+        state_ = State::Armed;
+        return true;
+      }
+
+      void stop() { state_ = State::Idle; }
+
+      State state() const { return state_; }
+
+      /// The mask of the channels in the capture.
+      uint8_t channel_mask() const { return channel_mask_; }
+
+      /// The number of bytes of a complete capture, 0 before.
+      Size length() const { return (state_ == State::Done) ? used_size_ : 0; }
+
+      /// \return Byte `index` of the capture, oldest first.
+      uint8_t byte(const Size index) const {
+        // the next frame would have overwritten the oldest one
+        auto position = write_ + index;
+        if (position >= used_size_) {
+          position -= used_size_;
+        }
+        return buffer_[position];
+      }
+
+      /// To be called with every frame of raw samples.
+      void add(const Array<int32_t, used_channels> &frame) {
+        if ((state_ == State::Idle) || (state_ == State::Done)) {
+          return;
+        }
+        for (auto i = 0; i < used_channels; ++i) {
+          if ((channel_mask_ & (1U << static_cast<unsigned>(i))) == 0U) {
+            continue;
+          }
+          const auto sample = static_cast<uint32_t>(frame[i]);
+          buffer_[write_] = static_cast<uint8_t>(sample);
+          buffer_[write_ + 1] = static_cast<uint8_t>(sample >> 8U);
+          buffer_[write_ + 2] = static_cast<uint8_t>(sample >> 16U);
+          write_ += sample_size;
+        }
+        if (write_ >= used_size_) {
+          write_ = 0;
+        }
+
+        if (state_ == State::Armed) {
+          const auto sample = frame[channel_];
+          if (recorded_ < pre_) {
+            ++recorded_;
+          } else if (triggered(sample)) {
+            state_ = State::Triggered;
+          }
+          previous_ = sample;
+        }
+        if ((state_ == State::Triggered) && (--remaining_ == 0)) {
+          state_ = State::Done;
+        }
+      }
+
+    private:
+      bool triggered(const int32_t sample) const {
+        switch (trigger_) {
+        case Trigger::Rising:
+          return (previous_ < level_) && (sample >= level_);
+        case Trigger::Falling:
+          return (previous_ > level_) && (sample <= level_);
+        case Trigger::Above:
+          return sample > level_;
+        case Trigger::Below:
+          return sample < level_;
+        }
+        return false;
+      }
+
+      Array<uint8_t, capture_buffer_size> buffer_{};
+      Size write_{0};
+      Size used_size_{0};
+      Size pre_{0};
+      Size recorded_{0};
+      Size remaining_{0};
+      int32_t level_{0};
+      int32_t previous_{0};
+      int channel_{0};
+      Trigger trigger_{Trigger::Rising};
+      uint8_t channel_mask_{0U};
+      State state_{State::Idle};
+  };
+  static_assert(Scope::depth(0b0001U) == capture_buffer_size / 3);
+  static_assert(Scope::depth(0b1111U) == capture_buffer_size / 12);
+
+} // namespace meter
+
+#endif // MSPMETER_SCOPE_HPP
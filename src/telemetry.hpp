@@ -0,0 +1,282 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#ifndef MSPMETER_TELEMETRY_HPP
+#define MSPMETER_TELEMETRY_HPP
+
+#include "calibration.hpp"
+#include "config.hpp"
+#include "future.hpp"
+#include "util/cobs.hpp"
+#include "util/crc16.hpp"
+#include "util/varint.hpp"
+
+/// Binary telemetry frames, the compact alternative to the tab-separated text
+/// lines.
+///    Every frame is `type, sequence number, payload, CRC-16` with all
+/// multi-byte fields in little-endian byte order. The CRC (CCITT-FALSE) covers
+/// everything before it. The frame is COBS-encoded and terminated by a zero
+/// byte, so a receiver can resynchronize at any zero byte. The sequence number
+/// is incremented with every frame, so the receiver can detect lost frames.
+///
+///   Reading:     the averaged conversion result of every enabled channel as a
+///                signed 24-bit value, i.e. 18 bytes on the wire for four
+///                channels
+///   Samples:     the raw conversion results of the streamed channels, like a
+///                reading, but of a single conversion, see `stream` in
+///                meter.cpp
+///   Change:      the time of the reading in ms (uint32), the mask of the
+///                reported channels (uint8) and their averaged conversion
+///                results like a reading, when only changes are reported,
+///                see `Exception_filter`
+///   Batch:       the mask of the channels (uint8), followed by up to
+///                `max_batch_length` consecutive readings of them; every value
+///                is the difference to the same channel of the previous
+///                reading in the frame (to 0 for the first one), zigzag- and
+///                varint-encoded, see varint.hpp
+///   Calibration: offset (int32), multiplier (int32) and shift (uint8) of every
+///                channel, see `Channel_scale`, followed by the mask of
+///                enabled channels (uint8); sent whenever the calibration or
+///                the channel mask changes and with every sequence number 0
+///
+/// The receiver scales a reading with `apply()` using the latest calibration.
+namespace meter::telemetry {
+
+  enum class Frame_type : uint8_t {
+    Reading = 0x01U,
+    Calibration = 0x02U,
+    Samples = 0x03U,
+    Change = 0x04U,
+    Batch = 0x05U
+  };
+
+  constexpr auto reading_value_size = 3;
+  constexpr auto max_payload_length = 2 + (used_channels * 9) + 1 + 2;
+  constexpr auto max_frame_length = cobs_max_encoded_length(max_payload_length)
+                                    + 1;
+  constexpr auto max_reading_frame_length =
+      cobs_max_encoded_length(2 + (used_channels * reading_value_size) + 2) + 1;
+
+  /// The maximum number of readings in a batch and the room for their
+  /// values, which limits the number further, if the values change a lot.
+  constexpr auto max_batch_length = 16;
+  constexpr auto max_batch_data_length = 72;
+  constexpr auto max_batch_frame_length =
+      cobs_max_encoded_length(2 + 1 + max_batch_data_length + 2) + 1;
+
+  template <Size capacity_ = max_payload_length> class Frame {
+    public:
+      constexpr Frame(const Frame_type type, const uint8_t sequence_number) {
+        put(std::to_underlying(type), 1);
+        put(sequence_number, 1);
+      }
+
+      /// Appends the lower `size` bytes of `value` in little-endian order.
+      constexpr void put(const int32_t value, const int size) {
+        for (auto i = 0; i < size; ++i) {
+          payload_[length_] = static_cast<uint8_t>(
+              static_cast<uint32_t>(value) >> (8U * static_cast<unsigned>(i)));
+          ++length_;
+        }
+      }
+
+      /// Appends the CRC, encodes the frame and appends the delimiter.
+      /// \return The number of bytes written to `destination`, which must hold
+      ///    at least `max_frame_length` bytes.
+      constexpr Size finish(uint8_t *const destination) {
+        put(Crc16_ccitt::compute(payload_.data(), length_), 2);
+        const auto length = cobs_encode(payload_.data(), length_, destination);
+        destination[length] = 0U;
+        return length + 1;
+      }
+
+    private:
+      Array<uint8_t, capacity_> payload_{};
+      Size length_{0};
+  };
+
+  /// Collects consecutive readings into a batch frame.
+  class Batch {
+    public:
+      /// \return Whether the reading was added; otherwise the batch is full
+      ///    or holds other channels and has to be sent first.
+      constexpr bool
+      add(const Array<int32_t, used_channels> &conversion_results,
+          const uint8_t channel_mask) {
+        if (readings_ == 0) {
+          channel_mask_ = channel_mask;
+          previous_ = {};
+        }
+        if ((channel_mask != channel_mask_)
+            || (readings_ >= max_batch_length)) {
+          return false;
+        }
+        auto values = Array<uint8_t, used_channels * varint_max_length>{};
+        auto length = Size{0};
+        for (auto i = 0; i < used_channels; ++i) {
+          if ((channel_mask & (1U << static_cast<unsigned>(i))) != 0U) {
+            length += varint_encode(
+                zigzag_encode(conversion_results[i] - previous_[i]),
+                values.data() + length);
+          }
+        }
+        if (length_ + length > max_batch_data_length) {
+          return false;
+        }
+        for (auto i = 0; i < length; ++i) {
+          data_[length_ + i] = values[i];
+        }
+        length_ += length;
+        previous_ = conversion_results;
+        ++readings_;
+        return true;
+      }
+
+      constexpr Size readings() const { return readings_; }
+
+      /// Encodes the frame and starts the next batch.
+      /// \return The number of bytes written to `destination`, which must
+      ///    hold at least `max_batch_frame_length` bytes.
+      constexpr Size finish(uint8_t *const destination,
+                            const uint8_t sequence_number) {
+        auto frame = Frame<2 + 1 + max_batch_data_length + 2>{
+            Frame_type::Batch, sequence_number};
+        frame.put(channel_mask_, 1);
+        for (auto i = 0; i < length_; ++i) {
+          frame.put(data_[i], 1);
+        }
+        clear();
+        return frame.finish(destination);
+      }
+
+      constexpr void clear() {
+        readings_ = 0;
+        length_ = 0;
+      }
+
+    private:
+      Array<uint8_t, max_batch_data_length> data_{};
+      Array<int32_t, used_channels> previous_{};
+      Size length_{0};
+      Size readings_{0};
+      uint8_t channel_mask_{0U};
+  };
+
+  constexpr Size encode_reading(
+      uint8_t *const destination, const uint8_t sequence_number,
+      const Array<int32_t, used_channels> &conversion_results,
+      const uint8_t channel_mask,
+      const Frame_type type = Frame_type::Reading) {
+    auto frame = Frame{type, sequence_number};
+    for (auto i = 0; i < used_channels; ++i) {
+      if ((channel_mask & (1U << static_cast<unsigned>(i))) != 0U) {
+        frame.put(conversion_results[i], reading_value_size);
+      }
+    }
+    return frame.finish(destination);
+  }
+
+  constexpr Size encode_change(
+      uint8_t *const destination, const uint8_t sequence_number,
+      const uint32_t timestamp_ms,
+      const Array<int32_t, used_channels> &conversion_results,
+      const uint8_t channel_mask) {
+    auto frame = Frame{Frame_type::Change, sequence_number};
+    frame.put(static_cast<int32_t>(timestamp_ms), 4);
+    frame.put(channel_mask, 1);
+    for (auto i = 0; i < used_channels; ++i) {
+      if ((channel_mask & (1U << static_cast<unsigned>(i))) != 0U) {
+        frame.put(conversion_results[i], reading_value_size);
+      }
+    }
+    return frame.finish(destination);
+  }
+
+  constexpr Size
+  encode_calibration(uint8_t *const destination, const uint8_t sequence_number,
+                     const Array<Channel_scale, used_channels> &scales,
+                     const uint8_t channel_mask) {
+    auto frame = Frame{Frame_type::Calibration, sequence_number};
+    for (const auto &scale : scales) {
+      frame.put(scale.offset, 4);
+      frame.put(scale.multiplier, 4);
+      frame.put(scale.shift, 1);
+    }
+    frame.put(channel_mask, 1);
+    return frame.finish(destination);
+  }
+
+  /// Reads a little-endian, two's complement value of `size` bytes.
+  constexpr int32_t get(const uint8_t *const source, const int size) {
+    auto value = uint32_t{0U};
+    for (auto i = 0; i < size; ++i) {
+      value |= uint32_t{source[i]} << (8U * static_cast<unsigned>(i));
+    }
+    const auto bits = 8U * static_cast<unsigned>(size);
+    if ((bits < 32U) && ((value >> (bits - 1U)) != 0U)) {
+      value |= ~uint32_t{0U} << bits;
+    }
+    return static_cast<int32_t>(value);
+  }
+
+  /// Decodes the readings of a batch frame, which has been `decode()`d to
+  /// `payload_length` bytes, into `readings`.
+  /// \return The number of readings or -1, if the frame is malformed.
+  using Batch_readings =
+      Array<Array<int32_t, used_channels>, max_batch_length>;
+
+  constexpr Size decode_batch(const uint8_t *const payload,
+                              const Size payload_length,
+                              Batch_readings &readings) {
+    if ((payload_length < 3)
+        || (payload[0] != std::to_underlying(Frame_type::Batch))) {
+      return -1;
+    }
+    const auto channel_mask = payload[2];
+    auto previous = Array<int32_t, used_channels>{};
+    auto count = Size{0};
+    for (auto position = Size{3}; position < payload_length; ++count) {
+      if ((count >= max_batch_length) || (channel_mask == 0U)) {
+        return -1;
+      }
+      for (auto i = 0; i < used_channels; ++i) {
+        if ((channel_mask & (1U << static_cast<unsigned>(i))) == 0U) {
+          readings[count][i] = 0;
+          continue;
+        }
+        auto value = uint32_t{};
+        const auto used = varint_decode(payload + position,
+                                        payload_length - position, value);
+        if (used == 0) {
+          return -1;
+        }
+        position += used;
+        // wraps around instead of overflowing with malformed values
+        previous[i] = static_cast<int32_t>(
+            static_cast<uint32_t>(previous[i])
+            + static_cast<uint32_t>(zigzag_decode(value)));
+        readings[count][i] = previous[i];
+      }
+    }
+    return count;
+  }
+
+  /// Decodes a received frame (without its delimiter) in place and checks its
+  /// CRC.
+  /// \return The length of the payload including type and sequence number,
+  ///    or -1, if the frame is malformed or corrupted.
+  constexpr Size decode(uint8_t *const frame, const Size length) {
+    const auto decoded_length = cobs_decode(frame, length, frame);
+    if (decoded_length < 4) {
+      return -1;
+    }
+    const auto payload_length = decoded_length - 2;
+    if (Crc16_ccitt::compute(frame, payload_length)
+        != static_cast<uint16_t>(get(frame + payload_length, 2))) {
+      return -1;
+    }
+    return payload_length;
+  }
+
+} // namespace meter::telemetry
+
+#endif // MSPMETER_TELEMETRY_HPP
@@ -1,15 +1,29 @@
 // Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
 
-void __delay_cycles([[maybe_unused]] int cycles) {}
-
+#include "adc.hpp"
+#include "calibration.hpp"
+#include "meter.hpp"
+#include "modbus.hpp"
 #include "msp430i2.hpp"
+#include "power.hpp"
+#include "report.hpp"
+#include "scope.hpp"
+#include "telemetry.hpp"
 #include "util.hpp"
 
+#include <catch2/benchmark/catch_benchmark.hpp>
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/generators/catch_generators.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
 #include <format>
+#include <numbers>
+#include <random>
 #include <string_view>
+#include <vector>
 
 namespace Catch {
   template <> struct StringMaker<u8> {
@@ -38,7 +52,583 @@ namespace meter {
   }
 
   SCENARIO("ADC result to voltage conversion") {
-    // TODO
+    const auto cal = GENERATE(
+        Channel_calibration{5'000'000, 30'000'000, 0x7f'ffff, 0},
+        Channel_calibration{1'000'000, 1'000'000, 0x7f'ffff, 0},
+        Channel_calibration{5'000'000, 30'000'000, 0x6e'1234, -1'234},
+        Channel_calibration{1'000'000, 1'000'000, 0x12'3456, 4'321},
+        Channel_calibration{1'000'000, 1'000'000, -0x7f'0000, 0});
+
+    GIVEN("a channel calibration compiled to a fixed-point scale") {
+      const auto scale = compile(cal);
+
+      THEN("every 24-bit reading is within 1 uV of the exact result") {
+        auto max_error = 0.0;
+        for (auto reading = msp430i2::SD24::negative_full_scale;
+             reading <= msp430i2::SD24::full_scale; ++reading) {
+          const auto reference = static_cast<double>(reading - cal.offset)
+                                 * cal.full_scale_voltage
+                                 / cal.full_scale_reading;
+          max_error = std::max(
+              max_error, std::abs(apply(reading, scale) - reference));
+        }
+        REQUIRE(max_error <= 1.0);
+      }
+    }
+  }
+
+  SCENARIO("calibration constants in erased flash") {
+    GIVEN("constants, of which only the channels were stored") {
+      auto stored = Calibration_constants{};
+      stored.channel[2].offset = -1'234;
+      stored.current_channel_index = 3;
+      // older versions stored less, the rest of the segment is erased
+      const auto erased_from = offsetof(Calibration_constants, range_trims);
+      std::memset(reinterpret_cast<char *>(&stored) + erased_from, 0xff,
+                  sizeof(stored) - erased_from);
+      REQUIRE(stored.range_trims[0][0] == -1);
+      REQUIRE(stored.bus_address == 0xffU);
+
+      WHEN("they are read") {
+        const auto cal = in_current_layout(stored);
+
+        THEN("the ranges are not trimmed and the text commands are used") {
+          for (const auto &trims : cal.range_trims) {
+            for (const auto trim : trims) {
+              CHECK(trim == 0);
+            }
+          }
+          CHECK(cal.bus_address == modbus::broadcast_address);
+          CHECK(cal.layout == calibration_layout);
+        }
+
+        THEN("the channels are kept") {
+          CHECK(cal.channel[2].offset == -1'234);
+          CHECK(cal.current_channel_index == 3);
+        }
+      }
+    }
+
+    GIVEN("constants in the current layout") {
+      auto stored = Calibration_constants{};
+      stored.range_trims[1][4] = -56;
+      stored.bus_address = 17U;
+
+      THEN("they are read as they were stored") {
+        const auto cal = in_current_layout(stored);
+        CHECK(cal.range_trims[1][4] == -56);
+        CHECK(cal.bus_address == 17U);
+      }
+    }
+  }
+
+  SCENARIO("division by a constant") {
+    auto rng = std::mt19937{42U};
+    auto dist = std::uniform_int_distribution<int32_t>{};
+
+    GIVEN("the limits of a 32-bit dividend") {
+      for (const auto dividend : {int32_t{0}, int32_t{1}, int32_t{-1},
+                                  std::numeric_limits<int32_t>::max(),
+                                  std::numeric_limits<int32_t>::min()}) {
+        CHECK(divide<10>(dividend) == dividend / 10);
+        CHECK(divide<1'000>(dividend) == dividend / 1'000);
+      }
+    }
+
+    GIVEN("random 32-bit dividends") {
+      for (auto i = 0; i < 1'000'000; ++i) {
+        const auto dividend = dist(rng);
+        REQUIRE(divide<10>(dividend) == dividend / 10);
+        REQUIRE(divide<1'000>(dividend) == dividend / 1'000);
+      }
+    }
+  }
+
+  SCENARIO("averaging over power-of-two and other lengths") {
+    auto rng = std::mt19937_64{42U};
+    auto dist = std::uniform_int_distribution<int64_t>{
+        int64_t{-0x80'0000} * 65'536, int64_t{0x7f'ffff} * 65'536};
+
+    GIVEN("random sums, negative ones included") {
+      for (auto i = 0; i < 100'000; ++i) {
+        const auto sum = dist(rng);
+        const auto shift = static_cast<int>(i % 17);
+        const auto length = int32_t{1} << shift;
+        REQUIRE(average(sum, length, shift) == average(sum, length, -1));
+        // rounding to nearest, ties away from zero
+        const auto exact =
+            static_cast<long double>(sum) / static_cast<long double>(length);
+        REQUIRE(average(sum, length, -1)
+                == static_cast<int32_t>(std::llround(exact)));
+      }
+    }
+
+    GIVEN("a negative mean at 256 and at 250 samples") {
+      THEN("both lengths round alike") {
+        CHECK(average(int64_t{-1'000} * 256 - 100, 256, 8) == -1'000);
+        CHECK(average(int64_t{-1'000} * 250 - 100, 250, -1) == -1'000);
+        CHECK(average(int64_t{-1'000} * 256 - 128, 256, 8) == -1'001);
+        CHECK(average(int64_t{-1'000} * 250 - 125, 250, -1) == -1'001);
+      }
+    }
+  }
+
+  SCENARIO("integer square root") {
+    auto rng = std::mt19937_64{42U};
+    auto dist = std::uniform_int_distribution<uint64_t>{0U, uint64_t{1} << 52U};
+
+    GIVEN("random radicands in the range of squared conversion results") {
+      for (auto i = 0; i < 100'000; ++i) {
+        const auto value = dist(rng);
+        REQUIRE(isqrt(value)
+                == static_cast<uint32_t>(
+                    std::llround(std::sqrt(static_cast<long double>(value)))));
+      }
+    }
+  }
+
+  namespace {
+
+    /// Sums up `samples` like `AD_converter::collect()` does.
+    uint32_t ac_rms_of(const std::vector<int32_t> &samples,
+                       const int32_t pivot) {
+      auto sum = int64_t{0};
+      auto sum_of_squares = uint64_t{0U};
+      for (const auto sample : samples) {
+        const auto deviation = int64_t{sample} - pivot;
+        sum += deviation;
+        sum_of_squares += static_cast<uint64_t>(deviation * deviation);
+      }
+      const auto length = static_cast<int32_t>(samples.size());
+      return ac_rms(sum, sum_of_squares, length, averaging_shift(length));
+    }
+
+  } // namespace
+
+  SCENARIO("RMS of synthesized waveforms") {
+    constexpr auto amplitude = 0x40'0000;
+    constexpr auto dc = 0x10'0000;
+
+    GIVEN("four periods of a sine wave with a DC component") {
+      const auto length = GENERATE(256, 320);
+      auto samples = std::vector<int32_t>{};
+      for (auto i = 0; i < length; ++i) {
+        samples.push_back(
+            dc
+            + static_cast<int32_t>(std::lround(
+                amplitude
+                * std::sin(2.0 * std::numbers::pi * 4.0 * i / length))));
+      }
+      const auto expected = amplitude / std::numbers::sqrt2;
+
+      THEN("the AC RMS value is the amplitude divided by sqrt(2)") {
+        CHECK(std::abs(ac_rms_of(samples, dc) - expected) <= 1.0);
+      }
+
+      THEN("a pivot far from the mean costs little accuracy") {
+        CHECK(std::abs(ac_rms_of(samples, 0) - expected) <= 1.0);
+        CHECK(std::abs(ac_rms_of(samples, -0x7f'0000) - expected) <= 1.0);
+      }
+    }
+
+    GIVEN("a square wave with a DC component") {
+      auto samples = std::vector<int32_t>{};
+      for (auto i = 0; i < 256; ++i) {
+        samples.push_back(dc + (((i / 32) % 2 == 0) ? amplitude : -amplitude));
+      }
+
+      THEN("the AC RMS value is the amplitude") {
+        CHECK(ac_rms_of(samples, dc) == amplitude);
+        CHECK(ac_rms_of(samples, 0) == amplitude);
+      }
+    }
+
+    GIVEN("a constant signal") {
+      const auto samples = std::vector<int32_t>(256, dc);
+
+      THEN("there is no AC component") {
+        CHECK(ac_rms_of(samples, 0) == 0U);
+        CHECK(ac_rms_of(samples, dc) == 0U);
+      }
+    }
+  }
+
+  SCENARIO("power of fluctuating loads") {
+    const auto voltage = compile(default_calibration[0]);
+    const auto to_W = [](const double reading, const Channel_calibration &cal) {
+      return (reading - cal.offset) * cal.full_scale_voltage
+             / cal.full_scale_reading / 1e6;
+    };
+
+    GIVEN("random products of two conversion results") {
+      auto rng = std::mt19937{42U};
+      auto dist = std::uniform_int_distribution<int32_t>{-0x80'0000, 0x7f'ffff};
+      for (auto i = 0; i < 100'000; ++i) {
+        const auto product = int64_t{dist(rng)} * dist(rng);
+        const auto exact = static_cast<long double>(product)
+                           * voltage.multiplier
+                           / std::pow(2.0L, voltage.shift);
+        REQUIRE(std::abs(static_cast<long double>(scale_wide(product, voltage))
+                         - exact)
+                <= 0.5L);
+      }
+    }
+
+    GIVEN("voltage and current changing in phase within one window") {
+      constexpr auto high = 0x60'0000;
+      constexpr auto low = 0x20'0000;
+      constexpr auto offset = 0x1000;
+      auto cal = default_calibration;
+      cal[0].offset = offset;
+      cal[1].offset = -offset;
+
+      auto sum_of_products = int64_t{0};
+      for (auto i = 0; i < 256; ++i) {
+        const auto sample = ((i / 32) % 2 == 0) ? high : low;
+        sum_of_products += int64_t{sample} * sample;
+      }
+      const auto raw_mean_product = wide_average(sum_of_products, 256, 8);
+      const auto mean = (high + low) / 2;
+
+      THEN("the power is the mean of the sample-by-sample products") {
+        const auto power_W =
+            ((to_W(high, cal[0]) * to_W(high, cal[1]))
+             + (to_W(low, cal[0]) * to_W(low, cal[1])))
+            / 2;
+        const auto product = mean_product(raw_mean_product, mean, offset, mean,
+                                          -offset);
+        CHECK(std::abs(power_uW(product, compile(cal[0]), compile(cal[1]))
+                       - (power_W * 1e6))
+              <= 1.0);
+        CHECK(power_W > (to_W(mean, cal[0]) * to_W(mean, cal[1])) * 1.2);
+      }
+    }
+  }
+
+  SCENARIO("apparent power and power factor") {
+    const auto voltage = compile(default_calibration[0]);
+    const auto current = compile(default_calibration[1]);
+
+    GIVEN("full-scale RMS values") {
+      const auto apparent =
+          apparent_power_uVA(0x7f'ffffU, 0x7f'ffffU, voltage, current);
+
+      THEN("the apparent power is the product of the full-scale values") {
+        CHECK(apparent == 30'000'000);
+      }
+
+      THEN("the power factor relates real and apparent power") {
+        CHECK(power_factor_permille(apparent, apparent) == 1'000);
+        CHECK(power_factor_permille(apparent / 2, apparent) == 500);
+        CHECK(power_factor_permille(-apparent, apparent) == -1'000);
+      }
+    }
+  }
+
+  SCENARIO("tracking the extremes of samples") {
+    GIVEN("no samples") {
+      const auto extremes = Extremes{};
+      THEN("the extremes are empty") { CHECK(extremes.empty()); }
+    }
+
+    GIVEN("a few samples") {
+      auto extremes = Extremes{};
+      for (const auto sample : {5, -3, 12, 0}) {
+        extremes.add(sample);
+      }
+      THEN("the smallest and the largest one are kept") {
+        CHECK(!extremes.empty());
+        CHECK(extremes.minimum == -3);
+        CHECK(extremes.maximum == 12);
+      }
+
+      WHEN("merged with the extremes of other samples") {
+        auto hold = Extremes{};
+        hold.add(Extremes{});
+        hold.add(extremes);
+        hold.add(Extremes{-10, 1});
+        THEN("the hold covers all of them") {
+          CHECK(hold.minimum == -10);
+          CHECK(hold.maximum == 12);
+        }
+      }
+    }
+  }
+
+  SCENARIO("triggered waveform capture") {
+    // channel 1 counts the frames, channel 2 ramps down, so every sample
+    // tells where it came from
+    const auto frame = [](const int32_t n) {
+      return Array<int32_t, used_channels>{{n, -n, 0, 0}};
+    };
+    const auto sample = [](const Scope &scope, const Size index) {
+      auto bytes = Array<uint8_t, Scope::sample_size>{};
+      for (auto i = 0; i < Scope::sample_size; ++i) {
+        bytes[i] = scope.byte((index * Scope::sample_size) + i);
+      }
+      return telemetry::get(bytes.data(), Scope::sample_size);
+    };
+
+    GIVEN("a scope armed for a rising edge on channel 1") {
+      auto scope = Scope{};
+      REQUIRE(scope.arm(0, Trigger::Rising, 100, 0b0011U, 8, 16));
+      CHECK(scope.state() == Scope::State::Armed);
+      CHECK(scope.length() == 0);
+
+      WHEN("the level is crossed") {
+        for (auto n = 90; n < 200; ++n) {
+          scope.add(frame(n));
+        }
+
+        THEN("the frames around the trigger are captured") {
+          REQUIRE(scope.state() == Scope::State::Done);
+          REQUIRE(scope.length() == 24 * 2 * Scope::sample_size);
+          for (auto i = 0; i < 24; ++i) {
+            CHECK(sample(scope, 2 * i) == 92 + i);
+            CHECK(sample(scope, (2 * i) + 1) == -(92 + i));
+          }
+        }
+      }
+
+      WHEN("the level is crossed before the pre-trigger frames are recorded") {
+        for (auto n = 95; n < 105; ++n) {
+          scope.add(frame(n));
+        }
+
+        THEN("the trigger is ignored") {
+          CHECK(scope.state() == Scope::State::Armed);
+        }
+      }
+
+      WHEN("the capture is stopped") {
+        scope.stop();
+        scope.add(frame(0));
+        THEN("it is idle") { CHECK(scope.state() == Scope::State::Idle); }
+      }
+    }
+
+    GIVEN("a scope armed for a sample below a level") {
+      auto scope = Scope{};
+      REQUIRE(scope.arm(1, Trigger::Below, -1'000, 0b0001U, 0, 4));
+
+      WHEN("the level is reached long after arming") {
+        for (auto n = 0; n < 2'000; ++n) {
+          scope.add(frame(n));
+        }
+
+        THEN("the capture starts at the trigger") {
+          REQUIRE(scope.state() == Scope::State::Done);
+          for (auto i = 0; i < 4; ++i) {
+            CHECK(sample(scope, i) == 1'001 + i);
+          }
+        }
+      }
+    }
+
+    GIVEN("more frames than fit into the buffer") {
+      auto scope = Scope{};
+      THEN("the scope is not armed") {
+        CHECK(!scope.arm(0, Trigger::Above, 0, 0b1111U,
+                         Scope::depth(0b1111U), 1));
+        CHECK(scope.arm(0, Trigger::Above, 0, 0b1111U,
+                        Scope::depth(0b1111U) - 1, 1));
+        CHECK(!scope.arm(0, Trigger::Above, 0, 0b0001U, 0, 0));
+      }
+    }
+  }
+
+  namespace {
+
+    /// A recording of a noisy signal with a step in the middle.
+    std::vector<int32_t> record_step(const int32_t step, const double noise) {
+      auto rng = std::mt19937{7U};
+      auto dist = std::normal_distribution<double>{0.0, noise};
+      auto samples = std::vector<int32_t>{};
+      for (auto i = 0; i < 16'384; ++i) {
+        samples.push_back(((i < 8'192) ? 0 : step)
+                          + static_cast<int32_t>(std::lround(dist(rng))));
+      }
+      return samples;
+    }
+
+    struct Filter_performance {
+        /// samples from the step until the readings stay within the
+        /// tolerance
+        int settling_time;
+        /// standard deviation of the readings before the step
+        double noise;
+    };
+
+    /// Replays `samples` in windows of `length` through an adaptive average
+    /// with `max_length`, which is a plain average for `max_length` <=
+    /// `length`.
+    Filter_performance replay(const std::vector<int32_t> &samples,
+                              const int32_t length, const int32_t max_length,
+                              const int32_t step, const int32_t tolerance) {
+      auto filter = Adaptive_average{};
+      auto readings = std::vector<std::pair<int, int32_t>>{};
+      for (auto begin = std::size_t{0}; begin < samples.size();
+           begin += static_cast<std::size_t>(length)) {
+        auto sum = int64_t{0};
+        auto squares = uint64_t{0U};
+        for (auto i = begin; i < begin + static_cast<std::size_t>(length);
+             ++i) {
+          sum += samples[i];
+          squares += static_cast<uint64_t>(int64_t{samples[i]} * samples[i]);
+        }
+        const auto shift = averaging_shift(length);
+        const auto noise = ac_rms(sum, squares, length, shift);
+        readings.emplace_back(
+            static_cast<int>(begin) + length,
+            filter.add(sum, length, shift, noise, max_length));
+      }
+
+      auto settled_at = 0;
+      auto sum = 0.0;
+      auto sum_of_squares = 0.0;
+      auto count = 0;
+      for (const auto &[end, reading] : readings) {
+        if (end <= 8'192) {
+          if (end > 4'096) {
+            sum += reading;
+            sum_of_squares += static_cast<double>(reading) * reading;
+            ++count;
+          }
+        } else if (std::abs(reading - step) > tolerance) {
+          settled_at = end;
+        }
+      }
+      const auto mean = sum / count;
+      return {std::max(settled_at - 8'192, length),
+              std::sqrt((sum_of_squares / count) - (mean * mean))};
+    }
+
+  } // namespace
+
+  SCENARIO("deadbands and heartbeat of the exception filter") {
+    GIVEN("a filter with a deadband on channels 1 and 2 and a heartbeat") {
+      auto filter = Exception_filter{};
+      REQUIRE(filter.set_deadband(0, 100));
+      REQUIRE(filter.set_deadband(1, 1'000));
+      CHECK_FALSE(filter.set_deadband(2, -1));
+      filter.set_heartbeat_ms(1'000U);
+      const auto values = Array<int32_t, used_channels>{{0, 0, 0, 0}};
+
+      THEN("the first reading is reported completely") {
+        CHECK(filter.select(values, 0b0111U, 0U) == 0b0111U);
+      }
+
+      WHEN("the values stay within their deadbands") {
+        REQUIRE(filter.select(values, 0b0011U, 0U) == 0b0011U);
+        THEN("nothing is reported until the heartbeat") {
+          CHECK(filter.select({{100, -1'000, 0, 0}}, 0b0011U, 500U) == 0U);
+          CHECK(filter.select({{-100, 1'000, 0, 0}}, 0b0011U, 999U) == 0U);
+          CHECK(filter.select(values, 0b0011U, 1'000U) == 0b0011U);
+          CHECK(filter.select(values, 0b0011U, 1'999U) == 0U);
+        }
+      }
+
+      WHEN("a value leaves its deadband") {
+        REQUIRE(filter.select(values, 0b0011U, 0U) == 0b0011U);
+        THEN("only that channel is reported") {
+          CHECK(filter.select({{101, 900, 0, 0}}, 0b0011U, 10U) == 0b0001U);
+          AND_THEN("the deadband is centered on the reported value") {
+            CHECK(filter.select({{1, 900, 0, 0}}, 0b0011U, 20U) == 0U);
+            CHECK(filter.select({{0, 900, 0, 0}}, 0b0011U, 30U) == 0b0001U);
+          }
+        }
+      }
+
+      WHEN("the timestamp wraps around") {
+        REQUIRE(filter.select(values, 0b0001U, 0xffff'ff00U) == 0b0001U);
+        THEN("the heartbeat keeps its interval") {
+          CHECK(filter.select(values, 0b0001U, 0x0000'0100U) == 0U);
+          CHECK(filter.select(values, 0b0001U, 0x0000'02e8U) == 0b0001U);
+        }
+      }
+    }
+
+    GIVEN("a sample clock") {
+      auto clock = Sample_clock{};
+      WHEN("readings of odd lengths pass") {
+        for (auto i = 0; i < 1'000; ++i) {
+          clock.advance(67);
+        }
+        THEN("no fraction of a millisecond is lost") {
+          CHECK(clock.ms() == 67'000 / Sample_clock::samples_per_ms);
+        }
+      }
+    }
+
+    GIVEN("a change of two channels") {
+      const auto results =
+          Array<int32_t, used_channels>{{0, 0x12'3456, 0, -2}};
+      auto frame = Array<uint8_t, telemetry::max_frame_length>{};
+      const auto length = telemetry::encode_change(frame.data(), 7U,
+                                                   123'456'789U, results,
+                                                   0b1010U);
+
+      THEN("the frame holds the timestamp and the changed channels") {
+        REQUIRE(telemetry::decode(frame.data(), length - 1)
+                == 2 + 4 + 1 + (2 * 3));
+        CHECK(frame[0] == std::to_underlying(telemetry::Frame_type::Change));
+        CHECK(frame[1] == 7U);
+        CHECK(telemetry::get(frame.data() + 2, 4) == 123'456'789);
+        CHECK(frame[6] == 0b1010U);
+        CHECK(telemetry::get(frame.data() + 7, 3) == 0x12'3456);
+        CHECK(telemetry::get(frame.data() + 10, 3) == -2);
+      }
+    }
+  }
+
+  SCENARIO("adaptive averaging of recorded waveforms") {
+    constexpr auto step = 100'000;
+    // six standard deviations of a reading of 16 samples
+    constexpr auto tolerance = 300;
+
+    GIVEN("a step on a signal with noise") {
+      const auto samples = record_step(step, 200.0);
+      const auto short_window = replay(samples, 16, 16, step, tolerance);
+      const auto long_window = replay(samples, 1'024, 1'024, step, tolerance);
+      const auto adaptive = replay(samples, 16, 1'024, step, tolerance);
+      INFO("short window: " << short_window.settling_time << " samples, "
+                            << short_window.noise << " noise");
+      INFO("long window: " << long_window.settling_time << " samples, "
+                           << long_window.noise << " noise");
+      INFO("adaptive: " << adaptive.settling_time << " samples, "
+                        << adaptive.noise << " noise");
+
+      THEN("the adaptive average settles like the short window") {
+        CHECK(short_window.settling_time == 16);
+        CHECK(long_window.settling_time == 1'024);
+        CHECK(adaptive.settling_time <= 2 * 16);
+      }
+
+      THEN("the adaptive average is nearly as quiet as the long window") {
+        CHECK(adaptive.noise < short_window.noise / 4);
+        CHECK(adaptive.noise < long_window.noise * 2);
+      }
+    }
+
+    GIVEN("a step on a noise-free signal") {
+      const auto samples = record_step(step, 0.0);
+      const auto adaptive = replay(samples, 16, 1'024, step, 0);
+
+      THEN("the reading is exact after the first window") {
+        CHECK(adaptive.settling_time == 16);
+        CHECK(adaptive.noise == 0.0);
+      }
+    }
+  }
+
+  TEST_CASE("cost of adaptive averaging per window") {
+    auto filter = Adaptive_average{};
+    auto sum = int64_t{0};
+
+    BENCHMARK("Adaptive_average::add()") {
+      sum = (sum + 7'919) % (16 * 0x10'0000);
+      return filter.add(sum, 16, 4, 100U, 1'024);
+    };
   }
 
   SCENARIO("slicing") {
@@ -70,6 +660,20 @@ namespace meter {
       CHECK(print(buffer.begin(), buffer.size(), "30.00\t1.000\r\n") == 13);
       REQUIRE(buffer.data() == "30.00\t1.000\r\n"sv);
     }
+
+    GIVEN("millionths") {
+      const auto text = [&buffer](const int64_t value) {
+        const auto length =
+            print(buffer.begin(), buffer.size(), Millionths{value});
+        return std::string_view{buffer.data(),
+                                static_cast<std::size_t>(length)};
+      };
+      CHECK(text(12'345'678) == "12.345678");
+      CHECK(text(-5) == "-0.000005");
+      CHECK(text(0) == "0.000000");
+      CHECK(text(-9'223'372'036'854'775'807 - 1)
+            == "-9223372036854.775808");
+    }
   }
 
   SCENARIO("readout formatting for voltage (xx.xx)") {
@@ -182,6 +786,501 @@ namespace meter {
         }
       }
     }
+
+    GIVEN("an overload") {
+      const auto number = 10'000;
+      WHEN("formatting") {
+        format_readout<4, 0>(Slice{buffer}, number);
+        THEN("OL is shown in the last two digits") {
+          REQUIRE(buffer.data() == "  OL"sv);
+        }
+      }
+    }
+  }
+
+  SCENARIO("binary telemetry frames") {
+    GIVEN("a reading of full-scale conversion results") {
+      const auto results = Array<int32_t, used_channels>{
+          {msp430i2::SD24::full_scale, msp430i2::SD24::negative_full_scale,
+           0, -1}};
+      auto frame = Array<uint8_t, telemetry::max_frame_length>{};
+
+      WHEN("it is encoded") {
+        const auto length = telemetry::encode_reading(frame.data(), 42U,
+                                                      results, 0x0fU);
+
+        THEN("the frame is at most half the length of the text line") {
+          auto line = Array<char, 80>{};
+          const auto line_length =
+              print(line, 30'000'000, "\t", -30'000'000, "\t", 1'000'000, "\t",
+                    -1'000'000, "\r\n");
+          CHECK(length == 18);
+          CHECK(2 * length <= line_length);
+        }
+
+        THEN("only the last byte is zero") {
+          CHECK(frame[length - 1] == 0U);
+          CHECK(std::count(frame.begin(), frame.begin() + length - 1, 0U)
+                == 0);
+        }
+
+        THEN("it can be decoded") {
+          const auto payload_length =
+              telemetry::decode(frame.data(), length - 1);
+          REQUIRE(payload_length == 2 + (used_channels * 3));
+          CHECK(frame[0] == std::to_underlying(telemetry::Frame_type::Reading));
+          CHECK(frame[1] == 42U);
+          for (auto i = 0; i < used_channels; ++i) {
+            CHECK(telemetry::get(frame.data() + 2 + (i * 3), 3) == results[i]);
+          }
+        }
+
+        THEN("disabled channels are left out") {
+          CHECK(telemetry::encode_reading(frame.data(), 43U, results, 0x05U)
+                == length - (2 * 3));
+        }
+
+        THEN("a corrupted frame is rejected") {
+          frame[5] ^= 0x10U;
+          CHECK(telemetry::decode(frame.data(), length - 1) == -1);
+        }
+      }
+    }
+
+    GIVEN("a compiled calibration") {
+      auto scales = Array<Channel_scale, used_channels>{};
+      for (auto i = 0; i < used_channels; ++i) {
+        scales[i] = compile(default_calibration[i]);
+      }
+      auto frame = Array<uint8_t, telemetry::max_frame_length>{};
+
+      WHEN("it is encoded and decoded") {
+        const auto length = telemetry::encode_calibration(frame.data(), 0U,
+                                                          scales, 0x05U);
+        REQUIRE(length <= telemetry::max_frame_length);
+        REQUIRE(telemetry::decode(frame.data(), length - 1)
+                == 2 + (used_channels * 9) + 1);
+
+        THEN("the receiver obtains the same scales") {
+          CHECK(frame[0]
+                == std::to_underlying(telemetry::Frame_type::Calibration));
+          for (auto i = 0; i < used_channels; ++i) {
+            const auto *const field = frame.data() + 2 + (i * 9);
+            CHECK(telemetry::get(field, 4) == scales[i].offset);
+            CHECK(telemetry::get(field + 4, 4) == scales[i].multiplier);
+            CHECK(telemetry::get(field + 8, 1) == scales[i].shift);
+          }
+          CHECK(frame[2 + (used_channels * 9)] == 0x05U);
+        }
+      }
+    }
+  }
+
+  SCENARIO("batched telemetry frames") {
+    // four channels of a recorded step with noise, each one shifted in time
+    const auto samples = record_step(100'000, 200.0);
+    const auto reading = [&samples](const std::size_t n) {
+      auto results = Array<int32_t, used_channels>{};
+      for (auto i = 0; i < used_channels; ++i) {
+        results[i] = samples[(n + (4'000 * static_cast<std::size_t>(i)))
+                             % samples.size()];
+      }
+      return results;
+    };
+    const auto decode = [](Array<uint8_t, telemetry::max_batch_frame_length>
+                               &frame,
+                           const Size length,
+                           telemetry::Batch_readings &readings) {
+      const auto payload_length = telemetry::decode(frame.data(), length - 1);
+      return (payload_length < 0)
+                 ? Size{-1}
+                 : telemetry::decode_batch(frame.data(), payload_length,
+                                           readings);
+    };
+    auto frame = Array<uint8_t, telemetry::max_batch_frame_length>{};
+    auto readings = telemetry::Batch_readings{};
+
+    GIVEN("a batch of eight readings") {
+      auto batch = telemetry::Batch{};
+      for (auto n = std::size_t{0}; n < 8; ++n) {
+        REQUIRE(batch.add(reading(n), 0b1101U));
+      }
+      const auto length = batch.finish(frame.data(), 42U);
+
+      THEN("the host decodes the same readings") {
+        REQUIRE(decode(frame, length, readings) == 8);
+        CHECK(frame[0] == std::to_underlying(telemetry::Frame_type::Batch));
+        CHECK(frame[1] == 42U);
+        for (auto n = 0; n < 8; ++n) {
+          const auto expected = reading(static_cast<std::size_t>(n));
+          CHECK(readings[n][0] == expected[0]);
+          CHECK(readings[n][1] == 0);
+          CHECK(readings[n][2] == expected[2]);
+          CHECK(readings[n][3] == expected[3]);
+        }
+      }
+
+      THEN("the next batch starts empty") {
+        CHECK(batch.readings() == 0);
+      }
+
+      THEN("a corrupted frame is rejected") {
+        frame[4] ^= 0x01U;
+        CHECK(decode(frame, length, readings) == -1);
+      }
+    }
+
+    GIVEN("readings of full-scale steps") {
+      auto batch = telemetry::Batch{};
+      auto count = Size{0};
+      for (auto n = 0; batch.add({{(n % 2 == 0) ? 0x7f'ffff : -0x80'0000,
+                                   0, 0, 0}},
+                                 0b1111U);
+           ++n) {
+        ++count;
+      }
+
+      THEN("only as many readings are added as fit") {
+        CHECK(count == telemetry::max_batch_data_length / 7);
+        const auto length = batch.finish(frame.data(), 0U);
+        CHECK(length <= telemetry::max_batch_frame_length);
+        REQUIRE(decode(frame, length, readings) == count);
+        CHECK(readings[count - 1][0] == -0x80'0000);
+      }
+    }
+
+    GIVEN("a batch, when the channel mask changes") {
+      auto batch = telemetry::Batch{};
+      REQUIRE(batch.add(reading(0), 0b0001U));
+
+      THEN("the reading has to go into the next batch") {
+        CHECK_FALSE(batch.add(reading(1), 0b0011U));
+        CHECK(batch.readings() == 1);
+      }
+    }
+
+    GIVEN("the recorded readings") {
+      auto batch = telemetry::Batch{};
+      auto text_bytes = Size{0};
+      auto single_bytes = Size{0};
+      auto batched_bytes = Size{0};
+      auto scales = Array<Channel_scale, used_channels>{};
+      for (auto i = 0; i < used_channels; ++i) {
+        scales[i] = compile(default_calibration[i]);
+      }
+      auto line = Array<char, 80>{};
+      auto single = Array<uint8_t, telemetry::max_frame_length>{};
+      for (auto n = std::size_t{0}; n < samples.size(); ++n) {
+        const auto results = reading(n);
+        // like `Meter::report()` in the text format
+        text_bytes += print(line, apply(results[0], scales[0]), "\t",
+                            apply(results[1], scales[1]), "\t",
+                            apply(results[2], scales[2]), "\t",
+                            apply(results[3], scales[3]), "\r\n");
+        single_bytes += telemetry::encode_reading(single.data(), 0U,
+                                                  results, 0b1111U);
+        // like the meter, which sends a batch early, if a reading does not
+        // fit anymore
+        if (!batch.add(reading(n), 0b1111U)) {
+          batched_bytes += batch.finish(frame.data(), 0U);
+          REQUIRE(batch.add(reading(n), 0b1111U));
+        }
+        if (batch.readings() == 8) {
+          batched_bytes += batch.finish(frame.data(), 0U);
+        }
+      }
+      const auto per_reading = [&samples](const Size bytes) {
+        return static_cast<double>(bytes)
+               / static_cast<double>(samples.size());
+      };
+      INFO("text: " << per_reading(text_bytes) << " bytes/reading");
+      INFO("single: " << per_reading(single_bytes) << " bytes/reading");
+      INFO("batched: " << per_reading(batched_bytes) << " bytes/reading");
+
+      THEN("batches of eight take less than half the bytes") {
+        CHECK(2 * batched_bytes < single_bytes);
+      }
+
+      // the small values make short text lines, so that even batches do not
+      // take a third of their bytes
+      THEN("frames are shorter than text lines and batches less than half") {
+        CHECK(single_bytes < text_bytes);
+        CHECK(2 * batched_bytes < text_bytes);
+        CHECK(3 * batched_bytes > text_bytes);
+      }
+    }
+  }
+
+  SCENARIO("Modbus RTU requests") {
+    /// ten registers of each kind, holding register 9 is read-only
+    struct Registers {
+        Array<uint16_t, 10> input{};
+        Array<uint16_t, 10> holding{};
+
+        modbus::Exception read_input_register(const uint16_t address,
+                                              uint16_t &value) const {
+          if (address >= input.size()) {
+            return modbus::Exception::IllegalDataAddress;
+          }
+          value = input[address];
+          return modbus::Exception::None;
+        }
+        modbus::Exception read_holding_register(const uint16_t address,
+                                                uint16_t &value) const {
+          if (address >= holding.size()) {
+            return modbus::Exception::IllegalDataAddress;
+          }
+          value = holding[address];
+          return modbus::Exception::None;
+        }
+        modbus::Exception write_holding_register(const uint16_t address,
+                                                 const uint16_t value) {
+          if (address >= holding.size() - 1) {
+            return modbus::Exception::IllegalDataAddress;
+          }
+          holding[address] = value;
+          return modbus::Exception::None;
+        }
+        modbus::Exception read_snapshot(modbus::Snapshot &result) const {
+          if (latch_pending) {
+            return modbus::Exception::ServerDeviceBusy;
+          }
+          result = snapshot;
+          return modbus::Exception::None;
+        }
+        modbus::Exception latch(const uint16_t number) {
+          snapshot.latch = number;
+          latch_pending = true;
+          return modbus::Exception::None;
+        }
+
+        modbus::Snapshot snapshot{};
+        bool latch_pending{false};
+    };
+    auto registers = Registers{};
+    for (auto i = 0; i < registers.input.size(); ++i) {
+      registers.input[i] =
+          static_cast<uint16_t>(0x1100U * static_cast<unsigned>(i + 1));
+    }
+    auto response = Array<uint8_t, modbus::max_response_length>{};
+    // appends the CRC, low byte first
+    const auto with_crc = [](const std::vector<uint8_t> &data) {
+      const auto crc = Crc16_modbus::compute(
+          data.data(), static_cast<Size>(data.size()));
+      auto frame = std::vector<uint8_t>(data.size() + 2);
+      std::copy(data.begin(), data.end(), frame.begin());
+      frame[data.size()] = static_cast<uint8_t>(crc);
+      frame[data.size() + 1] = static_cast<uint8_t>(crc >> 8U);
+      return frame;
+    };
+    const auto respond = [&](const std::vector<uint8_t> &request) {
+      const auto length =
+          modbus::respond(request.data(), static_cast<Size>(request.size()),
+                          0x11U, registers, response.data());
+      return std::vector<uint8_t>(response.begin(),
+                                  response.begin() + length);
+    };
+
+    GIVEN("a request to read input registers") {
+      const auto request = with_crc({0x11U, 0x04U, 0x00U, 0x02U, 0x00U,
+                                     0x03U});
+
+      THEN("the registers are returned high byte first") {
+        CHECK(respond(request)
+              == with_crc({0x11U, 0x04U, 0x06U, 0x33U, 0x00U, 0x44U, 0x00U,
+                           0x55U, 0x00U}));
+      }
+
+      THEN("the CRC is sent low byte first") {
+        CHECK(with_crc({0x01U, 0x03U, 0x00U, 0x00U, 0x00U, 0x0aU})
+              == std::vector<uint8_t>{0x01U, 0x03U, 0x00U, 0x00U, 0x00U,
+                                      0x0aU, 0xc5U, 0xcdU});
+      }
+
+      WHEN("it is corrupted") {
+        auto corrupted = request;
+        corrupted[3] ^= 0x01U;
+        THEN("it is ignored") { CHECK(respond(corrupted).empty()); }
+      }
+
+      WHEN("it is addressed to another slave") {
+        THEN("it is ignored") {
+          CHECK(respond(with_crc({0x12U, 0x04U, 0x00U, 0x02U, 0x00U, 0x03U}))
+                    .empty());
+        }
+      }
+    }
+
+    GIVEN("requests, which cannot be executed") {
+      THEN("they are answered with an exception") {
+        // beyond the last register
+        CHECK(respond(with_crc({0x11U, 0x04U, 0x00U, 0x08U, 0x00U, 0x03U}))
+              == with_crc({0x11U, 0x84U, 0x02U}));
+        // too many registers
+        CHECK(respond(with_crc({0x11U, 0x03U, 0x00U, 0x00U, 0x00U,
+                                modbus::max_read_count + 1}))
+              == with_crc({0x11U, 0x83U, 0x03U}));
+        // beyond the last address
+        CHECK(respond(with_crc({0x11U, 0x03U, 0xffU, 0xffU, 0x00U, 0x02U}))
+              == with_crc({0x11U, 0x83U, 0x02U}));
+        // an unknown function
+        CHECK(respond(with_crc({0x11U, 0x2bU, 0x0eU, 0x01U, 0x00U}))
+              == with_crc({0x11U, 0xabU, 0x01U}));
+        // a wrong byte count
+        CHECK(respond(with_crc({0x11U, 0x10U, 0x00U, 0x00U, 0x00U, 0x01U,
+                                0x03U, 0x00U, 0x00U}))
+              == with_crc({0x11U, 0x90U, 0x03U}));
+      }
+    }
+
+    GIVEN("requests to write holding registers") {
+      WHEN("a single register is written") {
+        const auto request = with_crc({0x11U, 0x06U, 0x00U, 0x01U, 0xabU,
+                                       0xcdU});
+        const auto reply = respond(request);
+
+        THEN("the request is echoed") {
+          CHECK(reply == request);
+          CHECK(registers.holding[1] == 0xabcdU);
+        }
+      }
+
+      WHEN("several registers are written") {
+        const auto reply =
+            respond(with_crc({0x11U, 0x10U, 0x00U, 0x03U, 0x00U, 0x02U,
+                              0x04U, 0x01U, 0x02U, 0x03U, 0x04U}));
+
+        THEN("the first register and the count are confirmed") {
+          CHECK(reply
+                == with_crc({0x11U, 0x10U, 0x00U, 0x03U, 0x00U, 0x02U}));
+          CHECK(registers.holding[3] == 0x0102U);
+          CHECK(registers.holding[4] == 0x0304U);
+        }
+      }
+
+      WHEN("a write to all slaves is broadcast") {
+        const auto reply = respond(with_crc({0x00U, 0x06U, 0x00U, 0x02U,
+                                             0x00U, 0x07U}));
+
+        THEN("it is executed, but not answered") {
+          CHECK(reply.empty());
+          CHECK(registers.holding[2] == 7U);
+        }
+      }
+
+      WHEN("a write fails") {
+        const auto reply = respond(with_crc({0x11U, 0x06U, 0x00U, 0x09U,
+                                             0x00U, 0x01U}));
+
+        THEN("the exception is returned") {
+          CHECK(reply == with_crc({0x11U, 0x86U, 0x02U}));
+        }
+      }
+    }
+
+    GIVEN("a latch broadcast to all slaves") {
+      const auto reply = respond(with_crc({0x00U, 0x42U, 0x12U, 0x34U}));
+      const auto poll = with_crc({0x11U, 0x41U});
+
+      THEN("the reading is started without an answer") {
+        CHECK(reply.empty());
+        CHECK(registers.latch_pending);
+        CHECK(registers.snapshot.latch == 0x1234U);
+      }
+
+      WHEN("the slave is polled before the reading is complete") {
+        THEN("it is busy") {
+          CHECK(respond(poll) == with_crc({0x11U, 0xc1U, 0x06U}));
+        }
+      }
+
+      WHEN("the slave is polled after the reading") {
+        registers.latch_pending = false;
+        registers.snapshot.timestamp_ms = 0x0102'0304U;
+        registers.snapshot.readings = {-1, 2, 0x7fff'ffff, 0};
+        registers.snapshot.power_uW = -1'000;
+        const auto snapshot = respond(poll);
+
+        THEN("the snapshot is returned high byte first") {
+          CHECK(snapshot
+                == with_crc({0x11U, 0x41U, 26U, 0x12U, 0x34U, 0x01U, 0x02U,
+                             0x03U, 0x04U, 0xffU, 0xffU, 0xffU, 0xffU, 0x00U,
+                             0x00U, 0x00U, 0x02U, 0x7fU, 0xffU, 0xffU, 0xffU,
+                             0x00U, 0x00U, 0x00U, 0x00U, 0xffU, 0xffU, 0xfcU,
+                             0x18U}));
+        }
+
+        THEN("the master can decode it") {
+          const auto decoded = modbus::decode(snapshot.data() + 3);
+          CHECK(decoded.latch == 0x1234U);
+          CHECK(decoded.timestamp_ms == 0x0102'0304U);
+          CHECK(decoded.readings == registers.snapshot.readings);
+          CHECK(decoded.power_uW == -1'000);
+        }
+      }
+    }
+
+    GIVEN("a latch addressed to one slave") {
+      const auto request = with_crc({0x11U, 0x42U, 0x00U, 0x07U});
+
+      THEN("the latch number is echoed") {
+        CHECK(respond(request) == request);
+        CHECK(registers.snapshot.latch == 7U);
+      }
+    }
+  }
+
+  SCENARIO("assembling Modbus frames") {
+    auto receiver = modbus::Receiver{};
+
+    GIVEN("the bytes of a request") {
+      for (const auto byte : {0x11U, 0x04U, 0x00U}) {
+        receiver.add_byte(static_cast<uint8_t>(byte));
+      }
+
+      WHEN("the line falls silent") {
+        REQUIRE(receiver.end_frame());
+
+        THEN("the frame is ready until it is released") {
+          REQUIRE(receiver.frame_ready());
+          CHECK(receiver.length() == 3);
+          CHECK(receiver.frame()[0] == 0x11U);
+          receiver.add_byte(0x55U);
+          CHECK(receiver.overruns() == 1U);
+          CHECK_FALSE(receiver.end_frame());
+          receiver.release();
+          CHECK_FALSE(receiver.frame_ready());
+          CHECK_FALSE(receiver.end_frame());
+        }
+      }
+    }
+
+    GIVEN("more bytes than a request can have") {
+      for (auto i = 0; i <= modbus::max_request_length; ++i) {
+        receiver.add_byte(0x11U);
+      }
+
+      THEN("the frame is dropped") {
+        CHECK_FALSE(receiver.end_frame());
+        CHECK(receiver.length() == 0);
+      }
+    }
+  }
+
+  TEST_CASE("cost of encoding batched telemetry") {
+    const auto samples = record_step(100'000, 200.0);
+    auto batch = telemetry::Batch{};
+    auto frame = Array<uint8_t, telemetry::max_batch_frame_length>{};
+    auto n = std::size_t{0};
+
+    BENCHMARK("Batch::add() and finish() of eight readings") {
+      for (auto i = 0; i < 8; ++i) {
+        const auto value = samples[n];
+        n = (n + 1) % samples.size();
+        batch.add({{value, value, value, value}}, 0b1111U);
+      }
+      return batch.finish(frame.data(), 0U);
+    };
   }
 
 } // namespace meter
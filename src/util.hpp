@@ -22,6 +22,54 @@ namespace meter {
   static_assert(ipow10(0) == 1);
   static_assert(ipow10(1) == 10);
 
+  /// Divides by a constant `divisor_` by multiplying with its fixed-point
+  /// reciprocal, truncating toward zero like the built-in division. This is
+  /// exact for all 32-bit dividends and avoids the software division on
+  /// MSP430 devices without a hardware divider.
+  template <int32_t divisor_>
+    requires(divisor_ > 1)
+  constexpr int32_t divide(const int32_t dividend) {
+    constexpr auto shift = 31 + std::bit_width(uint32_t{divisor_ - 1});
+    constexpr auto multiplier = static_cast<int64_t>(
+        ((uint64_t{1} << shift) / uint64_t{divisor_}) + 1U);
+    const auto quotient = static_cast<int32_t>(
+        (int64_t{dividend} * multiplier) >> shift);
+    return (dividend < 0) ? (quotient + 1) : quotient;
+  }
+  static_assert(divide<1'000>(30'000'000) == 30'000);
+  static_assert(divide<1'000>(-1'999) == -1);
+  static_assert(divide<10>(99'999) == 9'999);
+  static_assert(divide<10>(-10) == -1);
+
+  /// Integer square root, rounded to nearest. It is computed bit by bit, so it
+  /// needs neither a multiplier nor a divider.
+  constexpr uint32_t isqrt(uint64_t value) {
+    auto root = uint64_t{0U};
+    auto bit = uint64_t{1U} << 62U;
+    while (bit > value) {
+      bit >>= 2U;
+    }
+    while (bit != 0U) {
+      if (value >= root + bit) {
+        value -= root + bit;
+        root = (root >> 1U) + bit;
+      } else {
+        root >>= 1U;
+      }
+      bit >>= 2U;
+    }
+    // `value` is the remainder now
+    if ((value > root) && (root < 0xffff'ffffU)) {
+      ++root;
+    }
+    return static_cast<uint32_t>(root);
+  }
+  static_assert(isqrt(0U) == 0U);
+  static_assert(isqrt(2U) == 1U);
+  static_assert(isqrt(3U) == 2U);
+  static_assert(isqrt(uint64_t{0x7f'ffff} * 0x7f'ffff) == 0x7f'ffffU);
+  static_assert(isqrt(~uint64_t{0U}) == 0xffff'ffffU);
+
   /// Prints a `number` right-aligned and padded to `field_length` with the
   /// defined `padding` character.
   void format_number(char *buffer, Size field_length, int number,
@@ -66,12 +114,18 @@ namespace meter {
                         fractional);
         }
       } else {
-        // indicate overload
-        buffer[0] = ' ';
-        buffer[1] = ' ';
-        buffer[2] = ' ';
-        buffer[3] = 'O';
-        buffer[4] = 'L';
+        // indicate overload in the last two digits
+        constexpr auto digits = integral_digits + fractional_digits;
+        constexpr auto position = [](const int digit) {
+          return ((fractional_digits > 0) && (digit >= integral_digits))
+                     ? digit + 1
+                     : digit;
+        };
+        for (auto i = 0; i < position(digits - 1); ++i) {
+          buffer[i] = ' ';
+        }
+        buffer[position(digits - 2)] = 'O';
+        buffer[position(digits - 1)] = 'L';
       }
     }
 
@@ -102,6 +156,15 @@ namespace meter {
     return 0;
   }
 
+  inline Size print(char *const buffer, Size const buffer_length,
+                    const int64_t value) {
+    const auto result = std::to_chars(buffer, buffer + buffer_length, value);
+    if (result.ec == std::errc{}) {
+      return result.ptr - buffer;
+    }
+    return 0;
+  }
+
   inline Size print(char *const buffer, Size const buffer_length,
                     const char *const string) {
     auto i = 0;
@@ -118,6 +181,36 @@ namespace meter {
     return i;
   }
 
+  /// A number of millionths, which is printed as a decimal number of units,
+  /// e.g. a reading in uV in V.
+  struct Millionths {
+      int64_t value;
+  };
+
+  inline Size print(char *const buffer, Size const buffer_length,
+                    const Millionths number) {
+    const auto magnitude = (number.value < 0)
+                               ? 0U - static_cast<uint64_t>(number.value)
+                               : static_cast<uint64_t>(number.value);
+    auto *first = buffer;
+    if ((number.value < 0) && (buffer_length > 0)) {
+      *first = '-';
+      ++first;
+    }
+    const auto last = buffer + buffer_length;
+    const auto result = std::to_chars(first, last, magnitude / 1'000'000U);
+    if ((result.ec != std::errc{}) || (last - result.ptr < 7)) {
+      return 0;
+    }
+    *result.ptr = '.';
+    auto fraction = static_cast<uint32_t>(magnitude % 1'000'000U);
+    for (auto i = 6; i > 0; --i) {
+      result.ptr[i] = static_cast<char>('0' + (fraction % 10U));
+      fraction /= 10U;
+    }
+    return result.ptr + 7 - buffer;
+  }
+
   template <Size string_length_>
   inline Size print(char *const buffer, Size const buffer_length,
                     Array<char, string_length_> const &string) {
@@ -4,24 +4,157 @@
 #define MSPMETER_7SEGMENT_HPP
 
 #include "../future.hpp"
+#include "../util.hpp"
+
+#include <cstdlib>
 
 namespace meter {
 
-  u8 to_7segment(char character);
-  u8 to_7segment(char character, bool decimal_point);
+  namespace segment {
 
-  template <Size display_size, Size buffer_size>
-  void to_7segment(Slice<u8, display_size> display_buffer,
-                   const Array<char, buffer_size> &text_buffer) {
-    const auto *str = text_buffer.begin();
+    //   -a-
+    // f|   |b
+    //   -g-
+    // e|   |c
+    //   -d- o DP
+    constexpr auto a = u8{0x20U};
+    constexpr auto b = u8{0x10U};
+    constexpr auto c = u8{0x02U};
+    constexpr auto d = u8{0x04U};
+    constexpr auto e = u8{0x08U};
+    constexpr auto f = u8{0x80U};
+    constexpr auto g = u8{0x40U};
+    constexpr auto DP = u8{0x01U};
+
+  } // namespace segment
+
+  /// The segments of every ASCII character, blank for those that cannot be
+  /// shown.
+  constexpr Array<u8, 128> make_glyph_table() {
+    using namespace segment;
+    auto table = Array<u8, 128>{};
+    table['-'] = g;
+    table['0'] = a | b | c | d | e | f;
+    table['1'] = b | c;
+    table['2'] = a | b | d | e | g;
+    table['3'] = a | b | c | d | g;
+    table['4'] = b | c | f | g;
+    table['5'] = a | c | d | f | g;
+    table['6'] = a | c | d | e | f | g;
+    table['7'] = a | b | c;
+    table['8'] = a | b | c | d | e | f | g;
+    table['9'] = a | b | c | d | f | g;
+    table['A'] = a | b | c | e | f | g;
+    table['C'] = a | d | e | f;
+    table['E'] = a | d | e | f | g;
+    table['F'] = a | e | f | g;
+    table['G'] = a | c | d | e | f;
+    table['H'] = b | c | e | f | g;
+    table['L'] = d | e | f;
+    table['O'] = table['0'];
+    table['P'] = a | b | e | f | g;
+    table['S'] = table['5'];
+    table['U'] = b | c | d | e | f;
+    table['Y'] = b | c | f | g;
+    table['b'] = c | d | e | f | g;
+    table['c'] = d | e | g;
+    table['d'] = b | c | d | e | g;
+    table['f'] = a | e | f | g;
+    table['h'] = c | e | f | g;
+    table['i'] = e;
+    table['j'] = c | d;
+    table['n'] = c | e | g;
+    table['o'] = c | d | e | g;
+    table['r'] = e | g;
+    table['t'] = d | e | f | g;
+    table['u'] = c | d | e;
+    return table;
+  }
+
+  inline constexpr auto glyph_table = make_glyph_table();
+
+  constexpr u8 to_7segment(const char character) {
+    const auto index = static_cast<unsigned char>(character);
+    return (index < glyph_table.size()) ? glyph_table[index] : u8{0U};
+  }
+
+  constexpr u8 to_7segment(const char character, const bool decimal_point) {
+    return to_7segment(character) | (decimal_point ? segment::DP : u8{0U});
+  }
+
+  /// Shows a string, where a '.' lights the decimal point of the preceding
+  /// character. The digits after the end of the string are blanked.
+  template <Size display_size>
+  constexpr void to_7segment(Slice<u8, display_size> display_buffer,
+                             const char *str) {
     for (auto i = 0; i < display_size; ++i) {
-      if (*(str + 1) == '.') {
-        display_buffer[i] = ~to_7segment(*str, true);
-        ++str;
-      } else {
-        display_buffer[i] = ~to_7segment(*str);
+      auto glyph = u8{0U};
+      if (*str != '\0') {
+        const auto decimal_point = *(str + 1) == '.';
+        glyph = to_7segment(*str, decimal_point);
+        str += decimal_point ? 2 : 1;
       }
-      ++str;
+      display_buffer[i] = ~glyph;
+    }
+  }
+
+  template <Size display_size, Size buffer_size>
+  constexpr void to_7segment(Slice<u8, display_size> display_buffer,
+                             const Array<char, buffer_size> &text_buffer) {
+    to_7segment(display_buffer, text_buffer.data());
+  }
+
+  /// Renders a number with the resolution of `fractional_digits` directly
+  /// into the segments of the display, exactly like `format_readout()`
+  /// followed by `to_7segment()`, but without the text in between.
+  ///    The digits are extracted by subtracting powers of ten, at most nine
+  /// times per digit, instead of dividing by ten, which the MSP430 does in
+  /// software.
+  template <int integral_digits, int fractional_digits, Size display_size>
+    requires(integral_digits > 0
+             && integral_digits + fractional_digits == display_size)
+  constexpr void render_readout(Slice<u8, display_size> display_buffer,
+                                const int number) {
+    constexpr auto powers = [] {
+      auto result = Array<int, display_size + 1>{};
+      for (auto i = 0; i <= display_size; ++i) {
+        result[i] = ipow10(display_size - i);
+      }
+      return result;
+    }();
+    const auto magnitude = std::abs(number);
+
+    // the minus sign takes the place of the first digit
+    if (magnitude < powers[(number < 0) ? 1 : 0]) {
+      auto remainder = magnitude;
+      auto leading = true;
+      for (auto i = 0; i < display_size; ++i) {
+        auto digit = 0;
+        while (remainder >= powers[i + 1]) {
+          remainder -= powers[i + 1];
+          ++digit;
+        }
+        leading = leading && (digit == 0);
+        // leading zeros of the integral part are blanked
+        const auto shown = (i >= integral_digits - 1) || !leading;
+        display_buffer[i] = ~(shown ? glyph_table['0' + digit] : u8{0U});
+      }
+    } else {
+      // indicate overload
+      for (auto i = 0; i < display_size - 2; ++i) {
+        display_buffer[i] = ~u8{0U};
+      }
+      display_buffer[display_size - 2] = ~glyph_table['O'];
+      display_buffer[display_size - 1] = ~glyph_table['L'];
+    }
+
+    if (number < 0) {
+      display_buffer[0] = ~glyph_table['-'];
+    }
+
+    if (fractional_digits > 0) {
+      display_buffer[integral_digits - 1] =
+          display_buffer[integral_digits - 1] & ~segment::DP;
     }
   }
 
@@ -2,6 +2,9 @@
 
 #include "7segment.hpp"
 
+#include "../util.hpp"
+
+#include <catch2/benchmark/catch_benchmark.hpp>
 #include <catch2/catch_test_macros.hpp>
 
 namespace meter {
@@ -31,6 +34,95 @@ namespace meter {
         }
       }
     }
+
+    GIVEN("a string shorter than the display") {
+      WHEN("") {
+        buffer.fill(u8{0x00U});
+        to_7segment(Slice{buffer}, "E.r");
+        THEN("the remaining digits are blanked") {
+          REQUIRE(
+              buffer
+              == Array<u8, 4>{~u8{0xedU}, ~u8{0x48U}, ~u8{0x00U}, ~u8{0x00U}});
+        }
+      }
+    }
+  }
+
+  namespace {
+
+    /// \return Whether `render_readout()` shows the same as the text path
+    ///    for all numbers in [`first`, `last`].
+    template <int integral_digits, int fractional_digits>
+    bool renders_like_text(const int first, const int last) {
+      constexpr auto digits = integral_digits + fractional_digits;
+      for (auto number = first; number <= last; ++number) {
+        auto text = Array<char, 6>{};
+        auto expected = Array<u8, digits>{};
+        format_readout<integral_digits, fractional_digits>(Slice{text}, number);
+        to_7segment(Slice{expected}, text);
+
+        auto actual = Array<u8, digits>{};
+        render_readout<integral_digits, fractional_digits>(Slice{actual},
+                                                           number);
+        if (!(actual == expected)) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+  } // namespace
+
+  SCENARIO("rendering readings directly into segments") {
+    GIVEN("the formats of the display") {
+      THEN("the result equals formatting and converting the text") {
+        CHECK(renders_like_text<1, 3>(-11'000, 11'000));
+        CHECK(renders_like_text<2, 2>(-11'000, 11'000));
+        CHECK(renders_like_text<4, 0>(-1'100, 11'000));
+        CHECK(renders_like_text<1, 1>(-110, 110));
+      }
+    }
+
+    GIVEN("an overload") {
+      auto buffer = Array<u8, 4>{};
+      WHEN("rendering") {
+        render_readout<2, 2>(Slice{buffer}, -1'000);
+        THEN("OL is shown with the sign") {
+          REQUIRE(
+              buffer
+              == Array<u8, 4>{~u8{0x40U}, ~u8{0x01U}, ~u8{0xbeU}, ~u8{0x8cU}});
+        }
+      }
+    }
+
+    GIVEN("the glyph table") {
+      THEN("it is evaluated at compile time") {
+        STATIC_REQUIRE(to_7segment('8') == u8{0xfeU});
+        STATIC_REQUIRE(to_7segment('.') == u8{0x00U});
+        STATIC_REQUIRE(to_7segment(static_cast<char>(0x80)) == u8{0x00U});
+      }
+    }
+  }
+
+  // host time, which hides the software division of the text path on the
+  // MSP430
+  TEST_CASE("cost of rendering a reading") {
+    auto segments = Array<u8, 4>{};
+    auto number = 0;
+
+    BENCHMARK("format_readout() and to_7segment()") {
+      auto text = Array<char, 6>{};
+      number = (number + 7) % 10'000;
+      format_readout<1, 3>(Slice{text}, number);
+      to_7segment(Slice{segments}, text);
+      return segments[3];
+    };
+
+    BENCHMARK("render_readout()") {
+      number = (number + 7) % 10'000;
+      render_readout<1, 3>(Slice{segments}, number);
+      return segments[3];
+    };
   }
 
 } // namespace meter
@@ -0,0 +1,77 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#ifndef MSPMETER_COBS_HPP
+#define MSPMETER_COBS_HPP
+
+#include "../future.hpp"
+
+namespace meter {
+
+  /// The worst-case length of `length` bytes after COBS encoding, without the
+  /// frame delimiter.
+  constexpr Size cobs_max_encoded_length(const Size length) {
+    return length + (length / 254) + 1;
+  }
+
+  /// Consistent Overhead Byte Stuffing: encodes `length` bytes from `source`
+  /// into `destination`, so that the result contains no zero bytes. The frame
+  /// delimiter (a zero byte) is not appended.
+  ///    `destination` must hold at least `cobs_max_encoded_length(length)`
+  /// bytes and must not overlap `source`.
+  /// \return The number of encoded bytes.
+  constexpr Size cobs_encode(const uint8_t *const source, const Size length,
+                             uint8_t *const destination) {
+    auto code_index = Size{0};
+    auto write_index = Size{1};
+    auto code = uint8_t{1U};
+
+    for (auto read_index = Size{0}; read_index < length; ++read_index) {
+      if (source[read_index] != 0U) {
+        destination[write_index] = source[read_index];
+        ++write_index;
+        ++code;
+      }
+      if ((source[read_index] == 0U) || (code == 0xffU)) {
+        destination[code_index] = code;
+        code_index = write_index;
+        ++write_index;
+        code = 1U;
+      }
+    }
+    destination[code_index] = code;
+    return write_index;
+  }
+
+  /// Decodes a COBS frame without its delimiter. In-place decoding, i.e.
+  /// `destination == source`, is supported.
+  /// \return The number of decoded bytes or -1, if the frame is malformed.
+  constexpr Size cobs_decode(const uint8_t *const source, const Size length,
+                             uint8_t *const destination) {
+    auto read_index = Size{0};
+    auto write_index = Size{0};
+
+    while (read_index < length) {
+      const auto code = source[read_index];
+      if ((code == 0U) || (read_index + code > length)) {
+        return -1;
+      }
+      ++read_index;
+      for (auto i = 1; i < code; ++i) {
+        if (source[read_index] == 0U) {
+          return -1;
+        }
+        destination[write_index] = source[read_index];
+        ++write_index;
+        ++read_index;
+      }
+      if ((code != 0xffU) && (read_index < length)) {
+        destination[write_index] = 0U;
+        ++write_index;
+      }
+    }
+    return write_index;
+  }
+
+} // namespace meter
+
+#endif // MSPMETER_COBS_HPP
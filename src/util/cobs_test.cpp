@@ -0,0 +1,69 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#include "cobs.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <vector>
+
+namespace meter {
+
+  namespace {
+
+    std::vector<uint8_t> encode(const std::vector<uint8_t> &data) {
+      auto encoded = std::vector<uint8_t>(static_cast<std::size_t>(
+          cobs_max_encoded_length(static_cast<Size>(data.size()))));
+      encoded.resize(static_cast<std::size_t>(cobs_encode(
+          data.data(), static_cast<Size>(data.size()), encoded.data())));
+      return encoded;
+    }
+
+    std::vector<uint8_t> decode(std::vector<uint8_t> encoded) {
+      const auto length = cobs_decode(
+          encoded.data(), static_cast<Size>(encoded.size()), encoded.data());
+      REQUIRE(length >= 0);
+      encoded.resize(static_cast<std::size_t>(length));
+      return encoded;
+    }
+
+  } // namespace
+
+  SCENARIO("consistent overhead byte stuffing") {
+    GIVEN("the examples from the original paper") {
+      CHECK(encode({0x00}) == std::vector<uint8_t>{0x01, 0x01});
+      CHECK(encode({0x00, 0x00}) == std::vector<uint8_t>{0x01, 0x01, 0x01});
+      CHECK(encode({0x11, 0x22, 0x00, 0x33})
+            == std::vector<uint8_t>{0x03, 0x11, 0x22, 0x02, 0x33});
+      CHECK(encode({0x11, 0x00, 0x00, 0x00})
+            == std::vector<uint8_t>{0x02, 0x11, 0x01, 0x01, 0x01});
+    }
+
+    GIVEN("data of every length up to several 254-byte blocks") {
+      auto data = std::vector<uint8_t>{};
+      for (auto length = 0; length < 600; ++length) {
+        const auto encoded = encode(data);
+
+        REQUIRE(std::ranges::find(encoded, 0U) == encoded.end());
+        REQUIRE(static_cast<Size>(encoded.size())
+                <= cobs_max_encoded_length(static_cast<Size>(data.size())));
+        REQUIRE(decode(encoded) == data);
+
+        // every seventh byte is zero, the rest is non-zero
+        data.push_back(static_cast<uint8_t>((length % 7 == 0) ? 0 : length));
+      }
+    }
+
+    GIVEN("malformed frames") {
+      auto frame = std::vector<uint8_t>{0x05, 0x11, 0x22};
+      THEN("a code pointing beyond the end is rejected") {
+        CHECK(cobs_decode(frame.data(), 3, frame.data()) == -1);
+      }
+      frame = {0x03, 0x11, 0x00};
+      THEN("an embedded zero is rejected") {
+        CHECK(cobs_decode(frame.data(), 3, frame.data()) == -1);
+      }
+    }
+  }
+
+} // namespace meter
@@ -0,0 +1,84 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#ifndef MSPMETER_CRC16_HPP
+#define MSPMETER_CRC16_HPP
+
+#include "../future.hpp"
+
+namespace meter {
+
+  /// Table-driven CRC-16 with the lookup table generated at compile time.
+  /// \tparam polynomial_ The generator polynomial in normal (MSB-first)
+  ///    representation.
+  /// \tparam reflected_ Whether bytes are processed LSB-first, as with
+  ///    Modbus.
+  template <uint16_t polynomial_, uint16_t initial_, bool reflected_>
+  class Crc16 {
+    public:
+      static constexpr uint16_t initial = initial_;
+
+      static constexpr uint16_t update(const uint16_t crc, const uint8_t byte) {
+        if constexpr (reflected_) {
+          return static_cast<uint16_t>(
+              (crc >> 8U) ^ table_[static_cast<uint8_t>(crc ^ byte)]);
+        } else {
+          return static_cast<uint16_t>(
+              (crc << 8U) ^ table_[static_cast<uint8_t>((crc >> 8U) ^ byte)]);
+        }
+      }
+
+      static constexpr uint16_t compute(const uint8_t *const data,
+                                        const Size length,
+                                        uint16_t crc = initial_) {
+        for (auto i = Size{0}; i < length; ++i) {
+          crc = update(crc, data[i]);
+        }
+        return crc;
+      }
+
+    private:
+      static constexpr uint16_t reverse(uint16_t value) {
+        auto result = uint16_t{0U};
+        for (auto i = 0; i < 16; ++i) {
+          result = static_cast<uint16_t>((result << 1U) | (value & 1U));
+          value = static_cast<uint16_t>(value >> 1U);
+        }
+        return result;
+      }
+
+      static constexpr Array<uint16_t, 256> make_table() {
+        auto table = Array<uint16_t, 256>{};
+        for (auto i = 0; i < 256; ++i) {
+          auto crc = uint16_t{0U};
+          if constexpr (reflected_) {
+            crc = static_cast<uint16_t>(i);
+            for (auto bit = 0; bit < 8; ++bit) {
+              crc = ((crc & 1U) != 0U)
+                        ? static_cast<uint16_t>((crc >> 1U)
+                                                ^ reverse(polynomial_))
+                        : static_cast<uint16_t>(crc >> 1U);
+            }
+          } else {
+            crc = static_cast<uint16_t>(i << 8U);
+            for (auto bit = 0; bit < 8; ++bit) {
+              crc = ((crc & 0x8000U) != 0U)
+                        ? static_cast<uint16_t>((crc << 1U) ^ polynomial_)
+                        : static_cast<uint16_t>(crc << 1U);
+            }
+          }
+          table[i] = crc;
+        }
+        return table;
+      }
+
+      static constexpr auto table_ = make_table();
+  };
+
+  /// CRC-16/CCITT-FALSE as used by the binary telemetry frames
+  using Crc16_ccitt = Crc16<0x1021U, 0xffffU, false>;
+  /// CRC-16/MODBUS, sent low byte first
+  using Crc16_modbus = Crc16<0x8005U, 0xffffU, true>;
+
+} // namespace meter
+
+#endif // MSPMETER_CRC16_HPP
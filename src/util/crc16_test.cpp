@@ -0,0 +1,57 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#include "crc16.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+
+namespace meter {
+
+  namespace {
+
+    constexpr auto check_input = Array<uint8_t, 9>{
+        {'1', '2', '3', '4', '5', '6', '7', '8', '9'}};
+
+    /// bitwise reference implementation, MSB-first
+    uint16_t crc16_ccitt_bitwise(const uint8_t *const data, const Size length) {
+      auto crc = uint16_t{0xffffU};
+      for (auto i = Size{0}; i < length; ++i) {
+        crc = static_cast<uint16_t>(crc ^ (data[i] << 8U));
+        for (auto bit = 0; bit < 8; ++bit) {
+          crc = ((crc & 0x8000U) != 0U)
+                    ? static_cast<uint16_t>((crc << 1U) ^ 0x1021U)
+                    : static_cast<uint16_t>(crc << 1U);
+        }
+      }
+      return crc;
+    }
+
+  } // namespace
+
+  static_assert(Crc16_ccitt::compute(check_input.data(), check_input.size())
+                == 0x29b1U);
+  static_assert(Crc16_modbus::compute(check_input.data(), check_input.size())
+                == 0x4b37U);
+
+  SCENARIO("table-driven CRC-16") {
+    GIVEN("arbitrary data") {
+      auto data = Array<uint8_t, 64>{};
+      for (auto i = Size{0}; i < data.size(); ++i) {
+        data[i] = static_cast<uint8_t>((i * 37) ^ 0x5a);
+      }
+
+      THEN("the result matches the bitwise computation for every length") {
+        for (auto length = Size{0}; length <= data.size(); ++length) {
+          CHECK(Crc16_ccitt::compute(data.data(), length)
+                == crc16_ccitt_bitwise(data.data(), length));
+        }
+      }
+
+      THEN("the computation can be continued") {
+        const auto crc = Crc16_ccitt::compute(data.data(), 20);
+        CHECK(Crc16_ccitt::compute(data.data() + 20, 44, crc)
+              == Crc16_ccitt::compute(data.data(), 64));
+      }
+    }
+  }
+
+} // namespace meter
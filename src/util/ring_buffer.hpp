@@ -0,0 +1,97 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#ifndef MSPMETER_RING_BUFFER_HPP
+#define MSPMETER_RING_BUFFER_HPP
+
+#include "../future.hpp"
+
+#include <atomic>
+
+namespace meter {
+
+  /// Lock-free ring buffer for exactly one producer and one consumer, e.g. an
+  /// interrupt service routine and the main loop.
+  ///    The read and write counters are free-running 16-bit values, which are
+  /// read and written atomically by the MSP430. Each counter is only ever
+  /// written by one side, so no critical section is necessary.
+  template <typename Tp_, Size nm_> class Ring_buffer {
+    public:
+      using value_type = Tp_;
+      using size_type = Size;
+
+      static_assert((nm_ > 0) && ((nm_ & (nm_ - 1)) == 0),
+                    "capacity must be a power of two");
+      static_assert(nm_ <= 0x8000);
+
+      constexpr size_type capacity() const noexcept { return nm_; }
+
+      size_type size() const noexcept {
+        return static_cast<uint16_t>(head_ - tail_);
+      }
+
+      bool empty() const noexcept { return head_ == tail_; }
+      bool full() const noexcept { return size() == nm_; }
+
+      /// To be called by the producer only.
+      /// \return Whether there was space left for `item`.
+      bool push(const Tp_ &item) {
+        const uint16_t head = head_;
+        if (static_cast<uint16_t>(head - tail_) == nm_) {
+          return false;
+        }
+        items_[head & mask_] = item;
+        std::atomic_signal_fence(std::memory_order_release);
+        head_ = static_cast<uint16_t>(head + 1U);
+        return true;
+      }
+
+      /// To be called by the consumer only.
+      /// \return Whether an item was available and has been moved to `item`.
+      bool pop(Tp_ &item) {
+        const uint16_t tail = tail_;
+        if (head_ == tail) {
+          return false;
+        }
+        std::atomic_signal_fence(std::memory_order_acquire);
+        item = items_[tail & mask_];
+        std::atomic_signal_fence(std::memory_order_release);
+        tail_ = static_cast<uint16_t>(tail + 1U);
+        return true;
+      }
+
+      /// To be called by the consumer only.
+      /// \return The item `index` positions behind the oldest one.
+      const Tp_ &peek(const size_type index) const {
+        std::atomic_signal_fence(std::memory_order_acquire);
+        return items_[static_cast<uint16_t>(tail_ + index) & mask_];
+      }
+
+      /// Removes `count` items, which follow the oldest `offset` items, i.e.
+      /// the oldest items are moved up. To be called by the consumer only.
+      void erase(const size_type offset, const size_type count) {
+        const uint16_t tail = tail_;
+        for (auto i = offset; i > 0; --i) {
+          items_[static_cast<uint16_t>(tail + count + i - 1) & mask_] =
+              items_[static_cast<uint16_t>(tail + i - 1) & mask_];
+        }
+        std::atomic_signal_fence(std::memory_order_release);
+        tail_ = static_cast<uint16_t>(tail + count);
+      }
+
+      /// Discards all items. Must not be called while the producer is active.
+      void clear() {
+        head_ = 0U;
+        tail_ = 0U;
+      }
+
+    private:
+      static constexpr auto mask_ = static_cast<uint16_t>(nm_ - 1);
+
+      Array<Tp_, nm_> items_{};
+      volatile uint16_t head_{0U};
+      volatile uint16_t tail_{0U};
+  };
+
+} // namespace meter
+
+#endif // MSPMETER_RING_BUFFER_HPP
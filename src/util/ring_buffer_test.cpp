@@ -0,0 +1,77 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#include "ring_buffer.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+
+namespace meter {
+
+  SCENARIO("single-producer/single-consumer ring buffer") {
+    auto ring = Ring_buffer<int, 4>{};
+
+    GIVEN("an empty ring") {
+      auto item = 0;
+      REQUIRE(ring.empty());
+      REQUIRE_FALSE(ring.pop(item));
+
+      WHEN("pushing up to its capacity") {
+        for (auto i = 0; i < 4; ++i) {
+          REQUIRE(ring.push(i));
+        }
+        THEN("it is full and rejects further items") {
+          CHECK(ring.full());
+          CHECK(ring.size() == 4);
+          CHECK_FALSE(ring.push(4));
+        }
+        THEN("items are popped in order") {
+          for (auto i = 0; i < 4; ++i) {
+            REQUIRE(ring.pop(item));
+            CHECK(item == i);
+          }
+          CHECK(ring.empty());
+        }
+      }
+    }
+
+    GIVEN("a ring that was filled and drained many times") {
+      auto item = 0;
+      for (auto i = 0; i < 70'000; ++i) {
+        REQUIRE(ring.push(i));
+        REQUIRE(ring.pop(item));
+        REQUIRE(item == i);
+      }
+      THEN("the wrapping counters still yield the correct size") {
+        REQUIRE(ring.push(1));
+        REQUIRE(ring.push(2));
+        CHECK(ring.size() == 2);
+      }
+    }
+
+    GIVEN("a full ring, whose items wrap around the end of the storage") {
+      auto item = 0;
+      REQUIRE(ring.push(-1));
+      REQUIRE(ring.pop(item));
+      for (auto i = 0; i < 4; ++i) {
+        REQUIRE(ring.push(i));
+      }
+
+      THEN("items can be peeked at without removing them") {
+        CHECK(ring.peek(0) == 0);
+        CHECK(ring.peek(3) == 3);
+        CHECK(ring.size() == 4);
+      }
+
+      WHEN("erasing items behind the oldest one") {
+        ring.erase(1, 2);
+        THEN("the remaining items keep their order") {
+          REQUIRE(ring.size() == 2);
+          REQUIRE(ring.pop(item));
+          CHECK(item == 0);
+          REQUIRE(ring.pop(item));
+          CHECK(item == 3);
+        }
+      }
+    }
+  }
+
+} // namespace meter
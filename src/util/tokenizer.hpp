@@ -0,0 +1,92 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#ifndef MSPMETER_TOKENIZER_HPP
+#define MSPMETER_TOKENIZER_HPP
+
+#include "../future.hpp"
+
+#include <charconv>
+#include <string_view>
+
+namespace meter {
+
+  /// Splits a line into words separated by spaces or tabs. The words refer to
+  /// the line, nothing is copied.
+  class Tokenizer {
+    public:
+      constexpr explicit Tokenizer(const std::string_view line)
+          : rest_{line} {}
+
+      /// \return The next word or an empty view at the end of the line.
+      constexpr std::string_view next() {
+        skip_blanks();
+        const auto end = std::min(rest_.find_first_of(" \t"), rest_.size());
+        const auto word = rest_.substr(0, end);
+        rest_.remove_prefix(end);
+        return word;
+      }
+
+      constexpr bool done() {
+        skip_blanks();
+        return rest_.empty();
+      }
+
+    private:
+      constexpr void skip_blanks() {
+        rest_.remove_prefix(
+            std::min(rest_.find_first_not_of(" \t"), rest_.size()));
+      }
+
+      std::string_view rest_;
+  };
+
+  constexpr char to_lower(const char c) {
+    return ((c >= 'A') && (c <= 'Z')) ? static_cast<char>(c - 'A' + 'a') : c;
+  }
+
+  /// Compares a word with a lower-case `keyword`, ignoring the case of the
+  /// word.
+  constexpr bool matches(const std::string_view word,
+                         const std::string_view keyword) {
+    if (word.size() != keyword.size()) {
+      return false;
+    }
+    for (auto i = std::size_t{0}; i < word.size(); ++i) {
+      if (to_lower(word[i]) != keyword[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /// Compares a word with a SCPI `mnemonic` like "MEASure", which matches in
+  /// its short form, the leading capitals, or in full, ignoring the case of
+  /// the word.
+  constexpr bool matches_mnemonic(const std::string_view word,
+                                  const std::string_view mnemonic) {
+    const auto short_length =
+        std::min(mnemonic.find_first_not_of("*ABCDEFGHIJKLMNOPQRSTUVWXYZ"),
+                 mnemonic.size());
+    if ((word.size() != short_length) && (word.size() != mnemonic.size())) {
+      return false;
+    }
+    for (auto i = std::size_t{0}; i < word.size(); ++i) {
+      if (to_lower(word[i]) != to_lower(mnemonic[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /// \return Whether `word` is a complete decimal number, which fits into
+  ///    `value`.
+  template <typename Tp_>
+  bool parse(const std::string_view word, Tp_ &value) {
+    const auto *const last = word.data() + word.size();
+    const auto result = std::from_chars(word.data(), last, value);
+    return !word.empty() && (result.ec == std::errc{}) && (result.ptr == last);
+  }
+
+} // namespace meter
+
+#endif // MSPMETER_TOKENIZER_HPP
@@ -0,0 +1,50 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#include "tokenizer.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+
+namespace meter {
+
+  SCENARIO("splitting a command line into words") {
+    GIVEN("a line with irregular blanks") {
+      auto tokens = Tokenizer{"  cal\t2  offset "};
+
+      THEN("the words are returned in order") {
+        CHECK(tokens.next() == "cal");
+        CHECK(tokens.next() == "2");
+        CHECK_FALSE(tokens.done());
+        CHECK(tokens.next() == "offset");
+        CHECK(tokens.done());
+        CHECK(tokens.next().empty());
+      }
+    }
+
+    GIVEN("keywords") {
+      CHECK(matches("AVG?", "avg?"));
+      CHECK(matches("avg", "avg"));
+      CHECK_FALSE(matches("avg", "avg?"));
+      CHECK_FALSE(matches("avh", "avg"));
+    }
+
+    GIVEN("SCPI mnemonics") {
+      CHECK(matches_mnemonic("MEAS", "MEASure"));
+      CHECK(matches_mnemonic("measure", "MEASure"));
+      CHECK(matches_mnemonic("*idn", "*IDN"));
+      CHECK_FALSE(matches_mnemonic("meas?", "MEASure"));
+      CHECK_FALSE(matches_mnemonic("measu", "MEASure"));
+      CHECK_FALSE(matches_mnemonic("", "MEASure"));
+    }
+
+    GIVEN("numbers") {
+      auto value = int32_t{};
+      CHECK(parse("-8388608", value));
+      CHECK(value == -8'388'608);
+      CHECK_FALSE(parse("12x", value));
+      CHECK_FALSE(parse("", value));
+      auto small = uint8_t{};
+      CHECK_FALSE(parse("256", small));
+    }
+  }
+
+} // namespace meter
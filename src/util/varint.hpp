@@ -0,0 +1,62 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#ifndef MSPMETER_VARINT_HPP
+#define MSPMETER_VARINT_HPP
+
+#include "../future.hpp"
+
+namespace meter {
+
+  /// The maximum length of an encoded 32-bit value.
+  constexpr auto varint_max_length = 5;
+
+  /// Maps signed values to unsigned ones, so that values of a small
+  /// magnitude become small: 0, -1, 1, -2, ... become 0, 1, 2, 3, ...
+  constexpr uint32_t zigzag_encode(const int32_t value) {
+    return (static_cast<uint32_t>(value) << 1U)
+           ^ ((value < 0) ? ~uint32_t{0U} : uint32_t{0U});
+  }
+
+  constexpr int32_t zigzag_decode(const uint32_t value) {
+    return static_cast<int32_t>((value >> 1U) ^ (~(value & 1U) + 1U));
+  }
+
+  static_assert(zigzag_encode(0) == 0U);
+  static_assert(zigzag_encode(-1) == 1U);
+  static_assert(zigzag_encode(1) == 2U);
+  static_assert(zigzag_encode(-0x80'0000) == 0xff'ffffU);
+  static_assert(zigzag_decode(zigzag_encode(INT32_MIN)) == INT32_MIN);
+
+  /// Writes `value` in groups of seven bits, least significant first, where
+  /// the most significant bit of a byte tells whether another one follows.
+  ///    `destination` must hold at least `varint_max_length` bytes.
+  /// \return The number of bytes written.
+  constexpr Size varint_encode(uint32_t value, uint8_t *const destination) {
+    auto length = Size{0};
+    while (value >= 0x80U) {
+      destination[length] = static_cast<uint8_t>(value | 0x80U);
+      value >>= 7U;
+      ++length;
+    }
+    destination[length] = static_cast<uint8_t>(value);
+    return length + 1;
+  }
+
+  /// Reads a value written by `varint_encode()` from at most `length` bytes.
+  /// \return The number of bytes read or 0, if the value is truncated or too
+  ///    long.
+  constexpr Size varint_decode(const uint8_t *const source, const Size length,
+                               uint32_t &value) {
+    value = 0U;
+    for (auto i = Size{0}; (i < length) && (i < varint_max_length); ++i) {
+      value |= uint32_t{source[i] & 0x7fU} << (7U * static_cast<unsigned>(i));
+      if ((source[i] & 0x80U) == 0U) {
+        return i + 1;
+      }
+    }
+    return 0;
+  }
+
+} // namespace meter
+
+#endif // MSPMETER_VARINT_HPP
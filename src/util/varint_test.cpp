@@ -0,0 +1,66 @@
+// Meter Firmware / Darius Kellermann <kellermann@protonmail.com>
+
+#include "varint.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
+
+#include <vector>
+
+namespace meter {
+
+  namespace {
+
+    std::vector<uint8_t> encode(const uint32_t value) {
+      auto encoded = std::vector<uint8_t>(varint_max_length);
+      encoded.resize(
+          static_cast<std::size_t>(varint_encode(value, encoded.data())));
+      return encoded;
+    }
+
+  } // namespace
+
+  SCENARIO("variable-length integers") {
+    GIVEN("values at the boundaries of the lengths") {
+      CHECK(encode(0U) == std::vector<uint8_t>{0x00});
+      CHECK(encode(0x7fU) == std::vector<uint8_t>{0x7f});
+      CHECK(encode(0x80U) == std::vector<uint8_t>{0x80, 0x01});
+      CHECK(encode(300U) == std::vector<uint8_t>{0xac, 0x02});
+      CHECK(encode(0x1f'ffffU) == std::vector<uint8_t>{0xff, 0xff, 0x7f});
+      CHECK(encode(0xffff'ffffU)
+            == std::vector<uint8_t>{0xff, 0xff, 0xff, 0xff, 0x0f});
+    }
+
+    GIVEN("a signed value") {
+      const auto value = GENERATE(0, 1, -1, 63, -64, 64, 0x7f'ffff,
+                                  -0x80'0000, INT32_MAX, INT32_MIN);
+
+      THEN("it survives the round trip") {
+        const auto encoded = encode(zigzag_encode(value));
+        auto decoded = uint32_t{};
+        REQUIRE(varint_decode(encoded.data(),
+                              static_cast<Size>(encoded.size()), decoded)
+                == static_cast<Size>(encoded.size()));
+        CHECK(zigzag_decode(decoded) == value);
+      }
+
+      THEN("a small magnitude takes a single byte") {
+        if ((value >= -64) && (value < 64)) {
+          CHECK(encode(zigzag_encode(value)).size() == 1);
+        }
+      }
+    }
+
+    GIVEN("malformed input") {
+      auto value = uint32_t{};
+      const auto truncated = std::vector<uint8_t>{0x80, 0x80};
+      const auto too_long =
+          std::vector<uint8_t>{0x80, 0x80, 0x80, 0x80, 0x80, 0x01};
+      THEN("it is rejected") {
+        CHECK(varint_decode(truncated.data(), 2, value) == 0);
+        CHECK(varint_decode(too_long.data(), 6, value) == 0);
+      }
+    }
+  }
+
+} // namespace meter